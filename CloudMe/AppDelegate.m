@@ -62,6 +62,17 @@
     return NO;
 }
 
+- (void)application:(UIApplication *)application handleEventsForBackgroundURLSession:(NSString *)identifier completionHandler:(void (^)())completionHandler {
+    // uploads and downloads went on while the application was not running, the cloud manager must report their completion
+#ifdef USE_SWIFT
+    StatusController * controller = (StatusController *)self.window.rootViewController;
+    [controller.testContext.manager handleEventsForBackgroundURLSession:identifier completionHandler:completionHandler];
+#else
+    BrowseController * controller = (BrowseController*)self.window.rootViewController;
+    [controller.cloudManager handleEventsForBackgroundURLSession:identifier completionHandler:completionHandler];
+#endif
+}
+
 - (void)applicationDidBecomeActive:(UIApplication *)application {
     // Restart any tasks that were paused (or not yet started) while the application was inactive. If the application was previously in the background, optionally refresh the user interface.
 #ifdef USE_SWIFT
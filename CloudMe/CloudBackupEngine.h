@@ -0,0 +1,92 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+#import "CloudManager.h"
+
+/** The figures of a backup run */
+@interface CloudBackupStats : NSObject
+
+/** the number of assets of the camera roll considered by the run, including the ones already backed up */
+@property (nonatomic, readonly) NSUInteger assetCount;
+
+/** the number of assets already backed up by a previous run */
+@property (nonatomic, readonly) NSUInteger skippedCount;
+
+@property (nonatomic, readonly) NSUInteger uploadedCount;
+@property (nonatomic, readonly) NSUInteger failedCount;
+@property (nonatomic, readonly) long long uploadedBytes;
+
+/** the time since the start of the run */
+@property (nonatomic, readonly) NSTimeInterval duration;
+
+/** the upload throughput of the run, in bytes per second */
+@property (nonatomic, readonly) double throughput;
+
+/** the highest resident memory of the application observed during the run, in bytes */
+@property (nonatomic, readonly) unsigned long long peakMemory;
+
+@end
+
+
+/** a block type called each time an asset has been backed up or has failed */
+typedef __strong void (^BackupProgressBlock) (CloudBackupStats * _Nonnull stats);
+
+/** This class backs up the camera roll into a cloud folder, incrementally: the assets already uploaded are recorded in a persistent index
+ * and skipped by the next runs. Assets are never loaded in memory as a whole: they are read by chunks into the spool file of a background
+ * upload, and the number of chunks read at the same time is bounded by a memory ceiling.
+ * @note methods must be called from the main thread, the blocks are called on the main thread.
+ */
+@interface CloudBackupEngine : NSObject
+
+/** create an engine backing up to the given folder, with an index in the application support directory */
+- (nonnull id) initWithManager:(CloudManager * _Nonnull)manager folder:(NSString * _Nonnull)folderIdentifier;
+
+- (nonnull id) initWithManager:(CloudManager * _Nonnull)manager folder:(NSString * _Nonnull)folderIdentifier indexURL:(NSURL * _Nonnull)indexURL;
+
+@property (nonatomic, readonly, nonnull) NSString * folderIdentifier;
+@property (nonatomic, readonly, nonnull) NSURL * indexURL;
+
+/** the maximum number of assets uploaded by a run, 0 for no limit. Default value is 0 */
+@property (nonatomic) NSUInteger maxAssets;
+
+/** the memory used for reading assets, in bytes. Default value is 32 MB */
+@property (nonatomic) unsigned long long memoryCeiling;
+
+/** the maximum number of assets being uploaded at the same time. Default value is 4 */
+@property (nonatomic) NSUInteger maxParallelUploads;
+
+@property (nonatomic, readonly) BOOL isRunning;
+
+/** the figures of the current or last run */
+@property (nonatomic, readonly, nullable) CloudBackupStats * stats;
+
+@property (nonatomic, copy, nullable) BackupProgressBlock progressHandler;
+
+/** back up the assets of the camera roll that are not in the index yet.
+ * @param result called when all uploads have ended: StatusOK, ForbiddenAccess if the photo library cannot be read, CloudErrorCancelled if stopped,
+ * or the status of the last failed upload.
+ */
+- (void) start:(ResultBlock _Nullable)result;
+
+/** stop queuing assets. The uploads already queued complete in the background, and are recorded in the index */
+- (void) stop;
+
+/** forget the assets backed up, so that the next run uploads the whole camera roll again */
+- (void) resetIndex;
+
+@end
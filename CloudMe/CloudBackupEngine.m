@@ -0,0 +1,252 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudBackupEngine.h"
+#import "CloudTransferManager.h"
+#import "CloudManagerInternal.h"
+#import <AssetsLibrary/AssetsLibrary.h>
+#import <mach/mach.h>
+
+static const unsigned long long kDefaultMemoryCeiling = 32 * 1024 * 1024;
+static const NSUInteger kDefaultParallelUploads = 4;
+
+// the index is written after this number of uploads, so that a killed application loses little
+static const NSUInteger kIndexSaveInterval = 20;
+
+@interface CloudBackupStats ()
+@property (nonatomic) NSUInteger assetCount;
+@property (nonatomic) NSUInteger skippedCount;
+@property (nonatomic) NSUInteger uploadedCount;
+@property (nonatomic) NSUInteger failedCount;
+@property (nonatomic) long long uploadedBytes;
+@property (nonatomic) NSDate * startDate;
+@property (nonatomic) NSTimeInterval duration;
+@property (nonatomic) unsigned long long peakMemory;
+@end
+
+@implementation CloudBackupStats
+
+- (double) throughput {
+    return self.duration > 0 ? self.uploadedBytes / self.duration : 0;
+}
+
+/** record the current resident memory of the application. Can be called from any thread */
+- (void) sampleMemory {
+    struct mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS) {
+        @synchronized(self) {
+            _peakMemory = MAX(_peakMemory, info.resident_size);
+        }
+    }
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"%d assets, %d skipped, %d uploaded (%.1f MB), %d failed in %.1f s: %.1f kB/s, peak memory %.1f MB",
+            (int)self.assetCount, (int)self.skippedCount, (int)self.uploadedCount, self.uploadedBytes / 1048576.0, (int)self.failedCount,
+            self.duration, self.throughput / 1024, self.peakMemory / 1048576.0];
+}
+
+@end
+
+
+@interface CloudBackupEngine ()
+@property (nonatomic) CloudManager * manager;
+@property (nonatomic) ALAssetsLibrary * library;
+@property (nonatomic) NSMutableDictionary * index; // asset URL -> identifier of the uploaded file
+@property (nonatomic) NSMutableArray * queuedAssets; // URLs of the assets to upload
+@property (nonatomic) NSUInteger uploading; // assets being read or uploaded
+@property (nonatomic) NSUInteger unsavedCount;
+@property (nonatomic) NSOperationQueue * spoolQueue;
+@property (nonatomic) CloudStatus status;
+@property (nonatomic, copy) ResultBlock resultHandler;
+@end
+
+@implementation CloudBackupEngine
+
+- (id) initWithManager:(CloudManager*)manager folder:(NSString*)folderIdentifier {
+    NSURL * support = [[[NSFileManager defaultManager] URLsForDirectory:NSApplicationSupportDirectory inDomains:NSUserDomainMask] firstObject];
+    // folder identifiers may contain '/'
+    NSString * name = [[folderIdentifier stringByReplacingOccurrencesOfString:@"/" withString:@"_"] stringByAppendingPathExtension:@"plist"];
+    return [self initWithManager:manager folder:folderIdentifier indexURL:[[support URLByAppendingPathComponent:[manager storageName:@"CloudBackup"]] URLByAppendingPathComponent:name]];
+}
+
+- (id) initWithManager:(CloudManager*)manager folder:(NSString*)folderIdentifier indexURL:(NSURL*)indexURL {
+    self = [super init];
+    if (self != nil) {
+        _manager = manager;
+        _folderIdentifier = folderIdentifier;
+        _indexURL = indexURL;
+        _memoryCeiling = kDefaultMemoryCeiling;
+        _maxParallelUploads = kDefaultParallelUploads;
+        _spoolQueue = [[NSOperationQueue alloc] init];
+        _spoolQueue.name = @"CloudBackupEngine";
+    }
+    return self;
+}
+
+- (NSMutableDictionary*) index {
+    if (_index == nil) {
+        _index = [NSMutableDictionary dictionaryWithContentsOfURL:self.indexURL] ?: [[NSMutableDictionary alloc] init];
+    }
+    return _index;
+}
+
+- (void) saveIndex {
+    self.unsavedCount = 0;
+    [[NSFileManager defaultManager] createDirectoryAtURL:[self.indexURL URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+    [self.index writeToURL:self.indexURL atomically:YES];
+}
+
+- (void) resetIndex {
+    self.index = [[NSMutableDictionary alloc] init];
+    [[NSFileManager defaultManager] removeItemAtURL:self.indexURL error:nil];
+}
+
+- (void) start:(ResultBlock)result {
+    if (self.isRunning) {
+        return;
+    }
+    _isRunning = YES;
+    _stats = [[CloudBackupStats alloc] init];
+    self.stats.startDate = [NSDate date];
+    [self.stats sampleMemory];
+    self.status = StatusOK;
+    self.resultHandler = result;
+    self.queuedAssets = [[NSMutableArray alloc] init];
+    if (self.library == nil) {
+        self.library = [[ALAssetsLibrary alloc] init];
+    }
+    // only the URLs are kept: the assets themselves are fetched when their upload starts
+    [self.library enumerateGroupsWithTypes:ALAssetsGroupSavedPhotos usingBlock:^(ALAssetsGroup * group, BOOL * stop) {
+        if (group == nil) { // end of the enumeration
+            [self pump];
+            return;
+        }
+        [group enumerateAssetsUsingBlock:^(ALAsset * asset, NSUInteger index, BOOL * stopAssets) {
+            NSString * url = [[asset valueForProperty:ALAssetPropertyAssetURL] absoluteString];
+            if (url == nil) {
+                return;
+            }
+            self.stats.assetCount++;
+            if (self.index[url] != nil) {
+                self.stats.skippedCount++;
+            } else {
+                [self.queuedAssets addObject:url];
+                if (self.maxAssets > 0 && self.queuedAssets.count >= self.maxAssets) {
+                    *stopAssets = YES;
+                    *stop = YES;
+                }
+            }
+        }];
+        if (*stop) { // no end of enumeration call when stopped
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [self pump];
+            });
+        }
+    } failureBlock:^(NSError * error) {
+        NSLog (@"Cannot read the camera roll: %@", error.localizedDescription);
+        self.status = ForbiddenAccess;
+        [self.queuedAssets removeAllObjects];
+        [self pump];
+    }];
+}
+
+- (void) stop {
+    if (self.isRunning == NO) {
+        return;
+    }
+    self.status = CloudErrorCancelled;
+    [self.queuedAssets removeAllObjects];
+    [self pump];
+}
+
+/** start uploading queued assets up to the parallel limit, or end the run when everything has been uploaded */
+- (void) pump {
+    if (self.isRunning == NO) {
+        return;
+    }
+    while (self.uploading < MAX(self.maxParallelUploads, 1) && self.queuedAssets.count > 0) {
+        NSString * url = self.queuedAssets.firstObject;
+        [self.queuedAssets removeObjectAtIndex:0];
+        self.uploading++;
+        [self backupAsset:url];
+    }
+    if (self.uploading == 0 && self.queuedAssets.count == 0) {
+        _isRunning = NO;
+        self.stats.duration = -[self.stats.startDate timeIntervalSinceNow];
+        [self saveIndex];
+        ResultBlock resultHandler = self.resultHandler;
+        self.resultHandler = nil;
+        if (resultHandler != nil) {
+            resultHandler (self.status);
+        }
+    }
+}
+
+- (void) backupAsset:(NSString*)url {
+    [self.library assetForURL:[NSURL URLWithString:url] resultBlock:^(ALAsset * asset) {
+        ALAssetRepresentation * representation = asset.defaultRepresentation;
+        if (representation == nil) { // removed since the enumeration
+            [self assetDidEnd:url size:0 transfer:nil];
+            return;
+        }
+        // each spooling holds one chunk in memory
+        NSUInteger chunkSize = self.manager.bandwidthEstimator.recommendedChunkSize;
+        self.spoolQueue.maxConcurrentOperationCount = (NSInteger)MAX(1, self.memoryCeiling / chunkSize);
+        [self.spoolQueue addOperationWithBlock:^{
+            [self.manager.transferManager uploadContentOfSize:representation.size chunkSize:chunkSize filename:representation.filename folderID:self.folderIdentifier
+                                                       reader:^NSUInteger(uint8_t * buffer, long long offset, NSUInteger length) {
+                                                           return [representation getBytes:buffer fromOffset:offset length:length error:nil];
+                                                       } result:^(CloudTransfer * transfer) {
+                                                           dispatch_async(dispatch_get_main_queue(), ^{
+                                                               [self assetDidEnd:url size:representation.size transfer:transfer];
+                                                           });
+                                                       }];
+            [self.stats sampleMemory];
+        }];
+    } failureBlock:^(NSError * error) {
+        [self assetDidEnd:url size:0 transfer:nil];
+    }];
+}
+
+/** record the end of the upload of an asset. transfer is nil if the asset could not be read */
+- (void) assetDidEnd:(NSString*)url size:(long long)size transfer:(CloudTransfer*)transfer {
+    [self.stats sampleMemory];
+    if (transfer.status == StatusOK && transfer.cloudItem.identifier != nil) {
+        self.stats.uploadedCount++;
+        self.stats.uploadedBytes += size;
+        self.index[url] = transfer.cloudItem.identifier;
+        if (++self.unsavedCount >= kIndexSaveInterval) {
+            [self saveIndex];
+        }
+    } else {
+        // not recorded in the index: the next run tries again
+        self.stats.failedCount++;
+        if (self.status == StatusOK) {
+            self.status = transfer != nil ? transfer.status : CloudErrorNotFound;
+        }
+    }
+    self.stats.duration = -[self.stats.startDate timeIntervalSinceNow];
+    if (self.progressHandler != nil) {
+        self.progressHandler (self.stats);
+    }
+    self.uploading--;
+    [self pump];
+}
+
+@end
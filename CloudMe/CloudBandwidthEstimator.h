@@ -0,0 +1,79 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+
+/** The versions of a file content that can be displayed, from the lightest to the heaviest */
+typedef NS_ENUM(NSInteger, CloudContentQuality) {
+    CloudContentQualityThumbnail,
+    CloudContentQualityPreview,
+    CloudContentQualityFull
+};
+
+/** This class measures the network conditions from the requests sent to the cloud, and derives from them how many requests should be
+ * in flight at the same time, how big the chunks of a transfer should be, and which version of a content is worth downloading.
+ * The number of concurrent requests follows an AIMD scheme: it grows by one after a full round of successful requests, and is halved
+ * when the network or the server shows signs of congestion (timeouts, lost connections, 429 and 503 responses).
+ * @note all methods are thread safe
+ */
+@interface CloudBandwidthEstimator : NSObject
+
+/** the smoothed download or upload throughput, in bytes per second. 0 until a large enough request has completed */
+@property (nonatomic, readonly) double bandwidth;
+
+/** the smoothed round trip time, measured between sending a request and receiving the response headers. 0 until measured */
+@property (nonatomic, readonly) NSTimeInterval rtt;
+
+/** the number of requests that should be in flight at the same time */
+@property (nonatomic, readonly) NSUInteger concurrencyLimit;
+
+/** the bounds of concurrencyLimit. Default values are 1 and 8 */
+@property (nonatomic) NSUInteger minConcurrency;
+@property (nonatomic) NSUInteger maxConcurrency;
+
+/** YES when the measured throughput is too low to prefetch content the user did not ask for */
+@property (nonatomic, readonly) BOOL isSlow;
+
+/** the size of the chunks for uploads and ranged downloads, so that each chunk takes about 2 seconds, between 64 kB and 4 MB */
+@property (nonatomic, readonly) NSUInteger recommendedChunkSize;
+
+/** record a completed request.
+ * @param bytes the number of bytes sent and received.
+ * @param duration the time between the start of the request and its completion.
+ * @param latency the time between the start of the request and the reception of the response headers.
+ */
+- (void) addSampleWithBytes:(long long)bytes duration:(NSTimeInterval)duration latency:(NSTimeInterval)latency;
+
+/** record a request that succeeded, which may increase the concurrency limit */
+- (void) requestDidSucceed;
+
+/** record a request that failed because of congestion, which decreases the concurrency limit */
+- (void) requestDidCongest;
+
+/** the expected time to download the given number of bytes, or 0 if unknown */
+- (NSTimeInterval) estimatedDurationForSize:(long long)size;
+
+/** the best version of a content that can be downloaded within the given delay.
+ * @param size the size of the full content, 0 if unknown.
+ * @param delay the time the user is expected to wait, typically 1 or 2 seconds.
+ */
+- (CloudContentQuality) qualityForFileSize:(long long)size maxDelay:(NSTimeInterval)delay;
+
+/** forget all measures, for example when the network interface changes */
+- (void) reset;
+
+@end
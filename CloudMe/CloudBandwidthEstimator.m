@@ -0,0 +1,167 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudBandwidthEstimator.h"
+
+// requests smaller than this are dominated by latency, they only update the rtt
+static const long long kMinBandwidthSample = 16 * 1024;
+
+// smoothing factors: throughput follows changes quickly, rtt is smoothed as TCP does
+static const double kBandwidthGain = 0.3;
+static const double kRTTGain = 0.125;
+
+static const NSUInteger kInitialConcurrency = 4;
+
+// below this throughput (bytes per second), nothing should be downloaded ahead of the user
+static const double kSlowBandwidth = 32 * 1024;
+
+static const NSTimeInterval kChunkDuration = 2.0;
+static const NSUInteger kMinChunkSize = 64 * 1024;
+static const NSUInteger kMaxChunkSize = 4 * 1024 * 1024;
+static const NSUInteger kDefaultChunkSize = 256 * 1024;
+
+// typical size of a preview, used to decide whether it is worth downloading
+static const long long kPreviewSize = 100 * 1024;
+
+// without any measure, full contents are downloaded up to this size
+static const long long kMaxUnmeasuredFullSize = 1024 * 1024;
+
+@interface CloudBandwidthEstimator ()
+@property (nonatomic) NSUInteger successes; // successful requests since the last change of the concurrency limit
+@property (nonatomic) NSDate * lastDecrease;
+@end
+
+@implementation CloudBandwidthEstimator
+
+- (id) init {
+    self = [super init];
+    if (self != nil) {
+        _minConcurrency = 1;
+        _maxConcurrency = 8;
+        [self reset];
+    }
+    return self;
+}
+
+- (void) reset {
+    @synchronized(self) {
+        _bandwidth = 0;
+        _rtt = 0;
+        _concurrencyLimit = MAX(self.minConcurrency, MIN(kInitialConcurrency, self.maxConcurrency));
+        self.successes = 0;
+        self.lastDecrease = nil;
+    }
+}
+
+- (void) addSampleWithBytes:(long long)bytes duration:(NSTimeInterval)duration latency:(NSTimeInterval)latency {
+    if (duration <= 0) {
+        return;
+    }
+    @synchronized(self) {
+        if (latency > 0) {
+            _rtt = _rtt == 0 ? latency : (1 - kRTTGain) * _rtt + kRTTGain * latency;
+        }
+        if (bytes >= kMinBandwidthSample) {
+            // the time to first byte is not part of the transfer itself
+            NSTimeInterval transferTime = duration - latency > 0.01 ? duration - latency : duration;
+            double sample = bytes / transferTime;
+            _bandwidth = _bandwidth == 0 ? sample : (1 - kBandwidthGain) * _bandwidth + kBandwidthGain * sample;
+        }
+    }
+}
+
+- (void) requestDidSucceed {
+    @synchronized(self) {
+        self.successes++;
+        if (self.successes >= _concurrencyLimit) { // additive increase, once per round of requests
+            self.successes = 0;
+            _concurrencyLimit = MIN(_concurrencyLimit + 1, self.maxConcurrency);
+        }
+    }
+}
+
+- (void) requestDidCongest {
+    @synchronized(self) {
+        // requests in flight at the time of the congestion fail together, they only count once
+        NSTimeInterval window = MAX(_rtt, 1.0);
+        if (self.lastDecrease != nil && -[self.lastDecrease timeIntervalSinceNow] < window) {
+            return;
+        }
+        self.lastDecrease = [NSDate date];
+        self.successes = 0;
+        _concurrencyLimit = MAX(_concurrencyLimit / 2, self.minConcurrency); // multiplicative decrease
+    }
+}
+
+- (void) setMinConcurrency:(NSUInteger)minConcurrency {
+    @synchronized(self) {
+        _minConcurrency = MAX(minConcurrency, 1);
+        _concurrencyLimit = MAX(_concurrencyLimit, _minConcurrency);
+    }
+}
+
+- (void) setMaxConcurrency:(NSUInteger)maxConcurrency {
+    @synchronized(self) {
+        _maxConcurrency = MAX(maxConcurrency, 1);
+        _concurrencyLimit = MIN(_concurrencyLimit, _maxConcurrency);
+    }
+}
+
+- (BOOL) isSlow {
+    double bandwidth = self.bandwidth;
+    return bandwidth > 0 && bandwidth < kSlowBandwidth;
+}
+
+- (NSUInteger) recommendedChunkSize {
+    double bandwidth = self.bandwidth;
+    if (bandwidth == 0) {
+        return kDefaultChunkSize;
+    }
+    NSUInteger chunkSize = kMinChunkSize;
+    while (chunkSize < kMaxChunkSize && chunkSize * 2 <= bandwidth * kChunkDuration) {
+        chunkSize *= 2;
+    }
+    return chunkSize;
+}
+
+- (NSTimeInterval) estimatedDurationForSize:(long long)size {
+    @synchronized(self) {
+        if (_bandwidth == 0) {
+            return 0;
+        }
+        return _rtt + size / _bandwidth;
+    }
+}
+
+- (CloudContentQuality) qualityForFileSize:(long long)size maxDelay:(NSTimeInterval)delay {
+    if (self.bandwidth == 0) {
+        return size > 0 && size <= kMaxUnmeasuredFullSize ? CloudContentQualityFull : CloudContentQualityPreview;
+    }
+    if (size > 0 && [self estimatedDurationForSize:size] <= delay) {
+        return CloudContentQualityFull;
+    } else if ([self estimatedDurationForSize:kPreviewSize] <= delay) {
+        return CloudContentQualityPreview;
+    } else {
+        return CloudContentQualityThumbnail;
+    }
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"%.1f kB/s, rtt %d ms, %d requests", self.bandwidth / 1024, (int)(self.rtt * 1000), (int)self.concurrencyLimit];
+}
+
+@end
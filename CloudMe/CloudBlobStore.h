@@ -0,0 +1,56 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+
+/** The interface of a local store for downloaded contents (file contents, previews and thumbnails).
+ * Keys are built by CloudManager from the file identifier, its size, its creation date and the kind of content, so that a new version of a file
+ * never hits an old entry.
+ * @note methods can be called from any thread
+ */
+@protocol CloudContentStore <NSObject>
+
+/** the data stored for the key, or nil */
+- (NSData * _Nullable) dataForKey:(NSString * _Nonnull)key;
+
+- (void) storeData:(NSData * _Nonnull)data forKey:(NSString * _Nonnull)key;
+
+- (void) removeDataForKey:(NSString * _Nonnull)key;
+
+- (void) removeAllData;
+
+@end
+
+
+/** The default content store: one file per entry in a directory, read with memory mapping so that a large content costs neither
+ * a full read nor a full copy in memory. Writes are atomic, so a killed application never leaves a truncated entry.
+ * The total size is kept below a disk budget by removing the least recently used entries.
+ */
+@interface CloudBlobStore : NSObject <CloudContentStore>
+
+/** create a store in the given directory, which is created if needed. Existing entries are kept */
+- (nonnull id) initWithDirectory:(NSURL * _Nonnull)directory diskBudget:(unsigned long long)diskBudget;
+
+@property (nonatomic, readonly, nonnull) NSURL * directory;
+
+/** the maximum total size of the entries, in bytes */
+@property (nonatomic) unsigned long long diskBudget;
+
+/** the current total size of the entries, in bytes */
+@property (nonatomic, readonly) unsigned long long totalSize;
+
+@end
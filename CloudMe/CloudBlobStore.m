@@ -0,0 +1,201 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudBlobStore.h"
+#import <CommonCrypto/CommonDigest.h>
+
+static NSString * const kBlobExtension = @"blob";
+
+// when the budget is exceeded, entries are removed until this ratio of the budget is reached, so that eviction does not run on every write
+static const double kEvictionRatio = 0.9;
+
+@interface CloudBlobEntry : NSObject
+@property (nonatomic) unsigned long long size;
+@property (nonatomic) NSDate * lastAccess;
+@end
+
+@implementation CloudBlobEntry
+@end
+
+
+@interface CloudBlobStore ()
+@property (nonatomic) NSMutableDictionary * entries; // file name -> CloudBlobEntry, nil until the directory has been scanned
+@end
+
+@implementation CloudBlobStore
+
+- (id) initWithDirectory:(NSURL*)directory diskBudget:(unsigned long long)diskBudget {
+    self = [super init];
+    if (self != nil) {
+        _directory = directory;
+        _diskBudget = diskBudget;
+        [[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    }
+    return self;
+}
+
+/** entries are named after a hash of the key, keys contain characters that are not allowed in file names */
+- (NSString*) fileNameForKey:(NSString*)key {
+    NSData * data = [key dataUsingEncoding:NSUTF8StringEncoding];
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1(data.bytes, (CC_LONG)data.length, digest);
+    NSMutableString * name = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2 + 5];
+    for (int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++) {
+        [name appendFormat:@"%02x", digest[i]];
+    }
+    return [name stringByAppendingPathExtension:kBlobExtension];
+}
+
+/** the index of the entries, built from the directory content the first time it is needed. Must be called with self locked */
+- (NSMutableDictionary*) index {
+    if (self.entries == nil) {
+        self.entries = [[NSMutableDictionary alloc] init];
+        _totalSize = 0;
+        NSFileManager * fileManager = [NSFileManager defaultManager];
+        NSArray * keys = @[NSURLFileSizeKey, NSURLContentModificationDateKey];
+        for (NSURL * url in [fileManager contentsOfDirectoryAtURL:self.directory includingPropertiesForKeys:keys options:0 error:nil]) {
+            if ([url.pathExtension isEqualToString:kBlobExtension] == NO) { // left over by an interrupted atomic write
+                [fileManager removeItemAtURL:url error:nil];
+                continue;
+            }
+            NSDictionary * values = [url resourceValuesForKeys:keys error:nil];
+            CloudBlobEntry * entry = [[CloudBlobEntry alloc] init];
+            entry.size = [values[NSURLFileSizeKey] unsignedLongLongValue];
+            entry.lastAccess = values[NSURLContentModificationDateKey] ?: [NSDate distantPast];
+            self.entries[url.lastPathComponent] = entry;
+            _totalSize += entry.size;
+        }
+    }
+    return self.entries;
+}
+
+- (unsigned long long) totalSize {
+    @synchronized(self) {
+        [self index];
+        return _totalSize;
+    }
+}
+
+- (void) setDiskBudget:(unsigned long long)diskBudget {
+    @synchronized(self) {
+        _diskBudget = diskBudget;
+    }
+    [self evictIfNeeded];
+}
+
+- (NSData*) dataForKey:(NSString*)key {
+    NSString * name = [self fileNameForKey:key];
+    @synchronized(self) {
+        CloudBlobEntry * entry = [self index][name];
+        if (entry == nil) {
+            return nil;
+        }
+        entry.lastAccess = [NSDate date];
+    }
+    NSURL * url = [self.directory URLByAppendingPathComponent:name];
+    // mapped: the content is paged in by the system when it is actually read, and shared with the file cache
+    NSData * data = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:nil];
+    if (data == nil) { // removed behind our back
+        @synchronized(self) {
+            CloudBlobEntry * entry = self.entries[name];
+            if (entry != nil) {
+                _totalSize -= entry.size;
+                [self.entries removeObjectForKey:name];
+            }
+        }
+        return nil;
+    }
+    // the modification date records the last access, so that the LRU order survives relaunches
+    [[NSFileManager defaultManager] setAttributes:@{ NSFileModificationDate : [NSDate date] } ofItemAtPath:url.path error:nil];
+    return data;
+}
+
+- (void) storeData:(NSData*)data forKey:(NSString*)key {
+    if (data.length > self.diskBudget) {
+        return;
+    }
+    NSString * name = [self fileNameForKey:key];
+    NSURL * url = [self.directory URLByAppendingPathComponent:name];
+    if ([data writeToURL:url options:NSDataWritingAtomic error:nil] == NO) {
+        return;
+    }
+    @synchronized(self) {
+        CloudBlobEntry * entry = [self index][name];
+        if (entry == nil) {
+            entry = [[CloudBlobEntry alloc] init];
+            self.entries[name] = entry;
+        } else {
+            _totalSize -= entry.size;
+        }
+        entry.size = data.length;
+        entry.lastAccess = [NSDate date];
+        _totalSize += entry.size;
+    }
+    [self evictIfNeeded];
+}
+
+- (void) removeDataForKey:(NSString*)key {
+    NSString * name = [self fileNameForKey:key];
+    @synchronized(self) {
+        CloudBlobEntry * entry = [self index][name];
+        if (entry == nil) {
+            return;
+        }
+        _totalSize -= entry.size;
+        [self.entries removeObjectForKey:name];
+    }
+    [[NSFileManager defaultManager] removeItemAtURL:[self.directory URLByAppendingPathComponent:name] error:nil];
+}
+
+- (void) removeAllData {
+    NSArray * names;
+    @synchronized(self) {
+        names = [self index].allKeys;
+        [self.entries removeAllObjects];
+        _totalSize = 0;
+    }
+    for (NSString * name in names) {
+        [[NSFileManager defaultManager] removeItemAtURL:[self.directory URLByAppendingPathComponent:name] error:nil];
+    }
+}
+
+/** remove the least recently used entries until the total size is back under the budget */
+- (void) evictIfNeeded {
+    NSMutableArray * evicted = [[NSMutableArray alloc] init];
+    @synchronized(self) {
+        NSMutableDictionary * index = [self index];
+        if (_totalSize <= _diskBudget) {
+            return;
+        }
+        NSArray * names = [index keysSortedByValueUsingComparator:^NSComparisonResult(CloudBlobEntry * entry1, CloudBlobEntry * entry2) {
+            return [entry1.lastAccess compare:entry2.lastAccess];
+        }];
+        for (NSString * name in names) {
+            if (_totalSize <= _diskBudget * kEvictionRatio) {
+                break;
+            }
+            _totalSize -= [index[name] size];
+            [index removeObjectForKey:name];
+            [evicted addObject:name];
+        }
+    }
+    for (NSString * name in evicted) {
+        [[NSFileManager defaultManager] removeItemAtURL:[self.directory URLByAppendingPathComponent:name] error:nil];
+    }
+}
+
+@end
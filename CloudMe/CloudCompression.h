@@ -0,0 +1,87 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+
+/** The counters of the bytes exchanged with the cloud, as sent on the network and once decoded, and of the time spent encoding and decoding.
+ * The ratio between both sizes tells how much content encoding saves.
+ * @note all methods are thread safe
+ */
+@interface CloudTrafficStats : NSObject
+
+/** the size of the response bodies, once decoded */
+@property (nonatomic, readonly) long long receivedBytes;
+
+/** the size of the response bodies, as received on the network */
+@property (nonatomic, readonly) long long receivedWireBytes;
+
+/** the size of the request bodies, before encoding */
+@property (nonatomic, readonly) long long sentBytes;
+
+/** the size of the request bodies, as sent on the network */
+@property (nonatomic, readonly) long long sentWireBytes;
+
+/** the processor time spent compressing request bodies and decompressing response bodies */
+@property (nonatomic, readonly) NSTimeInterval codingTime;
+
+- (void) addReceivedBytes:(long long)bytes wireBytes:(long long)wireBytes;
+
+- (void) addSentBytes:(long long)bytes wireBytes:(long long)wireBytes;
+
+- (void) addCodingTime:(NSTimeInterval)time;
+
+- (void) reset;
+
+@end
+
+
+/** A streaming decoder of gzip and deflate contents: each chunk is decoded as soon as it is received, so that decoding overlaps the transfer
+ * and the decoded bytes can be parsed incrementally.
+ */
+@interface CloudInflater : NSObject
+
+/** YES if the data starts with a gzip or zlib header. The URL loading system decodes by itself the responses of the servers it talks to,
+ * but not the ones served by custom protocols: the first bytes tell whether the body still has to be decoded.
+ */
++ (BOOL) isEncodedData:(NSData * _Nonnull)data;
+
+/** create a decoder for a Content-Encoding value, nil if the encoding is neither gzip nor deflate */
+- (nullable id) initWithEncoding:(NSString * _Nonnull)encoding;
+
+/** decode the next chunk of the content.
+ * @return the decoded bytes, possibly empty, or nil if the content is corrupted.
+ */
+- (NSData * _Nullable) inflateData:(NSData * _Nonnull)data;
+
+/** YES once the end of the encoded content has been decoded */
+@property (nonatomic, readonly) BOOL finished;
+
+@end
+
+
+/** Compression of request bodies */
+@interface CloudCompression : NSObject
+
+/** the data compressed in gzip format, nil on failure */
++ (NSData * _Nullable) gzipData:(NSData * _Nonnull)data;
+
+/** YES if compressing the data is worth the processor time, as measured on a sample with a fast compression level.
+ * Contents that are already compressed (photos, videos, archives) are not.
+ */
++ (BOOL) isCompressibleData:(NSData * _Nonnull)data;
+
+@end
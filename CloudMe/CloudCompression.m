@@ -0,0 +1,172 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudCompression.h"
+#import <zlib.h>
+
+// the size of the output chunks of the encoder and decoder
+static const NSUInteger kCodingChunkSize = 64 * 1024;
+
+// compressibility is measured on this much of the beginning of a content
+static const NSUInteger kSampleSize = 64 * 1024;
+
+// a content is worth compressing if its sample shrinks below this ratio
+static const double kCompressibleRatio = 0.9;
+
+// windowBits: 15 for the largest window, +16 to write a gzip header, +32 to detect a gzip or zlib header when decoding
+static const int kGzipWindowBits = 15 + 16;
+static const int kAutoDetectWindowBits = 15 + 32;
+
+@implementation CloudTrafficStats
+
+- (void) addReceivedBytes:(long long)bytes wireBytes:(long long)wireBytes {
+    @synchronized(self) {
+        _receivedBytes += bytes;
+        _receivedWireBytes += wireBytes;
+    }
+}
+
+- (void) addSentBytes:(long long)bytes wireBytes:(long long)wireBytes {
+    @synchronized(self) {
+        _sentBytes += bytes;
+        _sentWireBytes += wireBytes;
+    }
+}
+
+- (void) addCodingTime:(NSTimeInterval)time {
+    @synchronized(self) {
+        _codingTime += time;
+    }
+}
+
+- (void) reset {
+    @synchronized(self) {
+        _receivedBytes = 0;
+        _receivedWireBytes = 0;
+        _sentBytes = 0;
+        _sentWireBytes = 0;
+        _codingTime = 0;
+    }
+}
+
+- (NSString*) description {
+    @synchronized(self) {
+        return [NSString stringWithFormat:@"received %.1f kB (%.1f kB on the wire), sent %.1f kB (%.1f kB on the wire), coding %d ms",
+                _receivedBytes / 1024.0, _receivedWireBytes / 1024.0, _sentBytes / 1024.0, _sentWireBytes / 1024.0, (int)(_codingTime * 1000)];
+    }
+}
+
+@end
+
+
+@interface CloudInflater () {
+    z_stream _stream;
+}
+@end
+
+@implementation CloudInflater
+
++ (BOOL) isEncodedData:(NSData*)data {
+    if (data.length < 2) {
+        return NO;
+    }
+    const uint8_t * bytes = data.bytes;
+    BOOL gzip = bytes[0] == 0x1f && bytes[1] == 0x8b;
+    BOOL zlib = (bytes[0] & 0x0f) == Z_DEFLATED && ((bytes[0] << 8) | bytes[1]) % 31 == 0;
+    return gzip || zlib;
+}
+
+- (id) initWithEncoding:(NSString*)encoding {
+    encoding = encoding.lowercaseString;
+    if ([encoding isEqualToString:@"gzip"] == NO && [encoding isEqualToString:@"x-gzip"] == NO && [encoding isEqualToString:@"deflate"] == NO) {
+        return nil;
+    }
+    self = [super init];
+    if (self != nil) {
+        if (inflateInit2(&_stream, kAutoDetectWindowBits) != Z_OK) {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void) dealloc {
+    inflateEnd(&_stream);
+}
+
+- (NSData*) inflateData:(NSData*)data {
+    if (_finished) {
+        return [NSData data]; // trailing bytes after the end of the content are ignored
+    }
+    NSMutableData * output = [[NSMutableData alloc] initWithCapacity:MAX(data.length * 4, kCodingChunkSize)];
+    _stream.next_in = (Bytef*)data.bytes;
+    _stream.avail_in = (uInt)data.length;
+    while (_stream.avail_in > 0 && _finished == NO) {
+        NSUInteger length = output.length;
+        [output setLength:length + kCodingChunkSize];
+        _stream.next_out = (Bytef*)output.mutableBytes + length;
+        _stream.avail_out = (uInt)kCodingChunkSize;
+        int result = inflate(&_stream, Z_NO_FLUSH);
+        [output setLength:length + kCodingChunkSize - _stream.avail_out];
+        if (result == Z_STREAM_END) {
+            _finished = YES;
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+            return nil;
+        }
+    }
+    return output;
+}
+
+@end
+
+
+@implementation CloudCompression
+
++ (NSData*) gzipData:(NSData*)data level:(int)level length:(NSUInteger)length {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, level, Z_DEFLATED, kGzipWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return nil;
+    }
+    NSMutableData * output = [[NSMutableData alloc] initWithLength:deflateBound(&stream, length)];
+    stream.next_in = (Bytef*)data.bytes;
+    stream.avail_in = (uInt)length;
+    stream.next_out = output.mutableBytes;
+    stream.avail_out = (uInt)output.length;
+    int result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        return nil;
+    }
+    [output setLength:stream.total_out];
+    return output;
+}
+
++ (NSData*) gzipData:(NSData*)data {
+    return [self gzipData:data level:Z_DEFAULT_COMPRESSION length:data.length];
+}
+
++ (BOOL) isCompressibleData:(NSData*)data {
+    NSUInteger length = MIN(data.length, kSampleSize);
+    if (length == 0) {
+        return NO;
+    }
+    NSData * sample = [self gzipData:data level:Z_BEST_SPEED length:length];
+    return sample != nil && sample.length < length * kCompressibleRatio;
+}
+
+@end
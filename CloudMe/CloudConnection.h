@@ -17,6 +17,9 @@
 
 #import <Foundation/Foundation.h>
 #import "CloudStatus.h"
+#import "CloudBandwidthEstimator.h"
+#import "CloudCompression.h"
+#import "CloudMemoryGovernor.h"
 
 
 typedef void (^OIDCCompletionHandler) (NSURLRequest *, NSError *);
@@ -32,12 +35,60 @@ typedef void (^CompletionHandler) (NSHTTPURLResponse *, NSData *, NSError *);
 
 typedef void (^ProgressHandler) (float);
 
-/** A class similar to manage cloud connections */
+@class CloudConnection;
+
+/** The requests sent on behalf of one CloudManager: they wait for a free slot of this pool only, and its estimator and counters only measure them.
+ * Managers of different accounts thus run side by side with their own throughput limits, without one queue delaying the other.
+ * @note all methods are thread safe
+ */
+@interface CloudConnectionPool : NSObject
+
+/** the pool of the requests sent without a pool, such as authentication requests */
++ (CloudConnectionPool*) defaultPool;
+
+/** the estimator of the network conditions, which drives the number of requests in flight */
+@property (nonatomic, readonly) CloudBandwidthEstimator * estimator;
+
+/** the counters of the bytes exchanged by the requests of the pool */
+@property (nonatomic, readonly) CloudTrafficStats * trafficStats;
+
+/** the governor in which response buffers are accounted. Default value is the shared governor */
+@property (atomic) CloudMemoryGovernor * memoryGovernor;
+
+/** the number of requests in flight */
+@property (nonatomic, readonly) NSUInteger runningCount;
+
+/** the number of requests waiting for a slot */
+@property (nonatomic, readonly) NSUInteger pendingCount;
+
+@end
+
+/** A class similar to manage cloud connections.
+ * The progress and completion handlers are called on the queue passed as parameter, or on the current run loop if queue is nil.
+ * Requests wait for a free slot of their pool before being sent: the number of requests in flight is driven by the bandwidth estimator
+ * of the pool, which is fed with the measures of every completed request.
+ * Compressed responses are decoded chunk by chunk as they are received.
+ */
 @interface CloudConnection : NSObject
 
-+ (void)sendAsynchronousRequest:(NSURLRequest *)request queue:(NSOperationQueue *)queue message:(NSString*)message completionHandler:(CompletionHandler)completionHandler;
+/** the estimator of the network conditions of the default pool */
++ (CloudBandwidthEstimator*) estimator;
+
+/** the counters of the bytes exchanged by the connections of the default pool */
++ (CloudTrafficStats*) trafficStats;
 
-+ (void)sendAsynchronousRequest:(NSURLRequest *)request queue:(NSOperationQueue *)queue message:(NSString*)message progressHandler:(ProgressHandler)progressHandler completionHandler:(CompletionHandler)completionHandler;
++ (CloudConnection*)sendAsynchronousRequest:(NSURLRequest *)request queue:(NSOperationQueue *)queue message:(NSString*)message completionHandler:(CompletionHandler)completionHandler;
+
++ (CloudConnection*)sendAsynchronousRequest:(NSURLRequest *)request queue:(NSOperationQueue *)queue message:(NSString*)message progressHandler:(ProgressHandler)progressHandler completionHandler:(CompletionHandler)completionHandler;
+
+/** send the request in the given pool, the default pool if nil */
++ (CloudConnection*)sendAsynchronousRequest:(NSURLRequest *)request pool:(CloudConnectionPool *)pool queue:(NSOperationQueue *)queue message:(NSString*)message
+                            progressHandler:(ProgressHandler)progressHandler completionHandler:(CompletionHandler)completionHandler;
+
+/** Cancel the connection. Neither the progress handler nor the completion handler will be called afterwards, and the connection
+ * is removed from the pending requests so that the next one can start immediately.
+ */
+- (void) cancel;
 
 @end
 
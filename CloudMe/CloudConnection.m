@@ -82,7 +82,7 @@
 - (void)connectionDidFinishLoading:(NSURLConnection *)connection {
     NSError * error = nil;
     NSUInteger code = self.response.statusCode;
-    if (code != 200 && code != 201 && code != 202 && code != 204) {
+    if (code != 200 && code != 201 && code != 202 && code != 204 && code != 206) { // 206: partial content of a range request
         error = [NSError errorWithDomain:@"Orange Cloud" code:self.response.statusCode userInfo:nil];
     } else {
         //        if (self.message) {
@@ -104,52 +104,166 @@
 @end
 
 
+@interface CloudConnectionPool ()
+@property (nonatomic) NSMutableArray * pendingRequests; // waiting for a slot
+@property (nonatomic) NSMutableArray * runningRequests;
+@end
+
 @interface CloudConnection () <NSURLConnectionDelegate, NSURLConnectionDataDelegate>
-@property (nonatomic, copy) ProgressHandler progressHandler;
-@property (nonatomic, copy) CompletionHandler completionHandler;
+@property (nonatomic) CloudConnectionPool * pool;
+@property (nonatomic) NSURLConnection * connection;
+@property (atomic, copy) ProgressHandler progressHandler; // atomic as the connection can be cancelled from any thread
+@property (atomic, copy) CompletionHandler completionHandler;
 @property (nonatomic) NSHTTPURLResponse * response;
 @property (nonatomic) NSMutableData * responseData;
 
 @end
 
 @interface CloudConnection ()
-@property (nonatomic) NSDate * startingDate; // used only for tracing bandwidth usage
+@property (nonatomic) NSDate * startingDate; // used to measure bandwidth and latency
+@property (nonatomic) NSTimeInterval latency; // time to receive the response headers
+@property (nonatomic) long long bytesSent;
+@property (nonatomic) long long bufferBytes; // the response bytes accounted in the memory governor, guarded by self
+@property (nonatomic) NSString * contentEncoding; // the Content-Encoding of the response, if any
+@property (nonatomic) CloudInflater * inflater; // set when the response body has to be decoded
+@property (nonatomic) long long wireBytes; // the size of the response body as received
 @property (nonatomic) NSString * message; // if not nil, bandwidth usage is display with this message as prefix
 
 @end
 
-static NSOperationQueue * operationQueue = nil;
-static NSMutableArray * pendingRequests = nil;
+@implementation CloudConnectionPool
+
++ (CloudConnectionPool*) defaultPool {
+    static dispatch_once_t once;
+    static CloudConnectionPool * defaultPool;
+    dispatch_once(&once, ^{
+        defaultPool = [[CloudConnectionPool alloc] init];
+    });
+    return defaultPool;
+}
+
+- (id) init {
+    self = [super init];
+    if (self != nil) {
+        _estimator = [[CloudBandwidthEstimator alloc] init];
+        _trafficStats = [[CloudTrafficStats alloc] init];
+        _memoryGovernor = [CloudMemoryGovernor sharedGovernor];
+        _pendingRequests = [[NSMutableArray alloc] initWithCapacity:128];
+        _runningRequests = [[NSMutableArray alloc] initWithCapacity:16];
+    }
+    return self;
+}
+
+- (NSUInteger) runningCount {
+    @synchronized(self) {
+        return self.runningRequests.count;
+    }
+}
+
+- (NSUInteger) pendingCount {
+    @synchronized(self) {
+        return self.pendingRequests.count;
+    }
+}
+
+- (void) addConnection:(CloudConnection*)cloudConnection {
+    @synchronized(self) {
+        [self.pendingRequests addObject:cloudConnection];
+        [self startPendingRequests];
+    }
+}
+
+/** remove the connection from the pending or running requests and start the next ones, if any */
+- (void) removeConnection:(CloudConnection*)cloudConnection {
+    @synchronized(self) {
+        [self.pendingRequests removeObjectIdenticalTo:cloudConnection];
+        [self.runningRequests removeObjectIdenticalTo:cloudConnection];
+        [self startPendingRequests];
+    }
+}
+
+/** start as many pending requests as the estimator allows. Must be called with self locked */
+- (void) startPendingRequests {
+    NSUInteger limit = FORCE_SERIAL_REQUESTS ? 1 : self.estimator.concurrencyLimit;
+    while (self.runningRequests.count < limit && self.pendingRequests.count > 0) {
+        CloudConnection * cloudConnection = self.pendingRequests[0];
+        [self.pendingRequests removeObjectAtIndex:0];
+        [self.runningRequests addObject:cloudConnection];
+        cloudConnection.startingDate = [NSDate date];
+        [cloudConnection.connection start];
+    }
+}
+
+@end
+
+
 @implementation CloudConnection
 
++ (CloudBandwidthEstimator*) estimator {
+    return [CloudConnectionPool defaultPool].estimator;
+}
 
-+ (void) load {
-    operationQueue = [[NSOperationQueue alloc] init];
-    operationQueue.maxConcurrentOperationCount = 1;
-    pendingRequests = [[NSMutableArray alloc] initWithCapacity:128];
++ (CloudTrafficStats*) trafficStats {
+    return [CloudConnectionPool defaultPool].trafficStats;
 }
 
-+ (void)sendAsynchronousRequest:(NSURLRequest *)request queue:(NSOperationQueue *)queue message:(NSString*)message completionHandler:(CompletionHandler) completionHandler {
-    [self sendAsynchronousRequest:request queue:queue message:message progressHandler:nil completionHandler:completionHandler];
++ (CloudConnection*)sendAsynchronousRequest:(NSURLRequest *)request queue:(NSOperationQueue *)queue message:(NSString*)message completionHandler:(CompletionHandler) completionHandler {
+    return [self sendAsynchronousRequest:request pool:nil queue:queue message:message progressHandler:nil completionHandler:completionHandler];
 }
 
-+ (void)sendAsynchronousRequest:(NSURLRequest *)request queue:(NSOperationQueue *)queue message:(NSString*)message progressHandler:(ProgressHandler)progressHandler
++ (CloudConnection*)sendAsynchronousRequest:(NSURLRequest *)request queue:(NSOperationQueue *)queue message:(NSString*)message progressHandler:(ProgressHandler)progressHandler
               completionHandler:(CompletionHandler) completionHandler {
+    return [self sendAsynchronousRequest:request pool:nil queue:queue message:message progressHandler:progressHandler completionHandler:completionHandler];
+}
+
++ (CloudConnection*)sendAsynchronousRequest:(NSURLRequest *)request pool:(CloudConnectionPool *)pool queue:(NSOperationQueue *)queue message:(NSString*)message
+                            progressHandler:(ProgressHandler)progressHandler completionHandler:(CompletionHandler)completionHandler {
     CloudConnection * cloudConnection = [[CloudConnection alloc] init];
+    cloudConnection.pool = pool ?: [CloudConnectionPool defaultPool];
     cloudConnection.startingDate = [NSDate date];
     cloudConnection.message = message;
     cloudConnection.progressHandler = progressHandler;
     cloudConnection.completionHandler = completionHandler;
-    if (FORCE_SERIAL_REQUESTS) {
-        NSURLConnection * connection = [[NSURLConnection alloc] initWithRequest:request delegate:cloudConnection startImmediately:NO];
-        @synchronized(pendingRequests) {
-            [pendingRequests addObject:@[connection, cloudConnection]];
-            if (pendingRequests.count == 1) {
-                [connection start];
-            }
-        }
-    } else {
-        (void)[[NSURLConnection alloc] initWithRequest:request delegate:cloudConnection];
+    NSURLConnection * connection = [[NSURLConnection alloc] initWithRequest:request delegate:cloudConnection startImmediately:NO];
+    if (queue != nil) { // delegate callbacks, and thus the completion handler, are called on this queue
+        [connection setDelegateQueue:queue];
+    }
+    cloudConnection.connection = connection;
+    [cloudConnection.pool addConnection:cloudConnection];
+    return cloudConnection;
+}
+
+- (void) cancel {
+    [self.connection cancel];
+    [self releaseSlot];
+    // break the retain cycles that may exist with the owner of the handlers
+    self.progressHandler = nil;
+    self.completionHandler = nil;
+}
+
+/** remove the connection from its pool so that the next requests can start */
+- (void) releaseSlot {
+    [self.pool removeConnection:self];
+    [self releaseBuffer];
+}
+
+/** the response is buffered in memory until the request completes: it counts in the memory budget */
+- (void) addBufferBytes:(long long)bytes {
+    @synchronized(self) {
+        self.bufferBytes += bytes;
+    }
+    [self.pool.memoryGovernor addUsage:bytes category:CloudMemoryCategoryBuffers];
+}
+
+/** stop accounting the response buffer, which is either dropped or handed over to the completion handler */
+- (void) releaseBuffer {
+    long long bytes;
+    @synchronized(self) {
+        bytes = self.bufferBytes;
+        self.bufferBytes = 0;
+    }
+    if (bytes != 0) {
+        [self.pool.memoryGovernor addUsage:-bytes category:CloudMemoryCategoryBuffers];
     }
 }
 
@@ -158,12 +272,41 @@ static NSMutableArray * pendingRequests = nil;
 
 
 - (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSHTTPURLResponse *)response {
+    self.latency = -[self.startingDate timeIntervalSinceNow];
     self.response = response;
+    [self releaseBuffer]; // a new response replaces the previous one
     self.responseData = [[NSMutableData alloc] init];
+    self.contentEncoding = response.allHeaderFields[@"Content-Encoding"];
+    self.inflater = nil;
+    self.wireBytes = 0;
 }
 
 - (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
+    if (self.wireBytes == 0 && self.contentEncoding != nil && [CloudInflater isEncodedData:data]) { // not decoded by the system
+        self.inflater = [[CloudInflater alloc] initWithEncoding:self.contentEncoding];
+    }
+    self.wireBytes += data.length;
+    if (self.inflater != nil) {
+        NSDate * start = [NSDate date];
+        data = [self.inflater inflateData:data];
+        [self.pool.trafficStats addCodingTime:-[start timeIntervalSinceNow]];
+        if (data == nil) {
+            [connection cancel];
+            [self connection:connection didFailWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotDecodeContentData userInfo:nil]];
+            return;
+        }
+    }
     [self.responseData appendData:data];
+    [self addBufferBytes:data.length];
+}
+
+/** the size of the response body on the network. When the system decoded it, the only trace of the encoded size is the Content-Length header */
+- (long long) responseWireBytes {
+    long long contentLength = [self.response.allHeaderFields[@"Content-Length"] longLongValue];
+    if (self.inflater == nil && self.contentEncoding != nil && contentLength > 0) {
+        return contentLength;
+    }
+    return self.wireBytes;
 }
 
 - (NSCachedURLResponse *)connection:(NSURLConnection *)connection willCacheResponse:(NSCachedURLResponse*)cachedResponse {
@@ -172,47 +315,61 @@ static NSMutableArray * pendingRequests = nil;
 }
 
 - (void)connection:(NSURLConnection *)connection didSendBodyData:(NSInteger)bytesWritten totalBytesWritten:(NSInteger)totalBytesWritten totalBytesExpectedToWrite:(NSInteger)totalBytesExpectedToWrite {
+    self.bytesSent = totalBytesWritten;
     float value = (1.0 * totalBytesWritten)/totalBytesExpectedToWrite;
-    if (self.progressHandler != nil) {
-        self.progressHandler (value);
+    ProgressHandler progressHandler = self.progressHandler;
+    if (progressHandler != nil) {
+        progressHandler (value);
     }
 }
 
 - (void)connectionDidFinishLoading:(NSURLConnection *)connection {
     NSError * error = nil;
     NSUInteger code = self.response.statusCode;
-    if (code != 200 && code != 201 && code != 202 && code != 204) {
+    CloudBandwidthEstimator * estimator = self.pool.estimator;
+    CloudTrafficStats * trafficStats = self.pool.trafficStats;
+    if (code != 200 && code != 201 && code != 202 && code != 204 && code != 206) { // 206: partial content of a range request
         error = [NSError errorWithDomain:@"Orange Cloud" code:self.response.statusCode userInfo:nil];
+        if (code == 429 || code == 503) { // too many requests, service over capacity
+            [estimator requestDidCongest];
+        }
     } else {
-        if (self.message) {
-            float contentSize = self.responseData.length / 1024.0;
-            NSTimeInterval downloadTime = -[self.startingDate timeIntervalSinceNow];
-            NSLog (@"[CLOUD USAGE] %@: %g kB in %g s => %g kB/s", self.message, contentSize, downloadTime, floor((10*contentSize)/downloadTime)/10.0);
+        // the throughput is the one of the network: compressed bodies count for their encoded size
+        long long wireBytes = [self responseWireBytes];
+        long long contentSize = wireBytes + self.bytesSent;
+        NSTimeInterval downloadTime = -[self.startingDate timeIntervalSinceNow];
+        [estimator addSampleWithBytes:contentSize duration:downloadTime latency:self.latency];
+        [estimator requestDidSucceed];
+        [trafficStats addReceivedBytes:self.responseData.length wireBytes:wireBytes];
+        if ([connection.originalRequest valueForHTTPHeaderField:@"Content-Encoding"] == nil) { // encoded bodies are counted when encoded
+            [trafficStats addSentBytes:self.bytesSent wireBytes:self.bytesSent];
         }
-    }
-    if (FORCE_SERIAL_REQUESTS) {
-        // start new one
-        @synchronized(pendingRequests) {
-            [pendingRequests removeObjectAtIndex:0];
-            if (pendingRequests.count > 0) {
-                NSArray * array = [pendingRequests objectAtIndex:0];
-                NSURLConnection * connection = array[0];
-                CloudConnection * cloudConnection = array[1];
-                cloudConnection.startingDate = [NSDate date];
-                [connection start];
-            }
+        if (self.message) {
+            NSLog (@"[CLOUD USAGE] %@: %g kB in %g s => %g kB/s, %g kB decoded (%@)", self.message, contentSize / 1024.0, downloadTime, floor((10*contentSize/1024.0)/downloadTime)/10.0,
+                   self.responseData.length / 1024.0, estimator);
         }
     }
-    if (self.completionHandler) {
-        self.completionHandler (self.response, self.responseData, error);
+    [self releaseSlot]; // start new one
+    CompletionHandler completionHandler = self.completionHandler;
+    self.completionHandler = nil;
+    self.progressHandler = nil;
+    if (completionHandler) {
+        completionHandler (self.response, self.responseData, error);
     }
 }
 
 - (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error {
     // The request has failed for some reason!
     // Check the error var
-    if (self.completionHandler != nil) {
-        self.completionHandler (self.response, nil, error);
+    if ([error.domain isEqualToString:NSURLErrorDomain] && (error.code == NSURLErrorTimedOut || error.code == NSURLErrorNetworkConnectionLost)) {
+        [self.pool.estimator requestDidCongest];
+    }
+    [self releaseSlot];
+    CompletionHandler completionHandler = self.completionHandler;
+    self.completionHandler = nil;
+    self.progressHandler = nil;
+    if (completionHandler != nil) {
+        completionHandler (self.response, nil, error);
     }
 }
 
@@ -307,9 +464,7 @@ static NSMutableArray * pendingRequests = nil;
         }
         if (TRACE_API_CALL) {
             NSLog (@"[CLOUD API] http error %d (%@)", statusCode, [NSHTTPURLResponse localizedStringForStatusCode:statusCode]);
-            if (data != nil) {
-                NSError * error = nil;
-                NSObject * jsonObject = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
+            if (jsonObject != nil) {
                 NSLog (@"Error message %@", jsonObject);
             }
         }
@@ -350,8 +505,9 @@ static NSMutableArray * pendingRequests = nil;
         } else if (statusCode == 800) {
             return CloudAlreadyExists;
         }
+        return CloudErrorUnknown;
     }
-    return CloudErrorUnknown;
+    return CloudErrorNetworkError; // no HTTP response: the request did not get an answer from the server
 }
 
 @end
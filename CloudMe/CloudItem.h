@@ -51,7 +51,7 @@ typedef enum {
 /** The size, ine bytes, of the item, only available for plain files (i.e. not a directory) */
 @property (nonatomic, readonly) int size;
 
-/** The creation date of the item, only available for plain files (i.e. not a directory) */
+/** The creation date of the item, only available for plain files (i.e. not a directory). nil while unknown, e.g. before a fileInfo call */
 @property (nonatomic, readonly) NSDate * creationDate;
 
 /** The URL to download a preview thumbnail, only available for plain files (i.e. not a directory) */
@@ -77,7 +77,9 @@ typedef enum {
 
 @property (nonatomic) NSMutableArray * extraInfoDelegates;
 
-/** A convenience place to store the thumbnail icon, in order to avoid requesting it from cloud servers multiple times */
+/** A convenience place to store the thumbnail icon, in order to avoid requesting it from cloud servers multiple times.
+ * @see CloudManager thumbnailForItem: to share decoded thumbnails between the items of successive listings, within the memory budget
+ */
 @property (nonatomic) UIImage * thumbnail;
 
 
@@ -89,6 +91,9 @@ typedef enum {
  */
 -(id) initWithDictionary:(NSDictionary*)dictionary;
 
+/** Initialize an item known only by its identity, for example from a local index. Extra info has to be fetched with a fileInfo call */
+- (id) initWithIdentifier:(NSString*)identifier name:(NSString*)name type:(CloudType)type parentIdentifier:(NSString*)parentIdentifier;
+
 /** set info typically returned by a getFileInfo cloud request, like size, creation time, download and thumbnail URLs, ... */
 - (void) setExtraInfo:(NSDictionary*)dictionary;
 
@@ -48,6 +48,17 @@
     return self;
 }
 
+- (id) initWithIdentifier:(NSString*)identifier name:(NSString*)name type:(CloudType)type parentIdentifier:(NSString*)parentIdentifier {
+    self = [super init];
+    if (self != nil) {
+        _identifier = identifier;
+        _name = name;
+        _type = type;
+        _parentIdentifier = parentIdentifier;
+    }
+    return self;
+}
+
 //- (NSString*)thumbnailURL {
 //    return [_thumbnailURL stringByReplacingOccurrencesOfString:@"https://cloudapi-test.orange.com" withString:@"http://ext-api.orange.fr"];
 //}
@@ -75,9 +86,38 @@ static NSString * kThumbnailUrlKey = @"thumbnailUrl";
 static NSString * kPreviewUrlKey = @"previewUrl";
 static NSString * kDownloadUrlKey = @"downloadUrl";
 
+/** the creation date of a dictionary: an ISO 8601 string in API responses, or seconds since 1970 in the dictionaries of extraInfo.
+ * nil when absent, as the date is part of the version of the content */
+static NSDate * dateFromValue (id value) {
+    if ([value isKindOfClass:[NSNumber class]]) {
+        return [value doubleValue] > 0 ? [NSDate dateWithTimeIntervalSince1970:[value doubleValue]] : nil;
+    } else if ([value isKindOfClass:[NSString class]] == NO) {
+        return nil;
+    }
+    static NSArray * formatters = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableArray * array = [[NSMutableArray alloc] init];
+        for (NSString * format in @[@"yyyy-MM-dd'T'HH:mm:ssZZZZZ", @"yyyy-MM-dd'T'HH:mm:ssZZZ", @"yyyy-MM-dd'T'HH:mm:ss.SSSZZZZZ"]) {
+            NSDateFormatter * formatter = [[NSDateFormatter alloc] init];
+            formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+            formatter.dateFormat = format;
+            [array addObject:formatter];
+        }
+        formatters = array;
+    });
+    for (NSDateFormatter * formatter in formatters) {
+        NSDate * date = [formatter dateFromString:value];
+        if (date != nil) {
+            return date;
+        }
+    }
+    return nil;
+}
+
 - (void) setExtraInfo:(NSDictionary *)dictionary {
     _size = [dictionary[kSizeKey] intValue];
-    _creationDate = [NSDate dateWithTimeIntervalSince1970:[dictionary[kCreationDateKey] doubleValue]];
+    _creationDate = dateFromValue (dictionary[kCreationDateKey]);
 
     if (dictionary[kThumbUrlKey] != [NSNull null]) {
         _thumbnailURL = dictionary[kThumbUrlKey];
@@ -0,0 +1,58 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <UIKit/UIKit.h>
+#import "CloudItem.h"
+
+/** The differences between two listings of the same folder, with items matched by identifier.
+ * An item whose name, type, size and creation date did not change is carried forward: the new listing holds the object of the previous one,
+ * with its extra info and its thumbnail, so that a refresh does not fetch them again.
+ * Moves are limited to the items that really changed position: the items kept in place are the longest run of common items in the same order.
+ @code
+ CloudListingDiff * diff = [CloudListingDiff diffFrom:self.entries to:items];
+ self.entries = diff.items;
+ [diff applyToTableView:self.tableView section:0];
+ @endcode
+ */
+@interface CloudListingDiff : NSObject
+
++ (nonnull instancetype) diffFrom:(NSArray<CloudItem*> * _Nullable)oldItems to:(NSArray<CloudItem*> * _Nonnull)newItems;
+
+/** the new listing, with unchanged items replaced by the objects of the previous listing */
+@property (nonatomic, readonly, nonnull) NSArray<CloudItem*> * items;
+
+/** indexes in the previous listing of the items that are gone */
+@property (nonatomic, readonly, nonnull) NSIndexSet * deletedIndexes;
+
+/** indexes in the new listing of the items that were not in the previous one */
+@property (nonatomic, readonly, nonnull) NSIndexSet * insertedIndexes;
+
+/** indexes in the previous listing of the items that stayed in place but changed */
+@property (nonatomic, readonly, nonnull) NSIndexSet * reloadedIndexes;
+
+/** the items that changed position, as pairs of indexes @[ previous index, new index ] */
+@property (nonatomic, readonly, nonnull) NSArray<NSArray<NSNumber*>*> * moves;
+
+/** NO when both listings are identical */
+@property (nonatomic, readonly) BOOL hasChanges;
+
+/** update the rows of a table view section that displayed the previous listing, in a single batch.
+ * The data source must already return the new items. Large changes fall back to reloadData.
+ */
+- (void) applyToTableView:(UITableView * _Nonnull)tableView section:(NSInteger)section;
+
+@end
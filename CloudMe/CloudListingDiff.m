@@ -0,0 +1,173 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudListingDiff.h"
+
+// above this number of changed rows, animating each of them costs more than reloading the table
+static const NSUInteger kMaxAnimatedChanges = 300;
+
+/** YES if a listing reports the same version of the item */
+static BOOL itemIsUnchanged(CloudItem * oldItem, CloudItem * newItem) {
+    return oldItem.type == newItem.type && oldItem.size == newItem.size
+        && (oldItem.name == newItem.name || [oldItem.name isEqualToString:newItem.name])
+        && (oldItem.creationDate == newItem.creationDate || [oldItem.creationDate isEqualToDate:newItem.creationDate]);
+}
+
+@implementation CloudListingDiff
+
++ (instancetype) diffFrom:(NSArray*)oldItems to:(NSArray*)newItems {
+    CloudListingDiff * diff = [[self alloc] init];
+    [diff computeFrom:oldItems ?: @[] to:newItems];
+    return diff;
+}
+
+/** mark the longest increasing subsequence of values, in O(n log n)
+ * @param stays set to YES for the elements of the subsequence
+ */
+static void longestIncreasingSubsequence(const NSUInteger * values, NSUInteger count, BOOL * stays) {
+    if (count == 0) {
+        return;
+    }
+    NSUInteger * tails = malloc(count * sizeof(NSUInteger)); // tails[l]: element ending the best subsequence of length l+1
+    NSUInteger * previous = malloc(count * sizeof(NSUInteger));
+    NSUInteger length = 0;
+    for (NSUInteger k = 0; k < count; k++) {
+        NSUInteger low = 0;
+        NSUInteger high = length;
+        while (low < high) {
+            NSUInteger middle = (low + high) / 2;
+            if (values[tails[middle]] < values[k]) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        previous[k] = low > 0 ? tails[low - 1] : NSNotFound;
+        tails[low] = k;
+        if (low == length) {
+            length++;
+        }
+    }
+    for (NSUInteger k = tails[length - 1]; k != NSNotFound; k = previous[k]) {
+        stays[k] = YES;
+    }
+    free(tails);
+    free(previous);
+}
+
+- (void) computeFrom:(NSArray*)oldItems to:(NSArray*)newItems {
+    NSMutableDictionary * oldIndexes = [[NSMutableDictionary alloc] initWithCapacity:oldItems.count];
+    [oldItems enumerateObjectsUsingBlock:^(CloudItem * item, NSUInteger index, BOOL * stop) {
+        if (item.identifier != nil) {
+            oldIndexes[item.identifier] = [NSNumber numberWithUnsignedInteger:index];
+        }
+    }];
+
+    NSMutableArray * items = [newItems mutableCopy];
+    NSMutableIndexSet * inserted = [[NSMutableIndexSet alloc] init];
+    NSMutableIndexSet * matched = [[NSMutableIndexSet alloc] init];
+    NSMutableIndexSet * changed = [[NSMutableIndexSet alloc] init];
+    // the items found in both listings, in the new order
+    NSUInteger * oldPositions = malloc(MAX(newItems.count, 1) * sizeof(NSUInteger));
+    NSUInteger * newPositions = malloc(MAX(newItems.count, 1) * sizeof(NSUInteger));
+    NSUInteger commonCount = 0;
+    for (NSUInteger j = 0; j < newItems.count; j++) {
+        CloudItem * item = newItems[j];
+        NSNumber * oldIndex = item.identifier != nil ? oldIndexes[item.identifier] : nil;
+        if (oldIndex == nil || [matched containsIndex:oldIndex.unsignedIntegerValue]) {
+            [inserted addIndex:j];
+            continue;
+        }
+        NSUInteger i = oldIndex.unsignedIntegerValue;
+        [matched addIndex:i];
+        oldPositions[commonCount] = i;
+        newPositions[commonCount] = j;
+        commonCount++;
+        if (itemIsUnchanged(oldItems[i], item)) {
+            items[j] = oldItems[i];
+        } else {
+            [changed addIndex:j];
+        }
+    }
+
+    NSMutableIndexSet * deleted = [[NSMutableIndexSet alloc] initWithIndexesInRange:NSMakeRange(0, oldItems.count)];
+    [deleted removeIndexes:matched];
+
+    // the rows not mentioned in a batch update keep their relative order: only the items out of the longest ordered run are moved
+    BOOL * stays = calloc(MAX(commonCount, 1), sizeof(BOOL));
+    longestIncreasingSubsequence(oldPositions, commonCount, stays);
+    NSMutableIndexSet * reloaded = [[NSMutableIndexSet alloc] init];
+    NSMutableArray * moves = [[NSMutableArray alloc] init];
+    for (NSUInteger k = 0; k < commonCount; k++) {
+        NSUInteger i = oldPositions[k];
+        NSUInteger j = newPositions[k];
+        BOOL isChanged = [changed containsIndex:j];
+        if (stays[k]) {
+            if (isChanged) {
+                [reloaded addIndex:i];
+            }
+        } else if (isChanged) { // a row cannot be both moved and reloaded in the same batch
+            [deleted addIndex:i];
+            [inserted addIndex:j];
+        } else {
+            [moves addObject:@[[NSNumber numberWithUnsignedInteger:i], [NSNumber numberWithUnsignedInteger:j]]];
+        }
+    }
+    free(oldPositions);
+    free(newPositions);
+    free(stays);
+
+    _items = items;
+    _deletedIndexes = deleted;
+    _insertedIndexes = inserted;
+    _reloadedIndexes = reloaded;
+    _moves = moves;
+}
+
+- (BOOL) hasChanges {
+    return self.deletedIndexes.count > 0 || self.insertedIndexes.count > 0 || self.reloadedIndexes.count > 0 || self.moves.count > 0;
+}
+
+static NSArray * indexPaths(NSIndexSet * indexes, NSInteger section) {
+    NSMutableArray * indexPaths = [[NSMutableArray alloc] initWithCapacity:indexes.count];
+    [indexes enumerateIndexesUsingBlock:^(NSUInteger index, BOOL * stop) {
+        [indexPaths addObject:[NSIndexPath indexPathForRow:index inSection:section]];
+    }];
+    return indexPaths;
+}
+
+- (void) applyToTableView:(UITableView*)tableView section:(NSInteger)section {
+    if (self.hasChanges == NO) {
+        return;
+    }
+    NSUInteger changeCount = self.deletedIndexes.count + self.insertedIndexes.count + self.reloadedIndexes.count + self.moves.count;
+    if (changeCount > kMaxAnimatedChanges) {
+        [tableView reloadData];
+        return;
+    }
+    [tableView beginUpdates];
+    [tableView deleteRowsAtIndexPaths:indexPaths(self.deletedIndexes, section) withRowAnimation:UITableViewRowAnimationAutomatic];
+    [tableView insertRowsAtIndexPaths:indexPaths(self.insertedIndexes, section) withRowAnimation:UITableViewRowAnimationAutomatic];
+    [tableView reloadRowsAtIndexPaths:indexPaths(self.reloadedIndexes, section) withRowAnimation:UITableViewRowAnimationNone];
+    for (NSArray * move in self.moves) {
+        [tableView moveRowAtIndexPath:[NSIndexPath indexPathForRow:[move[0] integerValue] inSection:section]
+                          toIndexPath:[NSIndexPath indexPathForRow:[move[1] integerValue] inSection:section]];
+    }
+    [tableView endUpdates];
+}
+
+@end
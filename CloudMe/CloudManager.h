@@ -19,6 +19,17 @@
 #import "CloudItem.h"
 #import "CloudConfig.h"
 #import "CloudStatus.h"
+#import "CloudOperation.h"
+#import "CloudTransferManager.h"
+#import "CloudBandwidthEstimator.h"
+#import "CloudCompression.h"
+#import "CloudBlobStore.h"
+#import "CloudMutationJournal.h"
+#import "CloudMemoryGovernor.h"
+
+@class CloudSearchIndex;
+@class CloudQuotaTracker;
+@class CloudConnectionPool;
 
 @interface CloudError : NSError
 @property (nonatomic) CloudStatus status;
@@ -52,6 +63,10 @@ typedef __strong void (^ProgressBlock) (float progress);
 /** a block type used when content has been fetched from servers. Can be used when retrieving thumbnail of file content. On success, status is StatusOK and data is non null.*/
 typedef __strong void (^DataBlock) ( NSData * _Nullable data, CloudStatus status);
 
+/** a block type used when a part of a file content has been fetched. On success, status is StatusOK, data is non null and totalLength is the size of the whole content.
+ * data may start before the requested offset and be longer than requested, when the server does not support ranges: offset is then the position of its first byte. */
+typedef __strong void (^RangeBlock) (NSData * _Nullable data, long long offset, long long totalLength, CloudStatus status);
+
 /** a block type used when free space has been requested. On success, status is StatusOK and size > 0.*/
 typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
 
@@ -60,6 +75,8 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  * Due to the asynchronous nature of cloud requests, these methosd will generally not return a value directly but rather
  * will take a block as parameter that will be called upon success or failure of the underlying network operation. The status of the network operation is passed
  * as one of the block parameter, along with the request result.
+ * Methods issuing a network request return a CloudOperation that can be used to cancel it, in which case the block is not called.
+ * nil is returned when the block has been called immediately because of a bad parameter.
  * A typical usage is to create an instance with the appd ID, secret and callback URL as defined in the Orange Partner portal. Once created this object can open a connection
  * with the Cloud Api using the connect method. then various methods provide means to interact with teh users cloud storage (folder listing, upload, download, ...)
  * @note during the connection phase, user is asked for his/her login and password, then is asked to grant the application access to resources. The specification of 
@@ -78,6 +95,64 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
 /** The network sessions timeout, in case you want to adjust it for special purposes. Default value is 60 seconds */
 @property (nonatomic) CGFloat timeout;
 
+/** The queue on which network responses are decoded (JSON parsing, CloudItem creation, date parsing, ...).
+ * Default value is a concurrent background queue owned by the manager, so that large folder listings do not block the UI.
+ */
+@property (nonatomic, nonnull) NSOperationQueue * processingQueue;
+
+/** The queue on which result and progress blocks are called. Default value is the main queue, so that UI can be updated directly from the blocks.
+ * @note blocks called synchronously because of a bad parameter are still called on the calling thread.
+ */
+@property (nonatomic, nonnull) NSOperationQueue * callbackQueue;
+
+/** The manager of uploads and downloads that go on while the application is suspended, created on first use.
+ * Its pending transfers are started each time the session is opened.
+ */
+@property (nonatomic, readonly, nonnull) CloudTransferManager * transferManager;
+
+/** The journal of file management changes applied locally and sent to the server in the background, created on first use.
+ * Its pending changes are sent each time the session is opened.
+ */
+@property (nonatomic, readonly, nonnull) CloudMutationJournal * mutationJournal;
+
+/** The pool in which the requests of this manager wait for a slot, independent from the pools of the other managers */
+@property (nonatomic, readonly, nonnull) CloudConnectionPool * connectionPool;
+
+/** The measures of the network conditions, fed by every completed request. It drives the number of requests in flight, and can be used
+ * to choose which version of a content to display.
+ */
+@property (nonatomic, readonly, nonnull) CloudBandwidthEstimator * bandwidthEstimator;
+
+/** The counters of the bytes exchanged with the cloud, before and after compression. API responses are requested in gzip or deflate encoding */
+@property (nonatomic, readonly, nonnull) CloudTrafficStats * trafficStats;
+
+/** YES to send the uploads of compressible data (text, documents) gzip encoded. Contents that are already compressed are sent as they are.
+ * Default value is NO, as not every server accepts encoded request bodies: it is turned off when the server rejects an encoded body.
+ */
+@property (atomic) BOOL compressUploads;
+
+/** The local store of downloaded contents, previews and thumbnails. getFileContent, getPreview and getThumbnail return the stored data
+ * when the same version of the file has already been downloaded. Default value is a CloudBlobStore in the caches directory, limited to 200 MB.
+ * Set it to nil to always download.
+ */
+@property (nonatomic, nullable) id<CloudContentStore> contentStore;
+
+/** The governor of the memory used by the thumbnails, listings and request buffers of this manager. Default value is the shared governor.
+ * Its usage by category tells where the memory goes, and its limits can be lowered on devices with little memory.
+ */
+@property (nonatomic, readonly, nonnull) CloudMemoryGovernor * memoryGovernor;
+
+/** The local index of item names, used to search files without any request. It is fed by every listing, and updated by the calls
+ * that create, rename, move, copy or delete items. Default value is an index saved in the caches directory. Set it to nil to disable indexing.
+ * @see buildSearchIndex:result:
+ */
+@property (nonatomic, nullable) CloudSearchIndex * searchIndex;
+
+/** The free space of the account, fetched when the session opens and updated by uploads and deletions. Uploads that cannot fit are
+ * refused with CloudErrorNoSpaceLeft or CloudErrorFileTooBig before any byte is sent.
+ */
+@property (nonatomic, readonly, nonnull) CloudQuotaTracker * quotaTracker;
+
 /** Utility method that returns a readable string version of an error.
  * @param error the error code to be converted into a readable string.
  * @return a string representation of the error, suitable to be presented to a user.
@@ -92,6 +167,16 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  */
 - (id _Nonnull) initWithAppKey:(NSString * _Nonnull)appKey appSecret:(NSString*_Nonnull) appSecret redirectURI:(NSString*_Nonnull)redirectURI;
 
+/** create a cloud session for one of several accounts used side by side. Everything the manager keeps is specific to the account:
+ * its requests have their own connection pool and throughput limits, and its token, caches, index, journal and transfer queue are stored
+ * under names suffixed with the account.
+ * @param account a name identifying the account in the application, nil for the storage names of a single account application
+ */
+- (id _Nonnull) initWithAppKey:(NSString * _Nonnull)appKey appSecret:(NSString*_Nonnull) appSecret redirectURI:(NSString*_Nonnull)redirectURI account:(NSString * _Nullable)account;
+
+/** the account passed at creation, nil for the default one */
+@property (nonatomic, readonly, nullable) NSString * account;
+
 /** Add a scope (i.e. feature) to the list of permissions the user must grant access.
  * The defaut scopes are OpenID and Cloud, to enable connection with user login/password and access to the private part of 
  * the cloud the app is allowed to read and write.
@@ -167,6 +252,17 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  */
 - (BOOL)handleOpenURL:(NSURL * _Nonnull)url;
 
+/** Background transfers need the application to forward this UIApplicationDelegate call to the manager, so that transfers that
+ * completed while the application was not running can be reported.
+@code
+- (void)application:(UIApplication *)application handleEventsForBackgroundURLSession:(NSString *)identifier completionHandler:(void (^)())completionHandler {
+    [cloudManager handleEventsForBackgroundURLSession:identifier completionHandler:completionHandler];
+}
+@endcode
+ * @return YES if the session is the one of the transfer manager
+ */
+- (BOOL) handleEventsForBackgroundURLSession:(NSString * _Nonnull)identifier completionHandler:(void (^ _Nonnull)(void))completionHandler;
+
 /** When opening a session failed, there are a few cases related to the Cloud management itself and requiring secific user actions.
  * The following method will handle these cases and display an alert popup that can lead to the proper action upon user agreement.
  * You will typically call this method in the failure block of the openSessionWithToken method.
@@ -193,7 +289,7 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  }];
 @endcode
  */
-- (void)rootFolder:(FileInfoBlock _Nonnull)success;
+- (CloudOperation * _Nullable) rootFolder:(FileInfoBlock _Nonnull)success;
 
 /** List the content of a folder. You must call this method first to be able to access to cloud information. No parameter is returned, rather a bloc of code is called
  * when either the session was successfully open or failed.
@@ -208,7 +304,7 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  * @param result a block of code called with the list of files contained in the folder and StatusOK, or nil and the error code if a problem occurred.
  * @note You probably need to first get the root folder content, using nil as the folderID. Then you can browse recursively the user file tree using this method.
  */
-- (void)listFolder:(CloudItem * _Nonnull)folderCloudItem
+- (CloudOperation * _Nullable) listFolder:(CloudItem * _Nonnull)folderCloudItem
     restrictedMode:(BOOL)restrictedMode
     showThumbnails:(BOOL)showThumbnails
             filter:(FilterType)filter
@@ -222,19 +318,31 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  * restrictedMode, showThumbnails, flat, tree are false, filter is FilterTypeAll, limit and offset are zero
  * @warning the download url is not fetched using this set of default parameters. This may have an impact on existing code. You should probably use the other listFolder call with showThumnails set to TRUE. 
  */
-- (void)listFolder:(CloudItem* _Nonnull)folderCloudItem result:(ListFolderBlock _Nonnull)result;
+- (CloudOperation * _Nullable) listFolder:(CloudItem* _Nonnull)folderCloudItem result:(ListFolderBlock _Nonnull)result;
+
+/** The content of the folder as returned by its last complete listing, if still in memory, without any request.
+ * It can be displayed while the folder is listed again, it may be outdated. Listings are released under memory pressure.
+ */
+- (NSArray * _Nullable) cachedListingOfFolder:(CloudItem * _Nonnull)folderCloudItem;
+
+/** Index the whole content of a folder in the search index, with flat listings of a few hundred items at a time.
+ * It is typically called once after the first login, so that searches cover the folders the user has never browsed.
+ * @param folderCloudItem the folder to index, typically the root folder.
+ * @param result a block of code called with StatusOK once every item has been indexed, or the error code of the listing that failed.
+ */
+- (CloudOperation * _Nullable) buildSearchIndex:(CloudItem * _Nonnull)folderCloudItem result:(ResultBlock _Nonnull)result;
 
 /** Get more information about a file. In particular, the following information is returned: size, creation time, thumbnail and download URL.
  * @note the cloud file object passed to the @i success callback is the one passed as first parameter, with new field values.
  * @param cloudFile an object returned by listFolder.
  * @param result a block of code called with the initial cloud file object augmented with new field values (like size, creation time, thumbnail and download URL) and StatusOK, or nil and the error code if a problem occurred..
  */
-- (void) fileInfo:(CloudItem * _Nonnull)cloudFile result:(FileInfoBlock _Nonnull)result;
+- (CloudOperation * _Nullable) fileInfo:(CloudItem * _Nonnull)cloudFile result:(FileInfoBlock _Nonnull)result;
 
 /** Get the available space of the current account.
  * @param result a block of code called with the available free space, in bytes and StatusOK, or nil and the error code if a problem occurred.
  */
-- (void) getFreeSpace:(FreeSpaceBlock _Nonnull) result;
+- (CloudOperation * _Nullable) getFreeSpace:(FreeSpaceBlock _Nonnull) result;
 
 /** Fetch the thumbnail data associated with file stored in the cloud. A thumbnail is a small and square graphical (around 144x144) representation of the content data.
  * The data returned in the @i success callback are suitable to be decoded as an image, like below:
@@ -251,7 +359,15 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  * @param cloudFile the cloud file object containing the thumbnail URL.
  * @param result a block of code called with the data associated with the thumbnail and StatusOK, or nil and the error code if a problem occurred.
  */
-- (void) getThumbnail:(CloudItem * _Nonnull)cloudFile result:(DataBlock _Nonnull)result;
+- (CloudOperation * _Nullable) getThumbnail:(CloudItem * _Nonnull)cloudFile result:(DataBlock _Nonnull)result;
+
+/** The decoded thumbnail of a file, as stored by setThumbnail:forItem:. It is shared by the items of the same version of the file,
+ * and its bitmap is released under memory pressure: it can become nil again.
+ */
+- (UIImage * _Nullable) thumbnailForItem:(CloudItem * _Nonnull)cloudFile;
+
+/** Keep the decoded thumbnail of a file in memory, accounted as bitmaps by the memory governor. A nil thumbnail removes it */
+- (void) setThumbnail:(UIImage * _Nullable)thumbnail forItem:(CloudItem * _Nonnull)cloudFile;
 
 /** Get the preview image associated with file stored in the cloud. A preview is a small version of the graphical 
  * representation of the content data, suitable to be displayed on a mobile phone screen.
@@ -269,7 +385,7 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  * @param cloudFile the cloud file object containing the thumbnail URL.
  * @param success a block of code called with the data associated with the preview and StatusOK, or nil and the error code if a problem occurred.
  */
-- (void) getPreview:(CloudItem * _Nonnull)cloudFile result:(DataBlock _Nonnull)result;
+- (CloudOperation * _Nullable) getPreview:(CloudItem * _Nonnull)cloudFile result:(DataBlock _Nonnull)result;
 
 /** Create a new folder.
  * @note The parent folder identifier is typically retreived with a listFolder call.
@@ -277,7 +393,7 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  * @param parentCloudItem the cloud item of the folder to be created.
  * @param result a block of code called with the new folder info and StatusOK, or nil and the error code if a problem occurred.
  */
-- (void) createFolder:(NSString*_Nonnull)folderName parent:(CloudItem*_Nonnull)parentCloudItem result:(FileInfoBlock _Nonnull)result;
+- (CloudOperation * _Nullable) createFolder:(NSString*_Nonnull)folderName parent:(CloudItem*_Nonnull)parentCloudItem result:(FileInfoBlock _Nonnull)result;
 
 /** Retrieve the file content stored in the cloud.
  * The data returned in the @i success callback is the exact content of the file. For instance, if the file is an image, its usage is pretty similar to getThumbnail:
@@ -291,10 +407,20 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  }];
  @endcode
  * @warning the file info must have been retrieved first to be able to call this method.
+ * @note the content is kept in the content store: asking again for the same version of the file returns the stored content, memory mapped, without network access.
  * @param cloudFile the cloud file object containing the download URL.
  * @param result a block of code called with the file content data and StatusOK, or nil and the error code if a problem occurred.
  */
-- (void) getFileContent:(CloudItem * _Nonnull)cloudFile result:(DataBlock _Nonnull)result;
+- (CloudOperation * _Nullable) getFileContent:(CloudItem * _Nonnull)cloudFile result:(DataBlock _Nonnull)result;
+
+/** Retrieve a part of the file content with an HTTP range request, for example to play a video while it is downloaded.
+ * The content store is not used: see CloudMediaLoader for a cache of the parts already downloaded.
+ * @param cloudFile the cloud file object containing the download URL.
+ * @param offset the position of the first byte.
+ * @param length the number of bytes, 0 for the rest of the file.
+ * @param result a block of code called with the data and StatusOK, or nil and the error code if a problem occurred.
+ */
+- (CloudOperation * _Nullable) getFileContent:(CloudItem * _Nonnull)cloudFile offset:(long long)offset length:(long long)length result:(RangeBlock _Nonnull)result;
 
 /** Rename a file or a folder
  * @param cloudFile the cloud file object to rename.
@@ -302,7 +428,7 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  * @param result a block of code called with the new file/folder info and StatusOK, or nil and the error code if a problem occurred.
  * @warning the id of renamed the file will have probably changed
  */
-- (void) rename :(CloudItem * _Nonnull)cloudFile newName:(NSString * _Nonnull)newName result:(FileInfoBlock _Nonnull)result;
+- (CloudOperation * _Nullable) rename :(CloudItem * _Nonnull)cloudFile newName:(NSString * _Nonnull)newName result:(FileInfoBlock _Nonnull)result;
 
 /** Move a file or a folder
  * @param cloudFile the cloud file object to rename.
@@ -310,7 +436,7 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  * @param result a block of code called with the new file/folder info and StatusOK, or nil and the error code if a problem occurred.
  * @warning the id of renamed the file will have probably changed
  */
-- (void) move :(CloudItem * _Nonnull)cloudFile destination:(CloudItem * _Nonnull)destination result:(FileInfoBlock _Nonnull)result;
+- (CloudOperation * _Nullable) move :(CloudItem * _Nonnull)cloudFile destination:(CloudItem * _Nonnull)destination result:(FileInfoBlock _Nonnull)result;
 
 /** Copy a file or a folder
  * @param cloudFile the cloud file object to rename.
@@ -318,7 +444,7 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  * @param result a block of code called with the new file/folder info and StatusOK, or nil and the error code if a problem occurred.
  * @warning the id of renamed the file will have probably changed
  */
-- (void) copy :(CloudItem * _Nonnull)cloudFile destination:(CloudItem * _Nonnull)destination result:(FileInfoBlock _Nonnull)result;
+- (CloudOperation * _Nullable) copy :(CloudItem * _Nonnull)cloudFile destination:(CloudItem * _Nonnull)destination result:(FileInfoBlock _Nonnull)result;
 
 /** Upload data content in a new file inside a folder
  * @param data the data to upload. This can be arbitrary data, like text or binary image compressed data.
@@ -327,18 +453,18 @@ typedef __strong void (^FreeSpaceBlock) (long size, CloudStatus status);
  * @param progress a block of code called whenever a chunk of data has been uploaded. The parameter is teh download percentage, from 0 to 1.
  * @param result a block of code called when data has been succesfully uploaded or when a problem occurred.
  */
-- (void) uploadData:(NSData*_Nonnull)data filename:(NSString*_Nonnull)filename folderID:(NSString*_Nonnull)folderID progress:(ProgressBlock _Nullable)progress result:(FileInfoBlock _Nonnull)result;
+- (CloudOperation * _Nullable) uploadData:(NSData*_Nonnull)data filename:(NSString*_Nonnull)filename folderID:(NSString*_Nonnull)folderID progress:(ProgressBlock _Nullable)progress result:(FileInfoBlock _Nonnull)result;
 
 /** Delete a folder and all its files and subfolders. You should really pay attention when calling this method as files will be permanentely deleted.
  * @param folderCloudItem the cloudItem of the folder that is to be deleted.
  * @param result a block of code called when folder has been succesfully deleted or when a problem occurred.
  */
-- (void) deleteFolder:(CloudItem * _Nonnull)folderCloudItem result:(ResultBlock _Nonnull)result;
+- (CloudOperation * _Nullable) deleteFolder:(CloudItem * _Nonnull)folderCloudItem result:(ResultBlock _Nonnull)result;
 
 /** Delete permanentely a single file.
  * @param fileCloudItem the cloudItem of the folder that is to be deleted.
  * @param result a block of code called when file has been succesfully deleted or when a problem occurred.
  */
-- (void) deleteFile:(CloudItem * _Nonnull)fileCloudItem result:(ResultBlock _Nonnull)result;
+- (CloudOperation * _Nullable) deleteFile:(CloudItem * _Nonnull)fileCloudItem result:(ResultBlock _Nonnull)result;
 
 @end
@@ -16,10 +16,14 @@
 
 
 #import "CloudManager.h"
+#import "CloudManagerInternal.h"
 #import "CloudItem.h"
 #import "CloudConnection.h"
+#import "CloudOperation.h"
 #import <Foundation/NSURLError.h>
 #import "OIDCManager.h"
+#import "CloudSearchIndex.h"
+#import "CloudQuotaTracker.h"
 
 @implementation CloudError
 - (id) initWithStatus:(CloudStatus)status {
@@ -40,7 +44,6 @@
 @property (nonatomic) NSString * cloudServer;
 @property (nonatomic) NSString * contentServer;
 @property (nonatomic) NSString * esid;
-@property (nonatomic) NSDateFormatter * dateFormatter;
 @property (nonatomic) NSString * verbSession;
 @property (nonatomic) NSString * verbListFolder;
 @property (nonatomic) NSString * verbCreateFolder;
@@ -56,13 +59,30 @@
 @property (nonatomic) UIAlertView * alertEULA;
 @property (nonatomic) UIAlertView * alertSubscribe;
 
+@property (nonatomic) CloudMemoryCache * thumbnailDataCache; // content key -> thumbnail bytes
+@property (nonatomic) CloudMemoryCache * thumbnailCache; // content key -> decoded thumbnail
+@property (nonatomic) CloudMemoryCache * listingCache; // folder identifier -> items of the last complete listing
+
 @end
 
 typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError * error);
 
+static NSString * const kUploadBoundary = @"UploadBoundary";
+
+static const unsigned long long kDefaultContentBudget = 200 * 1024 * 1024;
+
+// the memory held by a listed item with its extra info, used as the cost of the cached listings
+static const unsigned long long kEstimatedItemSize = 512;
+
+// the number of items listed by each request of buildSearchIndex
+static const int kSearchIndexPageSize = 500;
+
 
 @implementation CloudManager
 
+@synthesize transferManager = _transferManager;
+@synthesize mutationJournal = _mutationJournal;
+
 + (CloudManager*)sharedInstance {
     static dispatch_once_t once;
     static id sharedInstance;
@@ -112,8 +132,13 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
 //#define BETA
 
 - (id) initWithAppKey:(NSString*)appKey appSecret:(NSString*) appSecret redirectURI:(NSString*)redirectURI {
+    return [self initWithAppKey:appKey appSecret:appSecret redirectURI:redirectURI account:nil];
+}
+
+- (id) initWithAppKey:(NSString*)appKey appSecret:(NSString*) appSecret redirectURI:(NSString*)redirectURI account:(NSString*)account {
     self = [super init];
     if (self != nil) {
+        _account = [account copy];
         
 #ifdef BETA
         NSString * version = @"beta";
@@ -143,13 +168,25 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
         // configure internal properties
         self.timeout = 60.0;
         _token = @"unvalidToken";
-        self.dateFormatter = [[NSDateFormatter alloc] init];
-        [self.dateFormatter setDateFormat:@"yyyy-MM-dd'T'HH:mm:ssZZZ"];
-        [self.dateFormatter setTimeZone:[NSTimeZone localTimeZone]];
+        self.processingQueue = [[NSOperationQueue alloc] init];
+        self.processingQueue.name = @"CloudManager processing";
+        self.processingQueue.qualityOfService = NSQualityOfServiceUtility;
+        self.callbackQueue = [NSOperationQueue mainQueue];
+        NSURL * caches = [[[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask] firstObject];
+        self.contentStore = [[CloudBlobStore alloc] initWithDirectory:[caches URLByAppendingPathComponent:[self storageName:@"CloudContent"]] diskBudget:kDefaultContentBudget];
+        self.searchIndex = [[CloudSearchIndex alloc] initWithURL:[caches URLByAppendingPathComponent:[self storageName:@"CloudSearchIndex.plist"]]];
+        _memoryGovernor = [CloudMemoryGovernor sharedGovernor];
+        _connectionPool = [[CloudConnectionPool alloc] init];
+        _connectionPool.memoryGovernor = _memoryGovernor;
+        self.thumbnailDataCache = [[CloudMemoryCache alloc] initWithCategory:CloudMemoryCategoryThumbnails governor:_memoryGovernor];
+        self.thumbnailCache = [[CloudMemoryCache alloc] initWithCategory:CloudMemoryCategoryBitmaps governor:_memoryGovernor];
+        self.listingCache = [[CloudMemoryCache alloc] initWithCategory:CloudMemoryCategoryListings governor:_memoryGovernor];
+        _quotaTracker = [[CloudQuotaTracker alloc] initWithManager:self];
         _isConnected = NO;
         
         // create the authent manager
-        self.oidcManager = [[OIDCManager alloc] initWithAppKey:appKey appSecret:appSecret redirectURI:redirectURI];
+        self.oidcManager = [[OIDCManager alloc] initWithAppKey:appKey appSecret:appSecret redirectURI:redirectURI account:account];
+        self.oidcManager.connectionPool = _connectionPool;
         [self.oidcManager addScope:GrantScopeCloud];
         
     }
@@ -265,6 +302,8 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
             return @"Already exists";
         case CloudErrorNotFound:
             return @"File not found";
+        case CloudErrorCancelled:
+            return @"Cancelled";
         case CloudErrorUnknown:
             return [NSString stringWithFormat:@"%@ (%d)", @"unknown error", status];
     }
@@ -283,40 +322,47 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
     NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:sessionUrl cachePolicy:NSURLRequestUseProtocolCachePolicy timeoutInterval:self.timeout];
     [request setHTTPMethod:method];
     [request setValue:[@"Bearer " stringByAppendingString:self.token] forHTTPHeaderField:@"Authorization"];
+    [request setValue:@"gzip, deflate" forHTTPHeaderField:@"Accept-Encoding"]; // JSON listings shrink about 10 times
 //    if (self.esid != nil) {
 //        [request setValue:self.esid forHTTPHeaderField:@"X-Orange-CA-ESID"];
 //    }
     return request;
 }
 
-- (NSMutableURLRequest *) postRequestWithEndpoint:(NSString*)endpoint filename:(NSString*)filename data:(NSData *)filedata folder:(NSString*)folderID {
-    NSString *boundary = @"UploadBoundary";
-    NSMutableURLRequest * request = [self requestWithMethod:@"POST" endpoint:[NSString stringWithFormat:@"%@%@", self.contentServer, endpoint]];
-    
-    [request addValue:[NSString stringWithFormat:@"multipart/form-data; boundary=%@", boundary] forHTTPHeaderField:@"Content-Type"];
-    
-    NSMutableData * body = [[NSMutableData alloc] init];
-    
-    // add header
+- (NSMutableURLRequest *) uploadRequest {
+    NSMutableURLRequest * request = [self requestWithMethod:@"POST" endpoint:[NSString stringWithFormat:@"%@%@", self.contentServer, self.verbUpload]];
+    [request addValue:[NSString stringWithFormat:@"multipart/form-data; boundary=%@", kUploadBoundary] forHTTPHeaderField:@"Content-Type"];
+    return request;
+}
+
+- (NSData *) multipartHeaderWithFilename:(NSString*)filename size:(long long)size folder:(NSString*)folderID {
+    NSMutableData * header = [[NSMutableData alloc] init];
     NSDictionary * dict = @{
                             @"name" : filename,
-                            @"size" : [NSString stringWithFormat:@"%d", (int)filedata.length],
+                            @"size" : [NSString stringWithFormat:@"%lld", size],
                             @"folder" : folderID,
                             };
-    [body appendData:[[NSString stringWithFormat:@"\r\n--%@\r\n",boundary] dataUsingEncoding:NSUTF8StringEncoding]];
-    [body appendData:[[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"description\"\r\n\r\n"] dataUsingEncoding:NSUTF8StringEncoding]];
-    [body appendData:[NSJSONSerialization dataWithJSONObject:dict options:NSJSONWritingPrettyPrinted error:nil]];
+    [header appendData:[[NSString stringWithFormat:@"\r\n--%@\r\n", kUploadBoundary] dataUsingEncoding:NSUTF8StringEncoding]];
+    [header appendData:[[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"description\"\r\n\r\n"] dataUsingEncoding:NSUTF8StringEncoding]];
+    [header appendData:[NSJSONSerialization dataWithJSONObject:dict options:NSJSONWritingPrettyPrinted error:nil]];
     
-    [body appendData:[[NSString stringWithFormat:@"\r\n--%@\r\n", boundary] dataUsingEncoding:NSUTF8StringEncoding]];
-    [body appendData:[[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"file\"; filename=\"%@\"\r\n", filename] dataUsingEncoding:NSUTF8StringEncoding]];
-    [body appendData:[[NSString stringWithFormat:@"Content-Type: %@", @"image/jpeg\r\n\r\n"] dataUsingEncoding:NSUTF8StringEncoding]];
+    [header appendData:[[NSString stringWithFormat:@"\r\n--%@\r\n", kUploadBoundary] dataUsingEncoding:NSUTF8StringEncoding]];
+    [header appendData:[[NSString stringWithFormat:@"Content-Disposition: form-data; name=\"file\"; filename=\"%@\"\r\n", filename] dataUsingEncoding:NSUTF8StringEncoding]];
+    [header appendData:[[NSString stringWithFormat:@"Content-Type: %@", @"image/jpeg\r\n\r\n"] dataUsingEncoding:NSUTF8StringEncoding]];
+    return header;
+}
+
+- (NSData *) multipartFooter {
+    return [[NSString stringWithFormat:@"\r\n--%@--\r\n", kUploadBoundary] dataUsingEncoding:NSUTF8StringEncoding];
+}
 
+- (NSMutableURLRequest *) postRequestWithFilename:(NSString*)filename data:(NSData *)filedata folder:(NSString*)folderID {
+    NSMutableURLRequest * request = [self uploadRequest];
+    NSMutableData * body = [[NSMutableData alloc] init];
+    [body appendData:[self multipartHeaderWithFilename:filename size:filedata.length folder:folderID]];
     [body appendData:filedata];
-    
-    [body appendData:[[NSString stringWithFormat:@"\r\n--%@--\r\n", boundary] dataUsingEncoding:NSUTF8StringEncoding]];
-    
+    [body appendData:[self multipartFooter]];
     [request setHTTPBody:body];
-
     return request;
 }
 
@@ -325,13 +371,34 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
     [request setHTTPBody: [jsonString dataUsingEncoding:NSUTF8StringEncoding]];
 }
 
-- (void) sendRequest:(NSURLRequest*)request info:(NSString*)info completionHandler:(void (^)(NSURLResponse*, NSData*, NSError*))completionHandler {
-    [self sendRequest:request info:info progressHandler:nil completionHandler:completionHandler];
+- (CloudConnection*) sendRequest:(NSURLRequest*)request info:(NSString*)info operation:(CloudOperation*)operation completionHandler:(void (^)(NSURLResponse*, NSData*, NSError*))completionHandler {
+    return [self sendRequest:request info:info progressHandler:nil operation:operation completionHandler:completionHandler];
 }
 
-- (void) sendRequest:(NSURLRequest*)request info:(NSString*)info progressHandler:(void (^)(float))progressHandler completionHandler:(void (^)(NSURLResponse*, NSData*, NSError*))completionHandler {
+/** send the request and attach the resulting connection to the operation, if any, so that cancelling the operation cancels the connection */
+- (CloudConnection*) sendRequest:(NSURLRequest*)request info:(NSString*)info progressHandler:(void (^)(float))progressHandler operation:(CloudOperation*)operation completionHandler:(void (^)(NSURLResponse*, NSData*, NSError*))completionHandler {
     [CloudUtil dumpAsCurl:request withMessage:info];
-    [CloudConnection sendAsynchronousRequest:request queue:[NSOperationQueue mainQueue] message:TRACE_BANDWIDTH_USAGE ? info : nil progressHandler:progressHandler completionHandler:completionHandler];
+    ProgressHandler progress = nil;
+    if (progressHandler != nil) {
+        progress = ^(float value) {
+            [self deliver:^{ progressHandler (value); } operation:operation];
+        };
+    }
+    // the completion handler is called on the processing queue, it is up to it to deliver the user result on the callback queue
+    CloudConnection * connection = [CloudConnection sendAsynchronousRequest:request pool:self.connectionPool queue:self.processingQueue message:TRACE_BANDWIDTH_USAGE ? info : nil
+                                                            progressHandler:progress completionHandler:completionHandler];
+    [operation attach:connection];
+    return connection;
+}
+
+/** call a user block on the callback queue, unless the operation has been cancelled in the meantime.
+ * Responses are decoded on the processing queue, only the final user block should go through this method */
+- (void) deliver:(void (^)(void))block operation:(CloudOperation*)operation {
+    [self.callbackQueue addOperationWithBlock:^{
+        if (operation.isCancelled == NO) {
+            block ();
+        }
+    }];
 }
 
 - (void) openSessionFrom:(UIViewController*) parentController result:(ResultBlock)result {
@@ -339,6 +406,9 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
         if (status == AuthenticationOK) {
             self.token = token;
             _isConnected = YES;
+            [self.quotaTracker revalidate:nil]; // pending uploads wait for the free space before being sent
+            [_transferManager resume];
+            [_mutationJournal resume];
 
             result (StatusOK);
             //[self openSessionWithToken:token result:result];
@@ -357,6 +427,53 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
     return [self.oidcManager handleOpenURL:url];
 }
 
+- (CloudTransferManager*) transferManager {
+    @synchronized(self) {
+        if (_transferManager == nil) {
+            NSString * identifier = [NSString stringWithFormat:@"%@.%@", [NSBundle mainBundle].bundleIdentifier, [self storageName:@"CloudTransfers"]];
+            _transferManager = [[CloudTransferManager alloc] initWithManager:self identifier:identifier];
+            __weak CloudTransferManager * transferManager = _transferManager;
+            self.quotaTracker.availableSpaceHandler = ^{
+                [transferManager resume];
+            };
+        }
+        return _transferManager;
+    }
+}
+
+- (CloudMutationJournal*) mutationJournal {
+    @synchronized(self) {
+        if (_mutationJournal == nil) {
+            NSURL * support = [[[NSFileManager defaultManager] URLsForDirectory:NSApplicationSupportDirectory inDomains:NSUserDomainMask] firstObject];
+            _mutationJournal = [[CloudMutationJournal alloc] initWithManager:self url:[support URLByAppendingPathComponent:[self storageName:@"CloudMutations.plist"]]];
+        }
+        return _mutationJournal;
+    }
+}
+
+- (CloudBandwidthEstimator*) bandwidthEstimator {
+    return self.connectionPool.estimator;
+}
+
+- (CloudTrafficStats*) trafficStats {
+    return self.connectionPool.trafficStats;
+}
+
+- (NSString*) storageName:(NSString*)name {
+    if (self.account == nil) {
+        return name;
+    }
+    // the account may contain characters that are not allowed in file names, such as '/'
+    NSString * suffix = [self.account stringByAddingPercentEncodingWithAllowedCharacters:[NSCharacterSet alphanumericCharacterSet]];
+    NSString * extension = name.pathExtension;
+    NSString * base = [NSString stringWithFormat:@"%@-%@", name.stringByDeletingPathExtension, suffix];
+    return extension.length > 0 ? [base stringByAppendingPathExtension:extension] : base;
+}
+
+- (BOOL) handleEventsForBackgroundURLSession:(NSString*)identifier completionHandler:(void (^)(void))completionHandler {
+    return [self.transferManager handleEventsForBackgroundURLSession:identifier completionHandler:completionHandler];
+}
+
 - (void) setUseRefreshToken:(BOOL) useRefreshToken {
     self.oidcManager.useRefreshToken = useRefreshToken;
 }
@@ -380,7 +497,7 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
 - (void) openSessionWithToken:(NSString*)token result:(ResultBlock)result {
     self.token = token;
     NSMutableURLRequest *request = [self requestWithMethod:@"POST" endpoint:self.verbSession];
-    [self sendRequest:request info:@"openSession" completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+    [self sendRequest:request info:@"openSession" operation:nil completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
         if (error == nil) {
             NSObject * jsonObject = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
             if (error != nil) {
@@ -391,13 +508,9 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
             } else {
                 NSDictionary * dictionary = (NSDictionary*)jsonObject;
                 [CloudUtil dumpAsJSON:dictionary withMessage:@"got token"];
-//                self.esid = dictionary[@"esid"];
-//                if (self.esid == nil) {
-//                    result (CloudErrorResponseMalformed);
-//                } else {
-//                    _isConnected = YES;
-//                    result(StatusOK);
-//                }
+                // the token identifies the session: there is no session identifier to keep
+                _isConnected = YES;
+                result (StatusOK);
             }
         } else {
             result ([CloudUtil statusFromConnection:response data:data]);
@@ -409,40 +522,61 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
 
 - (void) reopenSession:(ResultBlock)result {
     _isConnected = NO;
-    [self openSessionWithToken:self.token result:result];
+    [self openSessionWithToken:self.token result:^(CloudStatus status) {
+        if (status == StatusOK) { // background transfers and journal changes parked by the expiration do not retry by themselves
+            [_transferManager resume];
+            [_mutationJournal resume];
+        }
+        result (status);
+    }];
 }
 
-- (void)rootFolder:(FileInfoBlock)result {
+- (CloudOperation*) rootFolder:(FileInfoBlock)result {
     NSMutableURLRequest *request = [self requestWithMethod:@"GET" endpoint:[self.verbListFolder stringByAppendingString:@"?restrictedmode"]];
-    [self sendRequest:request info:@"listFolder" completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    [self sendRequest:request info:@"listFolder" operation:operation completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
         if (error == nil) {
             NSObject * jsonObject = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
             if (error != nil || [jsonObject isKindOfClass:[NSDictionary class]] == NO) {
-                result (nil, CloudErrorResponseMalformed);
+                [self deliver:^{ result (nil, CloudErrorResponseMalformed); } operation:operation];
             } else {
                 NSDictionary * dictionary = (NSDictionary*)jsonObject;
                 [CloudUtil dumpAsJSON:dictionary withMessage:@"root folder content"];
-                result ([[CloudItem alloc] initWithDictionary:dictionary], StatusOK);
+                CloudItem * root = [[CloudItem alloc] initWithDictionary:dictionary];
+                [self deliver:^{ result (root, StatusOK); } operation:operation];
             }
         } else {
             CloudStatus status = [CloudUtil statusFromConnection:response data:data];
             if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to open teh session et relauch the request
                 NSLog (@"rootFolderWithSuccess: session expired, retrying");
-                [self reopenSession:^(CloudStatus status){ [self rootFolder:result]; }];
+                [self reopenSession:^(CloudStatus status){ [operation attach:[self rootFolder:result]]; }];
                 //[self reopenSessionWithFailure:failure success:^{ [self rootFolderWithSuccess:success failure:failure]; }];
             } else {
-                result (nil, status);
+                [self deliver:^{ result (nil, status); } operation:operation];
             }
         }
     }];
+    return operation;
 
 }
 
 - (NSString*) getFilterName:(FilterType)type {
-    return @"other";
+    switch (type) {
+        case FilterTypeImage:
+            return @"image";
+        case FilterTypeVideo:
+            return @"video";
+        case FilterTypeAudio:
+            return @"audio";
+        case FilterTypeOther:
+            return @"other";
+        case FilterTypeAll:
+            break;
+    }
+    return nil;
 }
 
-- (void)listFolder:(CloudItem * _Nonnull)folderCloudItem
+- (CloudOperation*) listFolder:(CloudItem * _Nonnull)folderCloudItem
     restrictedMode:(BOOL)restrictedMode
     showThumbnails:(BOOL)showThumbnails
             filter:(FilterType)filter
@@ -470,16 +604,33 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
         prefix = @"&";
     }
     if (filter != FilterTypeAll) {
-        endPoint = [endPoint stringByAppendingFormat:@"%@%@", prefix, [self getFilterName:filter]];
+        endPoint = [endPoint stringByAppendingFormat:@"%@filter=%@", prefix, [self getFilterName:filter]];
+        prefix = @"&";
+    }
+    if (flat) {
+        endPoint = [endPoint stringByAppendingFormat:@"%@flat", prefix];
+        prefix = @"&";
+    }
+    if (tree) {
+        endPoint = [endPoint stringByAppendingFormat:@"%@tree", prefix];
+        prefix = @"&";
+    }
+    if (limit > 0) {
+        endPoint = [endPoint stringByAppendingFormat:@"%@limit=%d", prefix, limit];
+        prefix = @"&";
+    }
+    if (offset > 0) {
+        endPoint = [endPoint stringByAppendingFormat:@"%@offset=%d", prefix, offset];
         prefix = @"&";
     }
     
     request = [self requestWithMethod:@"GET" endpoint:endPoint];
-    [self sendRequest:request info:@"listFolder" completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    [self sendRequest:request info:@"listFolder" operation:operation completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
         if (error == nil) {
             NSObject * jsonObject = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
             if (error != nil || [jsonObject isKindOfClass:[NSDictionary class]] == NO) {
-                result (nil, CloudErrorResponseMalformed);
+                [self deliver:^{ result (nil, CloudErrorResponseMalformed); } operation:operation];
             } else {
                 NSDictionary * dictionary = (NSDictionary*)jsonObject;
                 [CloudUtil dumpAsJSON:dictionary withMessage:@"got folder content"];
@@ -492,121 +643,258 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
                 for (NSDictionary * dictionary in dirArray) {
                     [files addObject:[[CloudItem alloc] initWithDictionary:dictionary]];
                 }
-                result (files, StatusOK);
+                if (filter == FilterTypeAll && limit == 0 && offset == 0 && flat == NO && tree == NO) {
+                    // a complete listing also tells which items are gone
+                    [self.searchIndex updateFolder:folderCloudItem items:files];
+                    if (folderCloudItem.identifier != nil) {
+                        [self.listingCache setObject:files forKey:folderCloudItem.identifier cost:files.count * kEstimatedItemSize];
+                    }
+                } else {
+                    [self.searchIndex addItems:files parent:flat || tree ? nil : folderCloudItem];
+                }
+                [self deliver:^{ result (files, StatusOK); } operation:operation];
             }
         } else {
             CloudStatus status = [CloudUtil statusFromConnection:response data:data];
             if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to reopen the session et relauch the request
                 NSLog (@"listFolder: session expired, retrying");
-                [self reopenSession:^(CloudStatus status){ [self listFolder:folderCloudItem result:result]; }];
+                [self reopenSession:^(CloudStatus status){ [operation attach:[self listFolder:folderCloudItem restrictedMode:restrictedMode showThumbnails:showThumbnails filter:filter flat:flat tree:tree limit:limit offset:offset result:result]]; }];
             } else {
-                result (nil, status);
+                [self deliver:^{ result (nil, status); } operation:operation];
             }
         }
     }];
+    return operation;
+}
+
+- (CloudOperation*) listFolder:(CloudItem * _Nonnull)folderCloudItem result:(ListFolderBlock _Nonnull)result {
+    return [self listFolder:folderCloudItem restrictedMode:NO showThumbnails:NO filter:FilterTypeAll flat:NO tree:NO limit:0 offset:0 result:result];
 }
 
-- (void)listFolder:(CloudItem * _Nonnull)folderCloudItem result:(ListFolderBlock _Nonnull)result {
-    [self listFolder:folderCloudItem restrictedMode:NO showThumbnails:NO filter:FilterTypeAll flat:NO tree:NO limit:0 offset:0 result:result];
+- (NSArray*) cachedListingOfFolder:(CloudItem*)folderCloudItem {
+    return folderCloudItem.identifier == nil ? nil : [self.listingCache objectForKey:folderCloudItem.identifier];
 }
 
-- (void) fileInfo:(CloudItem *)cloudFile result:(FileInfoBlock)result  {
+/** list one page of the flat content of the folder, then the next one until the listing is complete */
+- (void) indexFolder:(CloudItem*)folderCloudItem offset:(int)offset operation:(CloudOperation*)operation result:(ResultBlock)result {
+    [operation attach:[self listFolder:folderCloudItem restrictedMode:NO showThumbnails:NO filter:FilterTypeAll flat:YES tree:NO limit:kSearchIndexPageSize offset:offset result:^(NSArray * entries, CloudStatus status) {
+        // listings feed the search index themselves
+        if (status != StatusOK) {
+            result (status);
+        } else if (entries.count < kSearchIndexPageSize) {
+            result (StatusOK);
+        } else {
+            [self indexFolder:folderCloudItem offset:offset + (int)entries.count operation:operation result:result];
+        }
+    }]];
+}
+
+- (CloudOperation*) buildSearchIndex:(CloudItem*)folderCloudItem result:(ResultBlock)result {
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    [self indexFolder:folderCloudItem offset:0 operation:operation result:result];
+    return operation;
+}
+
+- (CloudOperation*) fileInfo:(CloudItem *)cloudFile result:(FileInfoBlock)result  {
     if (cloudFile.isDirectory == YES || cloudFile.identifier == nil) {
         result (nil, CloudErrorBadParameter);
-        return;
+        return nil;
     }
     NSMutableURLRequest *request = [self requestWithMethod:@"GET" endpoint:[self.verbFileInfo stringByAppendingString:cloudFile.identifier]];
-    [self sendRequest:request info:@"fileInfo" completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    [self sendRequest:request info:@"fileInfo" operation:operation completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
         if (error == nil) {
             NSObject * jsonObject = [NSJSONSerialization JSONObjectWithData:data options:NSJSONReadingMutableContainers error:&error];
             if (error != nil || [jsonObject isKindOfClass:[NSMutableDictionary class]] == NO) {
-                result (nil, CloudErrorResponseMalformed);
+                [self deliver:^{ result (nil, CloudErrorResponseMalformed); } operation:operation];
             } else {
                 NSMutableDictionary * dictionary = (NSMutableDictionary*)jsonObject;
                 [CloudUtil dumpAsJSON:dictionary withMessage:@"got file info"];
-                NSDate * date = [self.dateFormatter dateFromString:dictionary[@"creationDate"]];
-                dictionary[@"creationDate"] = [NSNumber numberWithDouble:[date timeIntervalSince1970]];
-                [cloudFile setExtraInfo:dictionary];
-                result (cloudFile, StatusOK);
+                [self deliver:^{
+                    // cloudFile is probably shared with the UI, so it is only updated on the callback queue
+                    [cloudFile setExtraInfo:dictionary];
+                    result (cloudFile, StatusOK);
+                } operation:operation];
             }
         } else {
             CloudStatus status = [CloudUtil statusFromConnection:response data:data];
             if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to open teh session et relauch the request
                 NSLog (@"fileInfo: session expired, retrying");
-                [self reopenSession:^(CloudStatus status) { [self fileInfo:cloudFile result:result]; }];
+                [self reopenSession:^(CloudStatus status){ [operation attach:[self fileInfo:cloudFile result:result]]; }];
             } else {
-                result (nil, status);
+                [self deliver:^{ result (nil, status); } operation:operation];
             }
         }
     }];
+    return operation;
 }
 
-- (void) getThumbnail:(CloudItem *)cloudFile result:(DataBlock)result  {
-    if (cloudFile.thumbnailURL == nil) {
-        result (nil, CloudErrorBadParameter);
-        return;
+static NSString * const kContentVariant = @"content";
+static NSString * const kPreviewVariant = @"preview";
+static NSString * const kThumbnailVariant = @"thumbnail";
+
+/** the key of a content in the content store. Size and creation date are part of it, so a new version of the file gets a new key.
+ * nil when the version is unknown, for an item known only by its identity: its content is neither looked up nor stored
+ */
+- (NSString*) contentKeyForItem:(CloudItem*)cloudFile variant:(NSString*)variant {
+    if (cloudFile.identifier == nil || cloudFile.creationDate == nil) {
+        return nil;
     }
-    
-    NSMutableURLRequest *request = [self requestWithMethod:@"GET" endpoint:cloudFile.thumbnailURL];
-    [self sendRequest:request info:@"getThumbnail" completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
-        if (error == nil) {
-            result (data, StatusOK);
-        } else {
-            CloudStatus status = [CloudUtil statusFromConnection:response data:data];
-            if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to open teh session et relauch the request
-                NSLog (@"getThumbnail: session expired, retrying");
-                [self reopenSession:^(CloudStatus status){ [self getThumbnail:cloudFile result:result]; }];
+    return [NSString stringWithFormat:@"%@/%d/%.0f/%@", cloudFile.identifier, cloudFile.size, [cloudFile.creationDate timeIntervalSince1970], variant];
+}
+
+/** get some data from the content store if available, otherwise download it from the url and store it.
+ * @param keys the content store keys to look up, in order of preference. The downloaded data is stored under the first one
+ * @param retry called to send the request again once the session has been reopened
+ */
+- (CloudOperation*) getData:(NSString*)url keys:(NSArray*)keys info:(NSString*)info result:(DataBlock)result retry:(CloudOperation* (^)(void))retry {
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    id<CloudContentStore> contentStore = self.contentStore;
+    [self.processingQueue addOperationWithBlock:^{
+        for (NSString * key in keys) {
+            NSData * data = [contentStore dataForKey:key];
+            if (data != nil) {
+                [self deliver:^{ result (data, StatusOK); } operation:operation];
+                return;
+            }
+        }
+        if (operation.isCancelled) {
+            return;
+        }
+        NSMutableURLRequest *request = [self requestWithMethod:@"GET" endpoint:url];
+        [self sendRequest:request info:info operation:operation completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+            if (error == nil) {
+                if (keys.count > 0) {
+                    [contentStore storeData:data forKey:keys[0]];
+                }
+                [self deliver:^{ result (data, StatusOK); } operation:operation];
             } else {
-                result (nil, status);
+                CloudStatus status = [CloudUtil statusFromConnection:response data:data];
+                if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to open teh session et relauch the request
+                    NSLog (@"%@: session expired, retrying", info);
+                    [self reopenSession:^(CloudStatus status){ [operation attach:retry ()]; }];
+                } else {
+                    [self deliver:^{ result (nil, status); } operation:operation];
+                }
             }
+        }];
+    }];
+    return operation;
+}
+
+- (CloudOperation*) getThumbnail:(CloudItem *)cloudFile result:(DataBlock)result  {
+    if (cloudFile.thumbnailURL == nil) {
+        result (nil, CloudErrorBadParameter);
+        return nil;
+    }
+    NSString * key = [self contentKeyForItem:cloudFile variant:kThumbnailVariant];
+    NSArray * keys = key == nil ? @[] : @[key];
+    // thumbnails are decoded again each time a cell shows them: their bytes are kept in memory, ahead of the content store
+    CloudMemoryCache * cache = self.thumbnailDataCache;
+    NSData * data = key == nil ? nil : [cache objectForKey:key];
+    if (data != nil) {
+        CloudOperation * operation = [[CloudOperation alloc] init];
+        [self deliver:^{ result (data, StatusOK); } operation:operation];
+        return operation;
+    }
+    DataBlock cachingResult = ^(NSData * data, CloudStatus status) {
+        if (status == StatusOK && key != nil) {
+            [cache setObject:data forKey:key cost:data.length];
         }
+        result (data, status);
+    };
+    return [self getData:cloudFile.thumbnailURL keys:keys info:@"getThumbnail" result:cachingResult retry:^{
+        return [self getThumbnail:cloudFile result:result];
     }];
 }
 
-- (void) getPreview:(CloudItem *)cloudFile result:(DataBlock)result {
+- (UIImage*) thumbnailForItem:(CloudItem*)cloudFile {
+    NSString * key = [self contentKeyForItem:cloudFile variant:kThumbnailVariant];
+    return key == nil ? nil : [self.thumbnailCache objectForKey:key];
+}
+
+- (void) setThumbnail:(UIImage*)thumbnail forItem:(CloudItem*)cloudFile {
+    NSString * key = [self contentKeyForItem:cloudFile variant:kThumbnailVariant];
+    if (key == nil) {
+        return;
+    } else if (thumbnail == nil) {
+        [self.thumbnailCache removeObjectForKey:key];
+    } else {
+        CGImageRef image = thumbnail.CGImage;
+        [self.thumbnailCache setObject:thumbnail forKey:key cost:CGImageGetBytesPerRow(image) * CGImageGetHeight(image)];
+    }
+}
+
+- (CloudOperation*) getPreview:(CloudItem *)cloudFile result:(DataBlock)result {
     if (cloudFile.previewURL == nil) {
         result (nil, CloudErrorBadParameter);
-        return;
+        return nil;
     }
-    
-    NSMutableURLRequest *request = [self requestWithMethod:@"GET" endpoint:cloudFile.previewURL];
-    [self sendRequest:request info:@"getPreview" completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
-        if (error == nil) {
-            result (data, StatusOK);
-        } else {
-            CloudStatus status = [CloudUtil statusFromConnection:response data:data];
-            if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to open teh session et relauch the request
-                NSLog (@"getPreview: session expired, retrying");
-                [self reopenSession:^(CloudStatus status){ [self getPreview:cloudFile result:result]; }];
-            } else {
-                result (nil, status);
-            }
-        }
+    // a full content already downloaded is better than a preview
+    NSString * key = [self contentKeyForItem:cloudFile variant:kPreviewVariant];
+    NSArray * keys = key == nil ? @[] : @[key, [self contentKeyForItem:cloudFile variant:kContentVariant]];
+    return [self getData:cloudFile.previewURL keys:keys info:@"getPreview" result:result retry:^{
+        return [self getPreview:cloudFile result:result];
     }];
 }
 
-- (void) getFileContent:(CloudItem *)cloudFile result:(DataBlock)result  {
+- (CloudOperation*) getFileContent:(CloudItem *)cloudFile result:(DataBlock)result  {
     if (cloudFile.downloadURL == nil) {
         result (nil, CloudErrorBadParameter);
-        return;
+        return nil;
     }
-    NSMutableURLRequest *request = [self requestWithMethod:@"GET" endpoint:cloudFile.downloadURL];
-    [self sendRequest:request info:@"getFileContent" completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+    NSString * key = [self contentKeyForItem:cloudFile variant:kContentVariant];
+    return [self getData:cloudFile.downloadURL keys:key == nil ? @[] : @[key] info:@"getFileContent" result:result retry:^{
+        return [self getFileContent:cloudFile result:result];
+    }];
+}
+
+- (CloudOperation*) getFileContent:(CloudItem *)cloudFile offset:(long long)offset length:(long long)length result:(RangeBlock)result {
+    if (cloudFile.downloadURL == nil) {
+        result (nil, 0, 0, CloudErrorBadParameter);
+        return nil;
+    }
+    return [self getContentOfURL:cloudFile.downloadURL offset:offset length:length result:result];
+}
+
+- (CloudOperation*) getContentOfURL:(NSString*)url offset:(long long)offset length:(long long)length result:(RangeBlock)result {
+    NSMutableURLRequest * request = [self requestWithMethod:@"GET" endpoint:url];
+    [request setValue:@"identity" forHTTPHeaderField:@"Accept-Encoding"]; // the range must apply to the content itself
+    if (length > 0) {
+        [request setValue:[NSString stringWithFormat:@"bytes=%lld-%lld", offset, offset + length - 1] forHTTPHeaderField:@"Range"];
+    } else {
+        [request setValue:[NSString stringWithFormat:@"bytes=%lld-", offset] forHTTPHeaderField:@"Range"];
+    }
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    [self sendRequest:request info:@"getContentRange" operation:operation completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
         if (error == nil) {
-            result (data, StatusOK);
+            NSHTTPURLResponse * httpResponse = (NSHTTPURLResponse*)response;
+            long long start = 0;
+            long long totalLength = data.length;
+            if (httpResponse.statusCode == 206) { // Content-Range: bytes 0-1023/4096
+                NSScanner * scanner = [NSScanner scannerWithString:httpResponse.allHeaderFields[@"Content-Range"] ?: @""];
+                long long end;
+                if ([scanner scanString:@"bytes" intoString:nil] == NO || [scanner scanLongLong:&start] == NO || [scanner scanString:@"-" intoString:nil] == NO ||
+                    [scanner scanLongLong:&end] == NO || [scanner scanString:@"/" intoString:nil] == NO || [scanner scanLongLong:&totalLength] == NO) {
+                    [self deliver:^{ result (nil, 0, 0, CloudErrorResponseMalformed); } operation:operation];
+                    return;
+                }
+            }
+            [self deliver:^{ result (data, start, totalLength, StatusOK); } operation:operation];
         } else {
             CloudStatus status = [CloudUtil statusFromConnection:response data:data];
-            if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to open teh session et relauch the request
-                NSLog (@"getFileContent: session expired, retrying");
-                [self reopenSession:^(CloudStatus status){ [self getFileContent:cloudFile result:result]; }];
+            if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to open the session et relauch the request
+                NSLog (@"getContentRange: session expired, retrying");
+                [self reopenSession:^(CloudStatus status){ [operation attach:[self getContentOfURL:url offset:offset length:length result:result]]; }];
             } else {
-                result (nil, status);
+                [self deliver:^{ result (nil, 0, 0, status); } operation:operation];
             }
         }
     }];
+    return operation;
 }
 
-- (void) createFolder:(NSString*)folderName parent:(CloudItem*)parentCloudItem result:(FileInfoBlock)result {
+- (CloudOperation*) createFolder:(NSString*)folderName parent:(CloudItem*)parentCloudItem result:(FileInfoBlock)result {
     NSMutableURLRequest *request = [self requestWithMethod:@"POST" endpoint:self.verbCreateFolder];
     NSString * bodyString;
     if (parentCloudItem == nil) {
@@ -615,118 +903,193 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
         bodyString = [NSString stringWithFormat:@"{ \"name\":\"%@\", \"parentFolderId\":\"%@\" }", folderName, parentCloudItem.identifier];
     }
     [self addJSON:bodyString toRequest:request];
-    [self sendRequest:request info:@"createFolder" completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    [self sendRequest:request info:@"createFolder" operation:operation completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
         if (error == nil) {
             NSObject * jsonObject = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
             if (error != nil || [jsonObject isKindOfClass:[NSDictionary class]] == NO) {
-                result (nil, CloudErrorResponseMalformed);
+                [self deliver:^{ result (nil, CloudErrorResponseMalformed); } operation:operation];
             } else {
                 NSDictionary * dictionary = (NSDictionary*)jsonObject;
                 CloudItem * folder = [[CloudItem alloc] initWithDictionary:dictionary];
-                result (folder, StatusOK);
+                [self.searchIndex addItems:@[folder] parent:parentCloudItem];
+                [self deliver:^{ result (folder, StatusOK); } operation:operation];
             }
         } else {
             CloudStatus status = [CloudUtil statusFromConnection:response data:data];
             if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to open the session et relauch the request
                 NSLog (@"createFolder: session expired, retrying");
-                [self reopenSession:^(CloudStatus status){ [self createFolder:folderName parent:parentCloudItem result:result]; }];
+                [self reopenSession:^(CloudStatus status){ [operation attach:[self createFolder:folderName parent:parentCloudItem result:result]]; }];
             } else {
-                result (nil, status);
+                [self deliver:^{ result (nil, status); } operation:operation];
             }
         }
     }];
+    return operation;
 }
 
-- (void) getFreeSpace:(FreeSpaceBlock)result {
+- (CloudOperation*) getFreeSpace:(FreeSpaceBlock)result {
     NSMutableURLRequest *request = [self requestWithMethod:@"GET" endpoint:self.verbFreespace];
-    [self sendRequest:request info:@"freespace" completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    [self sendRequest:request info:@"freespace" operation:operation completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
         if (error == nil) {
             NSObject * jsonObject = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
             if (error != nil) {
-                result (-1, CloudErrorResponseMalformed);
+                [self deliver:^{ result (-1, CloudErrorResponseMalformed); } operation:operation];
             } else {
                 NSDictionary * dictionary = (NSDictionary*)jsonObject;
                 NSNumber * number = dictionary[@"freespace"];
                 long size =  [number integerValue];
-                result (size, StatusOK);
+                [self deliver:^{ result (size, StatusOK); } operation:operation];
             }
         } else {
-            result (-1, [CloudUtil statusFromConnection:response data:data]);
+            CloudStatus status = [CloudUtil statusFromConnection:response data:data];
+            [self deliver:^{ result (-1, status); } operation:operation];
         }
     }];
+    return operation;
 }
 
-- (void) uploadData:(NSData*)data filename:(NSString*)filename folderID:(NSString*)folderID progress:(ProgressBlock)progress result:(FileInfoBlock)result {
-    NSMutableURLRequest * request = [self postRequestWithEndpoint:self.verbUpload filename:filename data:data folder:folderID];
-    NSDate * startingDate = [NSDate date];
+- (CloudOperation*) uploadData:(NSData*)data filename:(NSString*)filename folderID:(NSString*)folderID progress:(ProgressBlock)progress result:(FileInfoBlock)result {
+    // refuse before sending what the server would refuse after receiving it. While the free space is fetched, the server decides
+    long long size = data.length;
+    CloudQuotaAdmission admission = [self.quotaTracker admitUploadOfSize:size];
+    if (admission == CloudQuotaNoSpaceLeft || admission == CloudQuotaFileTooBig) {
+        CloudStatus status = admission == CloudQuotaNoSpaceLeft ? CloudErrorNoSpaceLeft : CloudErrorFileTooBig;
+        [self deliver:^{ result (nil, status); } operation:nil];
+        return nil;
+    }
+    // the reservation ends once, with the response or with a cancellation, after which the response is never reported
+    __block BOOL reserved = admission == CloudQuotaAdmitted;
+    void (^endReservation)(CloudStatus) = ^(CloudStatus status) {
+        BOOL release;
+        @synchronized(self.quotaTracker) {
+            release = reserved;
+            reserved = NO;
+        }
+        if (release) {
+            [self.quotaTracker endUploadOfSize:size status:status];
+        }
+    };
+    NSData * content = [data copy]; // a mutable data could change before the body is built, and the completion handler parameter hides it
     float contentSize = data.length / 1024.0;
-    [self sendRequest:request info:@"uploadData" progressHandler:progress completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
-        if (error == nil) {
-            if (TRACE_BANDWIDTH_USAGE) {
-                NSTimeInterval downloadTime = -[startingDate timeIntervalSinceNow];
-                NSLog (@"***** Download of %g kB in %g s => %g kB/s", contentSize, downloadTime, floor(contentSize/downloadTime));
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    [operation setCancellationHandler:^{
+        endReservation (CloudErrorCancelled);
+    }];
+    // the multipart body is a copy of the content, and compressing it takes time: both are done off the calling thread
+    [self.processingQueue addOperationWithBlock:^{
+        if (operation.isCancelled) {
+            return;
+        }
+        NSMutableURLRequest * request = [self postRequestWithFilename:filename data:content folder:folderID];
+        BOOL compressed = NO;
+        long long plainLength = request.HTTPBody.length;
+        if (self.compressUploads && [CloudCompression isCompressibleData:content]) {
+            NSDate * start = [NSDate date];
+            NSData * body = [CloudCompression gzipData:request.HTTPBody];
+            [self.trafficStats addCodingTime:-[start timeIntervalSinceNow]];
+            if (body != nil && body.length < request.HTTPBody.length) {
+                [request setHTTPBody:body]; // the uncompressed body is released here
+                [request setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+                compressed = YES;
             }
-            NSObject * jsonObject = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
-            if (error != nil || [jsonObject isKindOfClass:[NSDictionary class]] == NO) {
-                result (nil, CloudErrorResponseMalformed);
+        }
+        long long wireLength = request.HTTPBody.length;
+        NSDate * startingDate = [NSDate date];
+        [self sendRequest:request info:@"uploadData" progressHandler:progress operation:operation completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+            if (error == nil) {
+                if (TRACE_BANDWIDTH_USAGE) {
+                    NSTimeInterval downloadTime = -[startingDate timeIntervalSinceNow];
+                    NSLog (@"***** Download of %g kB in %g s => %g kB/s", contentSize, downloadTime, floor(contentSize/downloadTime));
+                }
+                endReservation (StatusOK); // the server accepted the content, whatever the response says
+                if (compressed) { // sent bytes of encoded bodies are counted here, the connection only knows the encoded size
+                    [self.trafficStats addSentBytes:plainLength wireBytes:wireLength];
+                }
+                NSObject * jsonObject = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
+                if (error != nil || [jsonObject isKindOfClass:[NSDictionary class]] == NO) {
+                    [self deliver:^{ result (nil, CloudErrorResponseMalformed); } operation:operation];
+                } else {
+                    NSDictionary * dictionary = (NSDictionary*)jsonObject;
+                    CloudItem * file = [[CloudItem alloc] initWithIdentifier:dictionary[@"fileId"] name:dictionary[@"fileName"] type:CloudTypeFile parentIdentifier:folderID];
+                    [self.searchIndex addItems:@[file] parent:nil];
+                    [self deliver:^{ result (file, StatusOK); } operation:operation];
+                }
             } else {
-                NSDictionary * dictionary = (NSDictionary*)jsonObject;
-                CloudItem * file = [[CloudItem alloc] init];
-                file.identifier = dictionary[@"fileId"];
-                file.name = dictionary[@"fileName"];
-                file.type = CloudTypeFile;
-                result (file, StatusOK);
+                CloudStatus status = [CloudUtil statusFromConnection:response data:data];
+                endReservation (status);
+                if (compressed && [(NSHTTPURLResponse*)response statusCode] == 415) { // unsupported media type: the server does not decode request bodies
+                    NSLog (@"uploadData: encoded body refused, sending it again as is");
+                    self.compressUploads = NO;
+                    [operation attach:[self uploadData:content filename:filename folderID:folderID progress:progress result:result]];
+                    return;
+                }
+                [self deliver:^{ result (nil, status); } operation:operation];
             }
-        } else {
-            result (nil, [CloudUtil statusFromConnection:response data:data]);
-        }
+        }];
     }];
+    return operation;
 }
 
-- (void) deleteFolder:(CloudItem*)folderCloudItem result:(ResultBlock)result {
+- (CloudOperation*) deleteFolder:(CloudItem*)folderCloudItem result:(ResultBlock)result {
     NSMutableURLRequest *request = [self requestWithMethod:@"DELETE" endpoint:[self.verbDeleteFolder stringByAppendingString:folderCloudItem.identifier]];
-    [self sendRequest:request info:@"deleteFolder" completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    [self sendRequest:request info:@"deleteFolder" operation:operation completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
         if (error == nil) {
             if (error != nil) {
-                result (CloudErrorResponseMalformed);
+                [self deliver:^{ result (CloudErrorResponseMalformed); } operation:operation];
             } else {
-                result (StatusOK);
+                [self.searchIndex removeItem:folderCloudItem];
+                [self.quotaTracker creditDeletedSize:0]; // the size of the content is unknown
+                [self deliver:^{ result (StatusOK); } operation:operation];
             }
         } else {
             CloudStatus status = [CloudUtil statusFromConnection:response data:data];
             if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to open teh session et relauch the request
                 NSLog (@"deleteFolder: session expired, retrying");
-                [self reopenSession:^(CloudStatus status){ [self deleteFolder:folderCloudItem result:result]; }];
+                [self reopenSession:^(CloudStatus status){ [operation attach:[self deleteFolder:folderCloudItem result:result]]; }];
             } else {
-                result (status);
+                [self deliver:^{ result (status); } operation:operation];
             }
         }
     }];
+    return operation;
 }
 
-- (void) deleteFile:(CloudItem*)fileCloudItem result:(ResultBlock)result {
+- (CloudOperation*) deleteFile:(CloudItem*)fileCloudItem result:(ResultBlock)result {
     if (fileCloudItem.identifier == nil) {
         result (CloudErrorNotAFile);
-        return;
+        return nil;
     }
     NSMutableURLRequest *request = [self requestWithMethod:@"DELETE" endpoint:[self.verbDeleteFile stringByAppendingString:fileCloudItem.identifier]];
-    [self sendRequest:request info:@"deleteFile" completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    [self sendRequest:request info:@"deleteFile" operation:operation completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
         if (error == nil) {
             if (error != nil) {
-                result (CloudErrorResponseMalformed);
+                [self deliver:^{ result (CloudErrorResponseMalformed); } operation:operation];
             } else {
-                result (StatusOK);
+                for (NSString * variant in @[kContentVariant, kPreviewVariant, kThumbnailVariant]) {
+                    NSString * key = [self contentKeyForItem:fileCloudItem variant:variant];
+                    if (key != nil) {
+                        [self.contentStore removeDataForKey:key];
+                    }
+                }
+                [self.searchIndex removeItem:fileCloudItem];
+                [self.quotaTracker creditDeletedSize:fileCloudItem.extraInfoAvailable ? fileCloudItem.size : 0];
+                [self deliver:^{ result (StatusOK); } operation:operation];
             }
         } else {
             CloudStatus status = [CloudUtil statusFromConnection:response data:data];
             if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to open teh session et relauch the request
                 NSLog (@"deleteFile: session expired, retrying");
-                [self reopenSession:^(CloudStatus status){ [self deleteFile:fileCloudItem result:result]; }];
+                [self reopenSession:^(CloudStatus status){ [operation attach:[self deleteFile:fileCloudItem result:result]]; }];
             } else {
-                result (status);
+                [self deliver:^{ result (status); } operation:operation];
             }
         }
     }];
+    return operation;
 }
 
 - (NSMutableURLRequest*) makeMoveRequest:(CloudItem * _Nonnull)item {
@@ -736,45 +1099,69 @@ typedef void (^RequestCallback)(NSURLResponse *response, NSData * data, NSError
     return request;
 }
 
-- (void) renameAux:(NSMutableURLRequest *)request bodyString:(NSString*) bodyString item:(CloudItem*)item result:(FileInfoBlock _Nonnull)result info:(NSString*)info {
+/** send a move request.
+ * @param destination the new parent folder, nil when the item stays in its folder.
+ * @param clone YES if the request copies the item, which is then kept in the search index.
+ */
+- (CloudOperation*) renameAux:(NSMutableURLRequest *)request bodyString:(NSString*) bodyString item:(CloudItem*)item destination:(CloudItem*)destination clone:(BOOL)clone result:(FileInfoBlock _Nonnull)result info:(NSString*)info {
     [self addJSON:bodyString toRequest:request];
-    [self sendRequest:request info:info completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
+    CloudOperation * operation = [[CloudOperation alloc] init];
+    [self sendRequest:request info:info operation:operation completionHandler:^(NSURLResponse *response, NSData *data, NSError *error) {
         if (error == nil) {
             NSObject * jsonObject = [NSJSONSerialization JSONObjectWithData:data options:0 error:&error];
             if (error != nil || [jsonObject isKindOfClass:[NSDictionary class]] == NO) {
-                result (nil, CloudErrorResponseMalformed);
+                [self deliver:^{ result (nil, CloudErrorResponseMalformed); } operation:operation];
             } else {
                 NSDictionary * dictionary = (NSDictionary*)jsonObject;
                 CloudItem * folder = [[CloudItem alloc] initWithDictionary:dictionary];
                 folder.type = item.type;
-                result (folder, StatusOK);
+                if (clone == NO && [folder.identifier isEqualToString:item.identifier] == NO) {
+                    [self.searchIndex removeItem:item];
+                }
+                [self.searchIndex addItems:@[folder] parent:destination];
+                [self deliver:^{ result (folder, StatusOK); } operation:operation];
             }
         } else {
             CloudStatus status = [CloudUtil statusFromConnection:response data:data];
             if (status == CloudErrorSessionExpired || status == ExpiredCredentials) { // try to open the session et relauch the request
                 NSLog (@"createFolder: session expired, retrying");
-                [self reopenSession:^(CloudStatus status){ [self renameAux:request bodyString:bodyString item:item result:result info:info]; }];
+                [self reopenSession:^(CloudStatus status){ [operation attach:[self renameAux:request bodyString:bodyString item:item destination:destination clone:clone result:result info:info]]; }];
             } else {
-                result (nil, status);
+                [self deliver:^{ result (nil, status); } operation:operation];
             }
         }
     }];
+    return operation;
 }
 
 
-- (void) rename :(CloudItem * _Nonnull)item newName:(NSString * _Nonnull)newName result:(FileInfoBlock _Nonnull)result {
+- (CloudOperation*) rename :(CloudItem * _Nonnull)item newName:(NSString * _Nonnull)newName result:(FileInfoBlock _Nonnull)result {
     NSString * bodyString = [NSString stringWithFormat:@"{ \"name\":\"%@\" }", newName];
-    [self renameAux:[self makeMoveRequest:item] bodyString:bodyString item:item result:result info:@"rename"];
+    return [self renameAux:[self makeMoveRequest:item] bodyString:bodyString item:item destination:nil clone:NO result:result info:@"rename"];
 }
 
-- (void) move :(CloudItem * _Nonnull)item destination:(CloudItem * _Nonnull)destination result:(FileInfoBlock _Nonnull)result {
+- (CloudOperation*) move :(CloudItem * _Nonnull)item destination:(CloudItem * _Nonnull)destination result:(FileInfoBlock _Nonnull)result {
     NSString * bodyString = [NSString stringWithFormat:@"{ \"parentFolderId\":\"%@\" }", destination.identifier];
-    [self renameAux:[self makeMoveRequest:item] bodyString:bodyString item:item result:result info:@"move"];
+    return [self renameAux:[self makeMoveRequest:item] bodyString:bodyString item:item destination:destination clone:NO result:result info:@"move"];
+}
+
+- (CloudOperation*) update:(CloudItem *)item name:(NSString *)name parentIdentifier:(NSString *)parentIdentifier result:(FileInfoBlock)result {
+    NSMutableDictionary * body = [[NSMutableDictionary alloc] init];
+    if (name != nil) {
+        body[@"name"] = name;
+    }
+    if (parentIdentifier != nil) {
+        body[@"parentFolderId"] = parentIdentifier;
+    }
+    NSData * data = [NSJSONSerialization dataWithJSONObject:body options:0 error:nil];
+    NSString * bodyString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+    CloudItem * destination = parentIdentifier == nil ? nil : [[CloudItem alloc] initWithIdentifier:parentIdentifier name:@"" type:CloudTypeDirectory parentIdentifier:nil];
+    return [self renameAux:[self makeMoveRequest:item] bodyString:bodyString item:item destination:destination clone:NO result:result info:@"update"];
 }
 
-- (void) copy :(CloudItem * _Nonnull)item destination:(CloudItem * _Nonnull)destination result:(FileInfoBlock _Nonnull)result {
+- (CloudOperation*) copy :(CloudItem * _Nonnull)item destination:(CloudItem * _Nonnull)destination result:(FileInfoBlock _Nonnull)result {
     NSString * bodyString = [NSString stringWithFormat:@"{ \"parentFolderId\":\"%@\", \"clone\" : true }", destination.identifier];
-    [self renameAux:[self makeMoveRequest:item] bodyString:bodyString item:item result:result info:@"copy"];
+    return [self renameAux:[self makeMoveRequest:item] bodyString:bodyString item:item destination:destination clone:YES result:result info:@"copy"];
 }
 
 @end
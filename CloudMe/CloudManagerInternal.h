@@ -0,0 +1,52 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudManager.h"
+
+/** CloudManager methods shared with the other classes of the SDK. They are not part of the public API. */
+@interface CloudManager (Internal)
+
+/** a request on the cloud server (or on an absolute URL) carrying the current token */
+- (NSMutableURLRequest *) requestWithMethod:(NSString *)method endpoint:(NSString *)endpoint;
+
+/** an upload request without body. The body is made of the multipart header, the file content and the multipart footer */
+- (NSMutableURLRequest *) uploadRequest;
+
+- (NSData *) multipartHeaderWithFilename:(NSString *)filename size:(long long)size folder:(NSString *)folderID;
+
+- (NSData *) multipartFooter;
+
+/** rename and move an item with a single request.
+ * @param name the new name, nil to keep it.
+ * @param parentIdentifier the new folder, nil to keep it.
+ */
+- (CloudOperation *) update:(CloudItem *)item name:(NSString *)name parentIdentifier:(NSString *)parentIdentifier result:(FileInfoBlock)result;
+
+/** get a part of the content at an absolute URL with a range request. See getFileContent:offset:length:result: */
+- (CloudOperation *) getContentOfURL:(NSString *)url offset:(long long)offset length:(long long)length result:(RangeBlock)result;
+
+/** the name of a file or directory holding state of this manager, suffixed with the account if any so that accounts never share state */
+- (NSString *) storageName:(NSString *)name;
+
+/** open a new session with the current token, after the server reported the session as expired. The pending transfers and
+ * changes are resumed once it is open */
+- (void) reopenSession:(ResultBlock)result;
+
+/** call a user block on the callback queue, unless the operation (if any) has been cancelled in the meantime */
+- (void) deliver:(void (^)(void))block operation:(CloudOperation *)operation;
+
+@end
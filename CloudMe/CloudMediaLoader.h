@@ -0,0 +1,87 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+#import <AVFoundation/AVFoundation.h>
+#import "CloudManager.h"
+
+/** A sparse on-disk cache of a remote content: a file of the size of the content, in which only the segments already downloaded
+ * have been written, and a list of these segments kept next to it.
+ * @note methods can be called from any thread
+ */
+@interface CloudSegmentCache : NSObject
+
+/** open the cache stored at the given file URL, or create it. Segments stored with a different segment size are discarded */
+- (nonnull id) initWithURL:(NSURL * _Nonnull)url segmentSize:(NSUInteger)segmentSize;
+
+@property (nonatomic, readonly, nonnull) NSURL * url;
+@property (nonatomic, readonly) NSUInteger segmentSize;
+
+/** the size of the whole content, -1 until known */
+@property (nonatomic) long long totalLength;
+
+/** the number of segments of the content, 0 until the total length is known */
+@property (nonatomic, readonly) NSUInteger segmentCount;
+
+- (BOOL) hasSegment:(NSUInteger)segment;
+
+/** read bytes from the cache. The range must be within cached segments */
+- (NSData * _Nullable) dataAtOffset:(long long)offset length:(NSUInteger)length;
+
+/** write downloaded bytes. The segments fully covered by the data are recorded, as well as the last segment if the data reaches the end of the content */
+- (void) storeData:(NSData * _Nonnull)data atOffset:(long long)offset;
+
+/** remove the cached segments and the files */
+- (void) removeAllData;
+
+@end
+
+
+/** This class streams the content of a cloud audio or video file to AVFoundation: it answers the byte range requests of the player with
+ * HTTP range requests on the download URL, so that playback starts after the first round trip instead of after a full download.
+ * The downloaded segments are kept in a CloudSegmentCache, so that seeking back or playing again does not download them again,
+ * and the segments following the playback position are read ahead, as far as the measured bandwidth allows.
+ * @note the loader must be kept alive as long as its asset is played: the resource loader does not retain its delegate.
+ */
+@interface CloudMediaLoader : NSObject <AVAssetResourceLoaderDelegate>
+
+/** create a loader for a cloud file, with a cache in the caches directory */
+- (nonnull id) initWithManager:(CloudManager * _Nonnull)manager item:(CloudItem * _Nonnull)cloudItem;
+
+/** create a loader for an absolute URL, requested with the session token.
+ * @param filename the name of the content, whose extension gives the media type.
+ * @param cacheURL the file of the segment cache.
+ */
+- (nonnull id) initWithManager:(CloudManager * _Nonnull)manager URL:(NSString * _Nonnull)url filename:(NSString * _Nonnull)filename cacheURL:(NSURL * _Nonnull)cacheURL;
+
+/** the asset to play with an AVPlayer, whose content is provided by the loader */
+@property (nonatomic, readonly, nonnull) AVURLAsset * asset;
+
+@property (nonatomic, readonly, nonnull) CloudSegmentCache * cache;
+
+/** the number of range requests sent so far */
+@property (nonatomic, readonly) NSUInteger requestCount;
+
+/** read a part of the content through the cache, as the player does.
+ * @param result called on the manager callback queue, with offset as the position of the data.
+ */
+- (void) readDataAtOffset:(long long)offset length:(NSUInteger)length result:(RangeBlock _Nonnull)result;
+
+/** cancel the pending requests. The loader cannot be used afterwards */
+- (void) invalidate;
+
+@end
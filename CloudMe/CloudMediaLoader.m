@@ -0,0 +1,437 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudMediaLoader.h"
+#import "CloudManagerInternal.h"
+#import <MobileCoreServices/MobileCoreServices.h>
+#import <CommonCrypto/CommonDigest.h>
+
+static NSString * const kMediaScheme = @"cloudmedia";
+
+static const NSUInteger kSegmentSize = 256 * 1024;
+
+// range requests sent ahead of the player at the same time, the requests of the player itself are never delayed
+static const NSUInteger kMaxReadAheadRequests = 2;
+
+// the content read ahead of the playback position: the content downloaded in that time, within bounds
+static const NSTimeInterval kReadAheadDuration = 20.0;
+static const long long kMinReadAhead = 1024 * 1024;
+static const long long kMaxReadAhead = 32 * 1024 * 1024;
+
+@interface CloudSegmentCache ()
+@property (nonatomic) NSURL * indexURL;
+@property (nonatomic) NSMutableIndexSet * segments;
+@property (nonatomic) NSFileHandle * fileHandle;
+@end
+
+@implementation CloudSegmentCache
+
+- (id) initWithURL:(NSURL*)url segmentSize:(NSUInteger)segmentSize {
+    self = [super init];
+    if (self != nil) {
+        _url = url;
+        _segmentSize = segmentSize;
+        _indexURL = [url URLByAppendingPathExtension:@"segments"];
+        _segments = [[NSMutableIndexSet alloc] init];
+        _totalLength = -1;
+        NSFileManager * fileManager = [NSFileManager defaultManager];
+        [fileManager createDirectoryAtURL:[url URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+        NSDictionary * index = [NSDictionary dictionaryWithContentsOfURL:self.indexURL];
+        if ([index[@"segmentSize"] unsignedIntegerValue] == segmentSize && [fileManager fileExistsAtPath:url.path]) {
+            _totalLength = [index[@"totalLength"] longLongValue];
+            for (NSArray * range in index[@"segments"]) {
+                [_segments addIndexesInRange:NSMakeRange([range[0] unsignedIntegerValue], [range[1] unsignedIntegerValue])];
+            }
+        } else {
+            [fileManager removeItemAtURL:url error:nil];
+            [fileManager removeItemAtURL:self.indexURL error:nil];
+        }
+    }
+    return self;
+}
+
+/** must be called with self locked */
+- (void) saveIndex {
+    NSMutableArray * ranges = [[NSMutableArray alloc] init];
+    [self.segments enumerateRangesUsingBlock:^(NSRange range, BOOL * stop) {
+        [ranges addObject:@[@(range.location), @(range.length)]];
+    }];
+    NSDictionary * index = @{ @"segmentSize" : @(self.segmentSize), @"totalLength" : @(_totalLength), @"segments" : ranges };
+    [index writeToURL:self.indexURL atomically:YES];
+}
+
+- (long long) totalLength {
+    @synchronized(self) {
+        return _totalLength;
+    }
+}
+
+- (void) setTotalLength:(long long)totalLength {
+    @synchronized(self) {
+        if (totalLength == _totalLength) {
+            return;
+        }
+        if (_totalLength >= 0) { // the content has changed: the cached segments are obsolete
+            [self.segments removeAllIndexes];
+        }
+        _totalLength = totalLength;
+        [self saveIndex];
+    }
+}
+
+- (NSUInteger) segmentCount {
+    long long totalLength = self.totalLength;
+    return totalLength < 0 ? 0 : (NSUInteger)((totalLength + self.segmentSize - 1) / self.segmentSize);
+}
+
+- (BOOL) hasSegment:(NSUInteger)segment {
+    @synchronized(self) {
+        return [self.segments containsIndex:segment];
+    }
+}
+
+/** the handle used for reading and writing the content file, created if needed. Must be called with self locked */
+- (NSFileHandle*) handle {
+    if (self.fileHandle == nil) {
+        if ([[NSFileManager defaultManager] fileExistsAtPath:self.url.path] == NO) {
+            [[NSFileManager defaultManager] createFileAtPath:self.url.path contents:nil attributes:nil];
+        }
+        self.fileHandle = [NSFileHandle fileHandleForUpdatingURL:self.url error:nil];
+    }
+    return self.fileHandle;
+}
+
+- (NSData*) dataAtOffset:(long long)offset length:(NSUInteger)length {
+    @synchronized(self) {
+        NSFileHandle * handle = [self handle];
+        @try {
+            [handle seekToFileOffset:offset];
+            NSData * data = [handle readDataOfLength:length];
+            return data.length == length ? data : nil;
+        } @catch (NSException * exception) {
+            return nil;
+        }
+    }
+}
+
+- (void) storeData:(NSData*)data atOffset:(long long)offset {
+    @synchronized(self) {
+        NSFileHandle * handle = [self handle];
+        @try {
+            [handle seekToFileOffset:offset];
+            [handle writeData:data];
+        } @catch (NSException * exception) { // no space left
+            return;
+        }
+        long long end = offset + data.length;
+        NSUInteger first = (NSUInteger)((offset + self.segmentSize - 1) / self.segmentSize);
+        NSUInteger last = (NSUInteger)(end / self.segmentSize);
+        if (_totalLength >= 0 && end >= _totalLength) { // the last segment is shorter
+            last = (NSUInteger)((_totalLength + self.segmentSize - 1) / self.segmentSize);
+        }
+        if (last > first) {
+            [self.segments addIndexesInRange:NSMakeRange(first, last - first)];
+            [self saveIndex];
+        }
+    }
+}
+
+- (void) removeAllData {
+    @synchronized(self) {
+        [self.fileHandle closeFile];
+        self.fileHandle = nil;
+        [self.segments removeAllIndexes];
+        _totalLength = -1;
+        [[NSFileManager defaultManager] removeItemAtURL:self.url error:nil];
+        [[NSFileManager defaultManager] removeItemAtURL:self.indexURL error:nil];
+    }
+}
+
+- (void) dealloc {
+    [_fileHandle closeFile];
+}
+
+@end
+
+
+/** a byte range asked by the player or by readDataAtOffset */
+@interface CloudMediaRead : NSObject
+@property (nonatomic) AVAssetResourceLoadingRequest * loadingRequest;
+@property (nonatomic, copy) RangeBlock result;
+@property (nonatomic) NSMutableData * data; // the bytes for the result block
+@property (nonatomic) BOOL needsData; // NO for a request of the content information only
+@property (nonatomic) long long offset;
+@property (nonatomic) long long length; // 0 until the end of the content
+@property (nonatomic) long long currentOffset; // the next byte to provide
+@end
+
+@implementation CloudMediaRead
+@end
+
+
+@interface CloudMediaLoader ()
+@property (nonatomic) CloudManager * manager;
+@property (nonatomic) NSString * url;
+@property (nonatomic) NSString * filename;
+@property (nonatomic) dispatch_queue_t queue; // all the state below is only used on this queue
+@property (nonatomic) NSMutableArray * reads;
+@property (nonatomic) NSMutableIndexSet * fetching; // segments being downloaded
+@property (nonatomic) NSMutableArray * operations;
+@property (nonatomic) long long playbackOffset; // the offset of the last request of the player, from which segments are read ahead
+@property (nonatomic) BOOL invalidated;
+@end
+
+@implementation CloudMediaLoader
+
+- (id) initWithManager:(CloudManager*)manager item:(CloudItem*)cloudItem {
+    NSURL * caches = [[[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask] firstObject];
+    // a new version of the file gets a new cache. When the creation date is unknown, the download URL stands for the version
+    NSString * version = cloudItem.creationDate != nil ? [NSString stringWithFormat:@"%.0f", [cloudItem.creationDate timeIntervalSince1970]] : [self.class digestOfString:cloudItem.downloadURL ?: @""];
+    NSString * name = [NSString stringWithFormat:@"%@-%d-%@", cloudItem.identifier, cloudItem.size, version];
+    name = [name stringByReplacingOccurrencesOfString:@"/" withString:@"_"];
+    NSURL * cacheURL = [[caches URLByAppendingPathComponent:[manager storageName:@"CloudMedia"]] URLByAppendingPathComponent:name];
+    return [self initWithManager:manager URL:cloudItem.downloadURL ?: @"" filename:cloudItem.name cacheURL:cacheURL];
+}
+
+/** a file name friendly hash of a string */
++ (NSString*) digestOfString:(NSString*)string {
+    NSData * data = [string dataUsingEncoding:NSUTF8StringEncoding];
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1(data.bytes, (CC_LONG)data.length, digest);
+    NSMutableString * hex = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
+    for (int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++) {
+        [hex appendFormat:@"%02x", digest[i]];
+    }
+    return hex;
+}
+
+- (id) initWithManager:(CloudManager*)manager URL:(NSString*)url filename:(NSString*)filename cacheURL:(NSURL*)cacheURL {
+    self = [super init];
+    if (self != nil) {
+        _manager = manager;
+        _url = url;
+        _filename = filename;
+        _cache = [[CloudSegmentCache alloc] initWithURL:cacheURL segmentSize:kSegmentSize];
+        _queue = dispatch_queue_create("CloudMediaLoader", DISPATCH_QUEUE_SERIAL);
+        _reads = [[NSMutableArray alloc] init];
+        _fetching = [[NSMutableIndexSet alloc] init];
+        _operations = [[NSMutableArray alloc] init];
+        // a custom scheme, so that AVFoundation asks the delegate for the content. The extension helps it guess the format
+        NSString * path = [filename.lastPathComponent stringByAddingPercentEncodingWithAllowedCharacters:[NSCharacterSet URLPathAllowedCharacterSet]];
+        _asset = [AVURLAsset URLAssetWithURL:[NSURL URLWithString:[NSString stringWithFormat:@"%@://content/%@", kMediaScheme, path]] options:nil];
+        [_asset.resourceLoader setDelegate:self queue:_queue];
+    }
+    return self;
+}
+
+- (void) readDataAtOffset:(long long)offset length:(NSUInteger)length result:(RangeBlock)result {
+    dispatch_async(self.queue, ^{
+        CloudMediaRead * read = [[CloudMediaRead alloc] init];
+        read.result = result;
+        read.data = [[NSMutableData alloc] init];
+        read.needsData = YES;
+        read.offset = offset;
+        read.length = length;
+        read.currentOffset = offset;
+        if (self.invalidated) {
+            [self finishRead:read status:CloudErrorCancelled];
+            return;
+        }
+        self.playbackOffset = offset;
+        [self.reads addObject:read];
+        [self process];
+    });
+}
+
+- (void) invalidate {
+    dispatch_async(self.queue, ^{
+        self.invalidated = YES;
+        for (CloudOperation * operation in self.operations) {
+            [operation cancel];
+        }
+        [self.operations removeAllObjects];
+        for (CloudMediaRead * read in self.reads) {
+            [self finishRead:read status:CloudErrorCancelled];
+        }
+        [self.reads removeAllObjects];
+    });
+}
+
+#pragma mark - AVAssetResourceLoaderDelegate
+
+- (BOOL) resourceLoader:(AVAssetResourceLoader*)resourceLoader shouldWaitForLoadingOfRequestedResource:(AVAssetResourceLoadingRequest*)loadingRequest {
+    if (self.invalidated || [loadingRequest.request.URL.scheme isEqualToString:kMediaScheme] == NO) {
+        return NO;
+    }
+    CloudMediaRead * read = [[CloudMediaRead alloc] init];
+    read.loadingRequest = loadingRequest;
+    AVAssetResourceLoadingDataRequest * dataRequest = loadingRequest.dataRequest;
+    if (dataRequest != nil) {
+        read.needsData = YES;
+        read.offset = dataRequest.requestedOffset;
+        read.currentOffset = dataRequest.currentOffset > 0 ? dataRequest.currentOffset : dataRequest.requestedOffset;
+        BOOL toEnd = [dataRequest respondsToSelector:@selector(requestsAllDataToEndOfResource)] && dataRequest.requestsAllDataToEndOfResource;
+        read.length = toEnd ? 0 : dataRequest.requestedLength;
+        self.playbackOffset = read.offset;
+    }
+    [self.reads addObject:read];
+    [self process];
+    return YES;
+}
+
+- (void) resourceLoader:(AVAssetResourceLoader*)resourceLoader didCancelLoadingRequest:(AVAssetResourceLoadingRequest*)loadingRequest {
+    for (CloudMediaRead * read in [self.reads copy]) {
+        if (read.loadingRequest == loadingRequest) {
+            [self.reads removeObject:read];
+        }
+    }
+}
+
+#pragma mark - reading
+
+/** answer the pending reads from the cache, download what they miss, and read ahead */
+- (void) process {
+    for (CloudMediaRead * read in [self.reads copy]) {
+        if ([self serveRead:read]) {
+            [self.reads removeObject:read];
+        }
+    }
+    [self readAhead];
+}
+
+/** provide the cached bytes of a read, and download the first missing segment. Return YES when the read is complete */
+- (BOOL) serveRead:(CloudMediaRead*)read {
+    long long totalLength = self.cache.totalLength;
+    if (totalLength < 0) { // the first response gives the length
+        [self fetchFromSegment:(NSUInteger)(read.currentOffset / kSegmentSize)];
+        return NO;
+    }
+    AVAssetResourceLoadingContentInformationRequest * information = read.loadingRequest.contentInformationRequest;
+    if (information != nil && information.contentLength == 0) {
+        CFStringRef type = UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (__bridge CFStringRef)self.filename.pathExtension, NULL);
+        information.contentType = CFBridgingRelease(type);
+        information.contentLength = totalLength;
+        information.byteRangeAccessSupported = YES;
+    }
+    if (read.needsData) {
+        long long end = read.length > 0 ? MIN(read.offset + read.length, totalLength) : totalLength;
+        while (read.currentOffset < end) {
+            NSUInteger segment = (NSUInteger)(read.currentOffset / kSegmentSize);
+            if ([self.cache hasSegment:segment] == NO) {
+                [self fetchFromSegment:segment];
+                return NO;
+            }
+            long long segmentEnd = MIN((long long)(segment + 1) * kSegmentSize, end);
+            NSData * data = [self.cache dataAtOffset:read.currentOffset length:(NSUInteger)(segmentEnd - read.currentOffset)];
+            if (data == nil) {
+                [self finishRead:read status:CloudErrorUnknown];
+                return YES;
+            }
+            // the player gets the bytes as soon as they are available, it does not wait for the whole range
+            if (read.loadingRequest != nil) {
+                [read.loadingRequest.dataRequest respondWithData:data];
+            } else {
+                [read.data appendData:data];
+            }
+            read.currentOffset = segmentEnd;
+        }
+    }
+    [self finishRead:read status:StatusOK];
+    return YES;
+}
+
+- (void) finishRead:(CloudMediaRead*)read status:(CloudStatus)status {
+    if (read.loadingRequest != nil) {
+        if (status == StatusOK) {
+            [read.loadingRequest finishLoading];
+        } else {
+            [read.loadingRequest finishLoadingWithError:[NSError errorWithDomain:@"Orange Cloud" code:status userInfo:nil]];
+        }
+    } else {
+        RangeBlock result = read.result;
+        NSData * data = status == StatusOK ? read.data : nil;
+        long long offset = read.offset;
+        long long totalLength = self.cache.totalLength;
+        [self.manager deliver:^{ result (data, offset, totalLength, status); } operation:nil];
+    }
+}
+
+/** download the given segment and the missing ones following it, up to the chunk size recommended by the bandwidth estimator */
+- (void) fetchFromSegment:(NSUInteger)first {
+    NSUInteger segmentCount = self.cache.segmentCount;
+    if ([self.fetching containsIndex:first] || [self.cache hasSegment:first] || (segmentCount > 0 && first >= segmentCount)) {
+        return;
+    }
+    NSUInteger maxCount = MAX(1, self.manager.bandwidthEstimator.recommendedChunkSize / kSegmentSize);
+    NSUInteger last = first;
+    while (last + 1 < first + maxCount && (segmentCount == 0 || last + 1 < segmentCount) && [self.cache hasSegment:last + 1] == NO && [self.fetching containsIndex:last + 1] == NO) {
+        last++;
+    }
+    NSRange range = NSMakeRange(first, last - first + 1);
+    [self.fetching addIndexesInRange:range];
+    _requestCount++;
+    __block CloudOperation * operation = nil;
+    operation = [self.manager getContentOfURL:self.url offset:(long long)first * kSegmentSize length:(long long)range.length * kSegmentSize result:^(NSData * data, long long offset, long long totalLength, CloudStatus status) {
+        dispatch_async(self.queue, ^{
+            [self.operations removeObject:operation];
+            [self.fetching removeIndexesInRange:range];
+            if (self.invalidated) {
+                return;
+            }
+            if (status == StatusOK) {
+                self.cache.totalLength = totalLength;
+                [self.cache storeData:data atOffset:offset];
+            }
+            // a short response would otherwise be requested again forever
+            if (status != StatusOK || [self.cache hasSegment:first] == NO) {
+                [self failReadsInRange:range status:status == StatusOK ? CloudErrorResponseMalformed : status];
+            }
+            [self process];
+        });
+    }];
+    if (operation != nil) {
+        [self.operations addObject:operation];
+    }
+}
+
+/** fail the reads waiting for the given segments, or all of them if the length of the content is still unknown */
+- (void) failReadsInRange:(NSRange)range status:(CloudStatus)status {
+    BOOL all = self.cache.totalLength < 0;
+    for (CloudMediaRead * read in [self.reads copy]) {
+        if (all || NSLocationInRange((NSUInteger)(read.currentOffset / kSegmentSize), range)) {
+            [self finishRead:read status:status];
+            [self.reads removeObject:read];
+        }
+    }
+}
+
+/** download the segments following the playback position that are not cached yet */
+- (void) readAhead {
+    NSUInteger segmentCount = self.cache.segmentCount;
+    if (segmentCount == 0) {
+        return;
+    }
+    CloudBandwidthEstimator * estimator = self.manager.bandwidthEstimator;
+    long long readAhead = estimator.isSlow ? kMinReadAhead : (long long)MIN(MAX(estimator.bandwidth * kReadAheadDuration, kMinReadAhead), kMaxReadAhead);
+    NSUInteger first = (NSUInteger)(self.playbackOffset / kSegmentSize);
+    NSUInteger last = (NSUInteger)MIN(segmentCount, (self.playbackOffset + readAhead + kSegmentSize - 1) / kSegmentSize);
+    for (NSUInteger segment = first; segment < last && self.operations.count < kMaxReadAheadRequests; segment++) {
+        [self fetchFromSegment:segment];
+    }
+}
+
+@end
@@ -0,0 +1,101 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+
+/** The kinds of memory accounted by the governor, in eviction order: decoded bitmaps go first, as they are the largest and the easiest
+ * to rebuild from the thumbnail bytes, which go next, then the listings. Buffers of requests in flight are accounted but never evicted.
+ */
+typedef NS_ENUM(NSInteger, CloudMemoryCategory) {
+    CloudMemoryCategoryBitmaps,
+    CloudMemoryCategoryThumbnails,
+    CloudMemoryCategoryListings,
+    CloudMemoryCategoryBuffers,
+    CloudMemoryCategoryCount
+};
+
+/** An object holding memory it can release on demand: a cache, or a view controller displaying a large image */
+@protocol CloudMemoryConsumer <NSObject>
+
+/** release at least the given number of bytes if possible, and report the change with addUsage:category:.
+ * @note can be called from any thread
+ */
+- (void) evictMemory:(unsigned long long)bytes;
+
+@end
+
+
+/** This class keeps the memory used by the SDK caches within limits. Each cache reports the bytes it holds, in a category.
+ * Above the soft limit, the registered consumers are asked to release memory in the background, by category in eviction order.
+ * Above the hard limit, they are asked synchronously by the thread that crosses it. On a memory warning, usage is brought down to half
+ * the soft limit. The limits apply to the evictable categories: buffers are accounted, but evicting the caches would not release them.
+ * @note all methods are thread safe. A consumer must not hold its own lock when calling addUsage:category:
+ */
+@interface CloudMemoryGovernor : NSObject
+
+/** the governor of the application, shared by all the cloud managers, as memory is a process wide resource */
++ (nonnull CloudMemoryGovernor *) sharedGovernor;
+
+/** the evictable usage above which consumers are trimmed in the background. Default value is 1/32 of the physical memory, 32 MB on a 1 GB device */
+@property (nonatomic) unsigned long long softLimit;
+
+/** the evictable usage above which consumers are trimmed before going on. Default value is 1/16 of the physical memory */
+@property (nonatomic) unsigned long long hardLimit;
+
+/** the sum of the usage of all categories, in bytes */
+@property (nonatomic, readonly) unsigned long long totalUsage;
+
+/** the bytes currently accounted in a category */
+- (unsigned long long) usageForCategory:(CloudMemoryCategory)category;
+
+/** add a consumer to the ones asked to release memory. Consumers are not retained */
+- (void) registerConsumer:(id<CloudMemoryConsumer> _Nonnull)consumer category:(CloudMemoryCategory)category;
+
+- (void) unregisterConsumer:(id<CloudMemoryConsumer> _Nonnull)consumer;
+
+/** record memory allocated (positive) or released (negative) in a category, and trim the consumers if a limit is crossed */
+- (void) addUsage:(long long)bytes category:(CloudMemoryCategory)category;
+
+/** ask the consumers to release memory, in eviction order, until the evictable usage is below the given size or nothing is left to evict */
+- (void) trimToSize:(unsigned long long)size;
+
+@end
+
+
+/** A memory cache whose entries have a cost, accounted in a category of a memory governor. When the governor asks it to release memory,
+ * the least recently used entries are removed first.
+ * @note methods can be called from any thread
+ */
+@interface CloudMemoryCache : NSObject <CloudMemoryConsumer>
+
+- (nonnull id) initWithCategory:(CloudMemoryCategory)category governor:(CloudMemoryGovernor * _Nonnull)governor;
+
+@property (nonatomic, readonly) CloudMemoryCategory category;
+
+/** the sum of the costs of the entries */
+@property (nonatomic, readonly) unsigned long long totalCost;
+
+- (id _Nullable) objectForKey:(id<NSCopying> _Nonnull)key;
+
+/** add or replace an entry. The cost is the number of bytes the object holds */
+- (void) setObject:(id _Nonnull)object forKey:(id<NSCopying> _Nonnull)key cost:(unsigned long long)cost;
+
+- (void) removeObjectForKey:(id<NSCopying> _Nonnull)key;
+
+- (void) removeAllObjects;
+
+@end
@@ -0,0 +1,275 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudMemoryGovernor.h"
+#import <UIKit/UIKit.h>
+
+// a memory warning brings the usage down to this ratio of the soft limit, a background trim to this other one
+static const double kWarningTrimRatio = 0.5;
+static const double kSoftTrimRatio = 0.9;
+
+@interface CloudMemoryGovernor ()
+@property (nonatomic) NSMutableArray * consumers; // one weak hash table per evictable category
+@property (nonatomic) dispatch_queue_t trimQueue;
+@property (nonatomic) BOOL trimScheduled;
+@property (nonatomic) BOOL hardLimitCrossed; // a synchronous trim was done since the usage went over the hard limit
+@end
+
+@implementation CloudMemoryGovernor {
+    long long _usage[CloudMemoryCategoryCount];
+}
+
++ (CloudMemoryGovernor*) sharedGovernor {
+    static CloudMemoryGovernor * sharedGovernor = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedGovernor = [[CloudMemoryGovernor alloc] init];
+    });
+    return sharedGovernor;
+}
+
+- (id) init {
+    self = [super init];
+    if (self != nil) {
+        unsigned long long physicalMemory = [NSProcessInfo processInfo].physicalMemory;
+        _softLimit = physicalMemory / 32;
+        _hardLimit = physicalMemory / 16;
+        _consumers = [[NSMutableArray alloc] init];
+        for (NSInteger category = 0; category < CloudMemoryCategoryCount; category++) {
+            [_consumers addObject:[NSHashTable weakObjectsHashTable]];
+        }
+        _trimQueue = dispatch_queue_create("CloudMemoryGovernor", DISPATCH_QUEUE_SERIAL);
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(didReceiveMemoryWarning:) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+- (void) didReceiveMemoryWarning:(NSNotification*)notification {
+    dispatch_async(self.trimQueue, ^{
+        [self trimToSize:self.softLimit * kWarningTrimRatio];
+    });
+}
+
+- (unsigned long long) totalUsage {
+    @synchronized(self) {
+        long long total = 0;
+        for (NSInteger category = 0; category < CloudMemoryCategoryCount; category++) {
+            total += _usage[category];
+        }
+        return MAX(total, 0);
+    }
+}
+
+/** the usage of the categories that can be evicted, which is what the limits apply to */
+- (unsigned long long) evictableUsage {
+    @synchronized(self) {
+        long long evictable = 0;
+        for (NSInteger category = 0; category < CloudMemoryCategoryCount; category++) {
+            if (category != CloudMemoryCategoryBuffers) {
+                evictable += _usage[category];
+            }
+        }
+        return MAX(evictable, 0);
+    }
+}
+
+- (unsigned long long) usageForCategory:(CloudMemoryCategory)category {
+    @synchronized(self) {
+        return MAX(_usage[category], 0);
+    }
+}
+
+- (void) registerConsumer:(id<CloudMemoryConsumer>)consumer category:(CloudMemoryCategory)category {
+    @synchronized(self) {
+        [self.consumers[category] addObject:consumer];
+    }
+}
+
+- (void) unregisterConsumer:(id<CloudMemoryConsumer>)consumer {
+    @synchronized(self) {
+        for (NSHashTable * consumers in self.consumers) {
+            [consumers removeObject:consumer];
+        }
+    }
+}
+
+- (void) addUsage:(long long)bytes category:(CloudMemoryCategory)category {
+    BOOL overHardLimit = NO;
+    BOOL overSoftLimit = NO;
+    @synchronized(self) {
+        _usage[category] += bytes;
+        unsigned long long evictable = self.evictableUsage;
+        if (evictable <= self.hardLimit) {
+            self.hardLimitCrossed = NO;
+        } else if (bytes > 0 && self.hardLimitCrossed == NO) {
+            // the allocations going on above the hard limit are trimmed in the background, like above the soft limit
+            self.hardLimitCrossed = YES;
+            overHardLimit = YES;
+        }
+        if (bytes > 0 && overHardLimit == NO) {
+            overSoftLimit = evictable > self.softLimit && self.trimScheduled == NO;
+            if (overSoftLimit) {
+                self.trimScheduled = YES;
+            }
+        }
+    }
+    if (overHardLimit) {
+        [self trimToSize:self.softLimit];
+    } else if (overSoftLimit) { // several allocations in a row trigger a single trim
+        dispatch_async(self.trimQueue, ^{
+            @synchronized(self) {
+                self.trimScheduled = NO;
+            }
+            [self trimToSize:self.softLimit * kSoftTrimRatio];
+        });
+    }
+}
+
+- (void) trimToSize:(unsigned long long)size {
+    for (NSInteger category = 0; category < CloudMemoryCategoryCount; category++) {
+        if (category == CloudMemoryCategoryBuffers) {
+            continue;
+        }
+        NSArray * consumers;
+        @synchronized(self) {
+            consumers = [self.consumers[category] allObjects];
+        }
+        // consumers are called without the lock held, as they report their releases
+        for (id<CloudMemoryConsumer> consumer in consumers) {
+            unsigned long long evictable = self.evictableUsage;
+            if (evictable <= size) {
+                return;
+            }
+            [consumer evictMemory:evictable - size];
+        }
+    }
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"bitmaps %.1f MB, thumbnails %.1f MB, listings %.1f MB, buffers %.1f MB",
+            [self usageForCategory:CloudMemoryCategoryBitmaps] / 1048576.0, [self usageForCategory:CloudMemoryCategoryThumbnails] / 1048576.0,
+            [self usageForCategory:CloudMemoryCategoryListings] / 1048576.0, [self usageForCategory:CloudMemoryCategoryBuffers] / 1048576.0];
+}
+
+@end
+
+
+@interface CloudMemoryCacheEntry : NSObject
+@property (nonatomic) id object;
+@property (nonatomic) unsigned long long cost;
+@property (nonatomic) unsigned long long lastAccess; // a counter rather than a date, cheaper and strictly ordered
+@end
+
+@implementation CloudMemoryCacheEntry
+@end
+
+
+@interface CloudMemoryCache ()
+@property (nonatomic, weak) CloudMemoryGovernor * governor;
+@property (nonatomic) NSMutableDictionary * entries;
+@property (nonatomic) unsigned long long accessCount;
+@end
+
+@implementation CloudMemoryCache
+
+- (id) initWithCategory:(CloudMemoryCategory)category governor:(CloudMemoryGovernor*)governor {
+    self = [super init];
+    if (self != nil) {
+        _category = category;
+        _governor = governor;
+        _entries = [[NSMutableDictionary alloc] init];
+        [governor registerConsumer:self category:category];
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [_governor addUsage:-(long long)_totalCost category:_category];
+}
+
+- (id) objectForKey:(id<NSCopying>)key {
+    @synchronized(self) {
+        CloudMemoryCacheEntry * entry = self.entries[key];
+        entry.lastAccess = ++self.accessCount;
+        return entry.object;
+    }
+}
+
+- (void) setObject:(id)object forKey:(id<NSCopying>)key cost:(unsigned long long)cost {
+    long long delta;
+    @synchronized(self) {
+        CloudMemoryCacheEntry * entry = self.entries[key];
+        if (entry == nil) {
+            entry = [[CloudMemoryCacheEntry alloc] init];
+            self.entries[key] = entry;
+        }
+        delta = (long long)cost - (long long)entry.cost;
+        entry.object = object;
+        entry.cost = cost;
+        entry.lastAccess = ++self.accessCount;
+        _totalCost += delta;
+    }
+    [self.governor addUsage:delta category:self.category];
+}
+
+- (void) removeObjectForKey:(id<NSCopying>)key {
+    unsigned long long cost;
+    @synchronized(self) {
+        CloudMemoryCacheEntry * entry = self.entries[key];
+        if (entry == nil) {
+            return;
+        }
+        cost = entry.cost;
+        [self.entries removeObjectForKey:key];
+        _totalCost -= cost;
+    }
+    [self.governor addUsage:-(long long)cost category:self.category];
+}
+
+- (void) removeAllObjects {
+    unsigned long long cost;
+    @synchronized(self) {
+        cost = _totalCost;
+        [self.entries removeAllObjects];
+        _totalCost = 0;
+    }
+    [self.governor addUsage:-(long long)cost category:self.category];
+}
+
+- (void) evictMemory:(unsigned long long)bytes {
+    unsigned long long evicted = 0;
+    @synchronized(self) {
+        NSArray * keys = [self.entries keysSortedByValueUsingComparator:^NSComparisonResult(CloudMemoryCacheEntry * entry1, CloudMemoryCacheEntry * entry2) {
+            return entry1.lastAccess < entry2.lastAccess ? NSOrderedAscending : (entry1.lastAccess > entry2.lastAccess ? NSOrderedDescending : NSOrderedSame);
+        }];
+        for (id key in keys) {
+            if (evicted >= bytes) {
+                break;
+            }
+            evicted += [self.entries[key] cost];
+            [self.entries removeObjectForKey:key];
+        }
+        _totalCost -= evicted;
+    }
+    [self.governor addUsage:-(long long)evicted category:self.category];
+}
+
+@end
@@ -0,0 +1,118 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+#import "CloudItem.h"
+#import "CloudStatus.h"
+
+@class CloudManager;
+
+/** The kind of a change of the cloud tree */
+typedef NS_ENUM(NSInteger, CloudMutationKind) {
+    CloudMutationKindCreateFolder,
+    /** a rename, a move, or both at once */
+    CloudMutationKindUpdate,
+    CloudMutationKindCopy,
+    CloudMutationKindDelete
+};
+
+/** A change recorded in a CloudMutationJournal, not yet acknowledged by the server */
+@interface CloudMutation : NSObject
+
+/** a unique identifier, stable across application launches */
+@property (nonatomic, readonly, nonnull) NSString * identifier;
+
+@property (nonatomic, readonly) CloudMutationKind kind;
+
+/** the changed item. For a folder creation or a copy, the identifier of the new item, which is a local identifier until the server answers */
+@property (nonatomic, readonly, nonnull) NSString * itemIdentifier;
+
+/** for a copy, the copied item */
+@property (nonatomic, readonly, nullable) NSString * sourceIdentifier;
+
+/** the name of the item once changed */
+@property (nonatomic, readonly, nonnull) NSString * name;
+
+/** YES if the mutation changes the name of the item */
+@property (nonatomic, readonly) BOOL renames;
+
+/** for a rename, the name of the item before the change, put back in the search index if the server rejects it */
+@property (nonatomic, readonly, nullable) NSString * previousName;
+
+/** the folder of the item once changed, nil if it does not change */
+@property (nonatomic, readonly, nullable) NSString * parentIdentifier;
+
+@property (nonatomic, readonly) CloudType type;
+
+/** the number of times the mutation was sent and failed because of the network */
+@property (nonatomic, readonly) int attempts;
+
+@end
+
+
+/** a block type called when the server rejected a mutation, which has been removed from the journal */
+typedef __strong void (^MutationFailureBlock) (CloudMutation * _Nonnull mutation, CloudStatus status);
+
+/** This class makes file management instant: changes are applied to the local items and recorded in a persistent journal,
+ * then sent to the server in the background, in order, one at a time.
+ * Changes that have not been sent yet are coalesced: a rename followed by a move of the same item becomes one request, successive renames
+ * keep the last name, and a folder created then deleted before being sent costs no request at all.
+ * Folders created locally get a local identifier, replaced by the server identifier in the pending changes and in the CloudItem returned
+ * by createFolder:parent: once the server has created them.
+ * Changes failing because of the network are kept and sent again later. Changes rejected by the server are dropped, with the changes
+ * that depend on them, and reported to the failure handler so that the UI can list the real content again. A folder creation conflicting
+ * with an existing folder of the same name is resolved by using the existing folder.
+ * @note methods should be called from the main thread. Most applications should use the journal owned by CloudManager.
+ */
+@interface CloudMutationJournal : NSObject
+
+/** create a journal stored in the given file. Changes recorded in a previous launch are sent once the cloud session is open */
+- (nonnull id) initWithManager:(CloudManager * _Nonnull)manager url:(NSURL * _Nonnull)url;
+
+/** YES for the identifiers given to folders and copies that the server has not created yet */
++ (BOOL) isLocalIdentifier:(NSString * _Nullable)identifier;
+
+/** the changes not acknowledged by the server yet, in the order they will be sent */
+@property (nonatomic, readonly, nonnull) NSArray<CloudMutation*> * pendingMutations;
+
+/** called on the manager callback queue for each change rejected by the server. The CloudItem objects changed by the journal keep the
+ * rejected change: the handler typically lists the affected folders again, and the listing replaces them */
+@property (nonatomic, copy, nullable) MutationFailureBlock failureHandler;
+
+/** @return a folder with a local identifier, to be displayed immediately */
+- (CloudItem * _Nonnull) createFolder:(NSString * _Nonnull)name parent:(CloudItem * _Nonnull)parent;
+
+/** the name of the item is changed immediately. If the server rejects the change, the search index gets the previous name back */
+- (void) rename:(CloudItem * _Nonnull)item newName:(NSString * _Nonnull)newName;
+
+- (void) move:(CloudItem * _Nonnull)item destination:(CloudItem * _Nonnull)destination;
+
+/** @return the copy, with a local identifier, to be displayed immediately */
+- (CloudItem * _Nonnull) copy:(CloudItem * _Nonnull)item destination:(CloudItem * _Nonnull)destination;
+
+/** delete a file or a folder */
+- (void) deleteItem:(CloudItem * _Nonnull)item;
+
+/** the content of a folder as it will be once the pending changes are done.
+ * @param items the content listed by the server. Renamed items are changed in place.
+ */
+- (NSArray<CloudItem*> * _Nonnull) applyToListing:(NSArray<CloudItem*> * _Nonnull)items folder:(CloudItem * _Nonnull)folder;
+
+/** Send the pending changes. This is done automatically when the cloud session is opened */
+- (void) resume;
+
+@end
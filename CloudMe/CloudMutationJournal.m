@@ -0,0 +1,563 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudMutationJournal.h"
+#import "CloudManagerInternal.h"
+#import "CloudSearchIndex.h"
+
+static NSString * const kLocalPrefix = @"local:";
+
+// a change failing because of the network is sent again after a delay doubling with each attempt, up to this delay
+static const NSTimeInterval kMaxRetryDelay = 60.0;
+// after this many failed attempts the change is rejected, rather than blocking the ones queued after it forever
+static const int kMaxAttempts = 10;
+
+static BOOL isTransientFailure(CloudStatus status) {
+    switch (status) {
+        case InternalError:
+        case ServiceTemporarilyUnavailable:
+        case ServiceOverCapacity:
+        case TooManyRequests:
+        case RequestTimeOut:
+        case ExpiredCredentials:
+        case CloudErrorSessionExpired:
+        case CloudErrorNetworkError:
+            return YES;
+        default:
+            return NO;
+    }
+}
+
+
+@interface CloudMutation ()
+@property (nonatomic, readwrite) NSString * identifier;
+@property (nonatomic, readwrite) CloudMutationKind kind;
+@property (nonatomic, readwrite) NSString * itemIdentifier;
+@property (nonatomic, readwrite) NSString * sourceIdentifier;
+@property (nonatomic, readwrite) NSString * name;
+@property (nonatomic, readwrite) BOOL renames;
+@property (nonatomic, readwrite) NSString * previousName;
+@property (nonatomic, readwrite) NSString * parentIdentifier;
+@property (nonatomic, readwrite) CloudType type;
+@property (nonatomic, readwrite) int attempts;
+@property (nonatomic) BOOL sending; // the request is in flight, the mutation can no longer be coalesced
+@end
+
+@implementation CloudMutation
+
+- (id) initWithKind:(CloudMutationKind)kind item:(CloudItem*)item {
+    self = [super init];
+    if (self != nil) {
+        self.identifier = [NSUUID UUID].UUIDString;
+        self.kind = kind;
+        self.itemIdentifier = item.identifier;
+        self.name = item.name ?: @"";
+        self.type = item.type;
+    }
+    return self;
+}
+
+- (id) initWithDictionary:(NSDictionary*)dictionary {
+    self = [super init];
+    if (self != nil) {
+        self.identifier = dictionary[@"identifier"];
+        self.kind = [dictionary[@"kind"] integerValue];
+        self.itemIdentifier = dictionary[@"item"];
+        self.sourceIdentifier = dictionary[@"source"];
+        self.name = dictionary[@"name"];
+        self.renames = [dictionary[@"renames"] boolValue];
+        self.previousName = dictionary[@"previousName"];
+        self.parentIdentifier = dictionary[@"parent"];
+        self.type = [dictionary[@"type"] intValue];
+        self.attempts = [dictionary[@"attempts"] intValue];
+    }
+    return self;
+}
+
+- (NSDictionary*) dictionary {
+    NSMutableDictionary * dictionary = [@{
+                                          @"identifier" : self.identifier,
+                                          @"kind" : @(self.kind),
+                                          @"item" : self.itemIdentifier,
+                                          @"name" : self.name,
+                                          @"renames" : @(self.renames),
+                                          @"type" : @(self.type),
+                                          @"attempts" : @(self.attempts),
+                                          } mutableCopy];
+    if (self.sourceIdentifier != nil) {
+        dictionary[@"source"] = self.sourceIdentifier;
+    }
+    if (self.parentIdentifier != nil) {
+        dictionary[@"parent"] = self.parentIdentifier;
+    }
+    if (self.previousName != nil) {
+        dictionary[@"previousName"] = self.previousName;
+    }
+    return dictionary;
+}
+
+- (BOOL) createsItem {
+    return self.kind == CloudMutationKindCreateFolder || self.kind == CloudMutationKindCopy;
+}
+
+/** YES if the mutation refers to the item, as its target, its source or its destination */
+- (BOOL) refersTo:(NSString*)identifier {
+    return [self.itemIdentifier isEqualToString:identifier] || [self.sourceIdentifier isEqualToString:identifier] || [self.parentIdentifier isEqualToString:identifier];
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<CloudMutation %d %@ name:%@ parent:%@>", (int)self.kind, self.itemIdentifier, self.name, self.parentIdentifier];
+}
+
+@end
+
+
+@interface CloudMutationJournal ()
+@property (nonatomic, weak) CloudManager * manager;
+@property (nonatomic) NSURL * url;
+@property (nonatomic) NSMutableArray * mutations;
+@property (nonatomic) NSMapTable * localItems; // local identifier -> CloudItem given to the application, updated with the server identifier
+@property (nonatomic) BOOL retryScheduled;
+@end
+
+@implementation CloudMutationJournal
+
+- (id) initWithManager:(CloudManager*)manager url:(NSURL*)url {
+    self = [super init];
+    if (self != nil) {
+        self.manager = manager;
+        self.url = url;
+        self.localItems = [NSMapTable strongToWeakObjectsMapTable];
+        self.mutations = [[NSMutableArray alloc] init];
+        for (NSDictionary * dictionary in [NSArray arrayWithContentsOfURL:url]) {
+            CloudMutation * mutation = [[CloudMutation alloc] initWithDictionary:dictionary];
+            if (mutation.identifier != nil && mutation.itemIdentifier != nil && mutation.name != nil) {
+                [self.mutations addObject:mutation];
+            }
+        }
+    }
+    return self;
+}
+
++ (BOOL) isLocalIdentifier:(NSString*)identifier {
+    return [identifier hasPrefix:kLocalPrefix];
+}
+
+- (NSString*) newLocalIdentifier {
+    return [kLocalPrefix stringByAppendingString:[NSUUID UUID].UUIDString];
+}
+
+- (NSArray*) pendingMutations {
+    @synchronized(self) {
+        return [self.mutations copy];
+    }
+}
+
+- (void) save {
+    NSMutableArray * array = [[NSMutableArray alloc] init];
+    @synchronized(self) {
+        for (CloudMutation * mutation in self.mutations) {
+            [array addObject:[mutation dictionary]];
+        }
+    }
+    [[NSFileManager defaultManager] createDirectoryAtURL:[self.url URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+    [array writeToURL:self.url atomically:YES];
+}
+
+/** the journal must reach the disk before the change is shown as done */
+- (void) didChange {
+    [self save];
+    [self sendNext];
+}
+
+#pragma mark - recording and coalescing
+
+- (CloudItem*) createFolder:(NSString*)name parent:(CloudItem*)parent {
+    CloudItem * folder = [[CloudItem alloc] initWithIdentifier:[self newLocalIdentifier] name:name type:CloudTypeDirectory parentIdentifier:parent.identifier];
+    CloudMutation * mutation = [[CloudMutation alloc] initWithKind:CloudMutationKindCreateFolder item:folder];
+    mutation.parentIdentifier = parent.identifier;
+    @synchronized(self) {
+        [self.localItems setObject:folder forKey:folder.identifier];
+        [self.mutations addObject:mutation];
+    }
+    [self.manager.searchIndex addItems:@[folder] parent:parent];
+    [self didChange];
+    return folder;
+}
+
+- (void) rename:(CloudItem*)item newName:(NSString*)newName {
+    NSString * previousName = item.name;
+    item.name = newName;
+    CloudMutation * mutation = [[CloudMutation alloc] initWithKind:CloudMutationKindUpdate item:item];
+    mutation.renames = YES;
+    mutation.previousName = previousName;
+    @synchronized(self) {
+        [self appendUpdate:mutation];
+    }
+    [self.manager.searchIndex addItems:@[item] parent:nil];
+    [self didChange];
+}
+
+- (void) move:(CloudItem*)item destination:(CloudItem*)destination {
+    CloudMutation * mutation = [[CloudMutation alloc] initWithKind:CloudMutationKindUpdate item:item];
+    mutation.parentIdentifier = destination.identifier;
+    @synchronized(self) {
+        [self appendUpdate:mutation];
+    }
+    [self.manager.searchIndex addItems:@[item] parent:destination];
+    [self didChange];
+}
+
+- (CloudItem*) copy:(CloudItem*)item destination:(CloudItem*)destination {
+    CloudItem * copy = [[CloudItem alloc] initWithIdentifier:[self newLocalIdentifier] name:item.name type:item.type parentIdentifier:destination.identifier];
+    CloudMutation * mutation = [[CloudMutation alloc] initWithKind:CloudMutationKindCopy item:copy];
+    mutation.sourceIdentifier = item.identifier;
+    mutation.parentIdentifier = destination.identifier;
+    @synchronized(self) {
+        [self.localItems setObject:copy forKey:copy.identifier];
+        [self.mutations addObject:mutation];
+    }
+    [self.manager.searchIndex addItems:@[copy] parent:destination];
+    [self didChange];
+    return copy;
+}
+
+- (void) deleteItem:(CloudItem*)item {
+    CloudMutation * mutation = [[CloudMutation alloc] initWithKind:CloudMutationKindDelete item:item];
+    @synchronized(self) {
+        [self appendDelete:mutation];
+    }
+    [self.manager.searchIndex removeItem:item];
+    [self didChange];
+}
+
+/** the last mutation of the item, if it has not been sent yet. Must be called with self locked */
+- (CloudMutation*) lastUnsentMutationOfItem:(NSString*)identifier {
+    for (CloudMutation * mutation in self.mutations.reverseObjectEnumerator) {
+        if ([mutation.itemIdentifier isEqualToString:identifier]) {
+            return mutation.sending ? nil : mutation;
+        }
+    }
+    return nil;
+}
+
+/** YES if the folder exists on the server by the time the mutation is sent. Must be called with self locked */
+- (BOOL) folder:(NSString*)folderIdentifier existsBefore:(CloudMutation*)mutation {
+    if ([CloudMutationJournal isLocalIdentifier:folderIdentifier] == NO) {
+        return YES;
+    }
+    for (CloudMutation * previous in self.mutations) {
+        if (previous == mutation) {
+            return NO;
+        }
+        if (previous.createsItem && [previous.itemIdentifier isEqualToString:folderIdentifier]) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+/** Must be called with self locked */
+- (void) appendUpdate:(CloudMutation*)mutation {
+    CloudMutation * previous = [self lastUnsentMutationOfItem:mutation.itemIdentifier];
+    if (previous.kind == CloudMutationKindDelete) {
+        return; // the item is already gone
+    }
+    if (previous.kind == CloudMutationKindUpdate) {
+        // one request instead of two. It is sent at the position of the last change, so that a destination created in between exists
+        [self.mutations removeObject:previous];
+        if (mutation.renames == NO) {
+            mutation.renames = previous.renames;
+        }
+        if (previous.renames) { // the name known by the server is the one before the first rename
+            mutation.previousName = previous.previousName;
+        }
+        if (mutation.parentIdentifier == nil) {
+            mutation.parentIdentifier = previous.parentIdentifier;
+        }
+    } else if (previous != nil && (previous.kind == CloudMutationKindCreateFolder || mutation.renames == NO)
+               && (mutation.parentIdentifier == nil || [self folder:mutation.parentIdentifier existsBefore:previous])) {
+        // the item is not created yet: it is created directly with its final name and in its final folder. A copy cannot be renamed
+        previous.name = mutation.name;
+        if (mutation.parentIdentifier != nil) {
+            previous.parentIdentifier = mutation.parentIdentifier;
+        }
+        return;
+    }
+    [self.mutations addObject:mutation];
+}
+
+/** Must be called with self locked */
+- (void) appendDelete:(CloudMutation*)mutation {
+    BOOL neverCreated = NO;
+    for (CloudMutation * previous in [self.mutations copy]) {
+        if (previous.sending == NO && [previous.itemIdentifier isEqualToString:mutation.itemIdentifier]) {
+            neverCreated = neverCreated || previous.createsItem;
+            [self.mutations removeObject:previous];
+        }
+    }
+    if (neverCreated) { // created then deleted: the server never hears about it
+        [self dropContentOfFolder:mutation.itemIdentifier];
+    } else {
+        [self.mutations addObject:mutation];
+    }
+}
+
+/** a folder that will never be created: what was to be created in it is dropped, existing items to be moved in it are deleted instead.
+ * Must be called with self locked
+ */
+- (void) dropContentOfFolder:(NSString*)folderIdentifier {
+    for (CloudMutation * mutation in [self.mutations copy]) {
+        if (mutation.sending || [mutation.parentIdentifier isEqualToString:folderIdentifier] == NO || [self.mutations containsObject:mutation] == NO) {
+            continue;
+        }
+        if (mutation.createsItem) {
+            for (CloudMutation * other in [self.mutations copy]) {
+                if (other.sending == NO && [other.itemIdentifier isEqualToString:mutation.itemIdentifier]) {
+                    [self.mutations removeObject:other];
+                }
+            }
+            [self dropContentOfFolder:mutation.itemIdentifier];
+        } else if (mutation.kind == CloudMutationKindUpdate) {
+            for (CloudMutation * other in [self.mutations copy]) {
+                if (other != mutation && other.sending == NO && [other.itemIdentifier isEqualToString:mutation.itemIdentifier]) {
+                    [self.mutations removeObject:other];
+                }
+            }
+            mutation.kind = CloudMutationKindDelete;
+            mutation.renames = NO;
+            mutation.parentIdentifier = nil;
+        }
+    }
+}
+
+#pragma mark - local view
+
+- (NSArray*) applyToListing:(NSArray*)items folder:(CloudItem*)folder {
+    NSArray * mutations = self.pendingMutations;
+    if (mutations.count == 0) {
+        return items;
+    }
+    NSMutableSet * deleted = [[NSMutableSet alloc] init];
+    NSMutableDictionary * updates = [[NSMutableDictionary alloc] init]; // identifier -> last update
+    for (CloudMutation * mutation in mutations) {
+        if (mutation.kind == CloudMutationKindDelete) {
+            [deleted addObject:mutation.itemIdentifier];
+        } else if (mutation.kind == CloudMutationKindUpdate) {
+            updates[mutation.itemIdentifier] = mutation;
+        }
+    }
+
+    NSMutableArray * result = [[NSMutableArray alloc] initWithCapacity:items.count];
+    NSMutableSet * listed = [[NSMutableSet alloc] init];
+    for (CloudItem * item in items) {
+        CloudMutation * update = updates[item.identifier];
+        if ([deleted containsObject:item.identifier] || (update.parentIdentifier != nil && [update.parentIdentifier isEqualToString:folder.identifier] == NO)) {
+            continue;
+        }
+        if (update.renames) {
+            item.name = update.name;
+        }
+        [result addObject:item];
+        [listed addObject:item.identifier];
+    }
+    // items created or moved in this folder
+    for (CloudMutation * mutation in mutations) {
+        if ([mutation.parentIdentifier isEqualToString:folder.identifier] == NO || [listed containsObject:mutation.itemIdentifier]
+            || [deleted containsObject:mutation.itemIdentifier] || mutation.kind == CloudMutationKindDelete) {
+            continue;
+        }
+        CloudItem * item;
+        @synchronized(self) {
+            item = [self.localItems objectForKey:mutation.itemIdentifier];
+        }
+        if (item == nil) {
+            item = [[CloudItem alloc] initWithIdentifier:mutation.itemIdentifier name:mutation.name type:mutation.type parentIdentifier:folder.identifier];
+        }
+        [result addObject:item];
+        [listed addObject:mutation.itemIdentifier];
+    }
+    return result;
+}
+
+#pragma mark - replay
+
+- (void) resume {
+    [self sendNext];
+}
+
+- (void) sendNext {
+    CloudMutation * mutation;
+    @synchronized(self) {
+        mutation = self.mutations.firstObject;
+        if (mutation == nil || mutation.sending || self.retryScheduled || self.manager.isConnected == NO) {
+            return;
+        }
+        mutation.sending = YES;
+    }
+    if ([CloudMutationJournal isLocalIdentifier:mutation.sourceIdentifier] || [CloudMutationJournal isLocalIdentifier:mutation.parentIdentifier]
+        || (mutation.createsItem == NO && [CloudMutationJournal isLocalIdentifier:mutation.itemIdentifier])) {
+        [self rejectMutation:mutation status:CloudErrorBadParameter]; // depends on an item that was never created
+        return;
+    }
+    CloudManager * manager = self.manager;
+    CloudItem * item = [[CloudItem alloc] initWithIdentifier:mutation.itemIdentifier name:mutation.name type:mutation.type parentIdentifier:nil];
+    CloudItem * parent = mutation.parentIdentifier == nil ? nil : [[CloudItem alloc] initWithIdentifier:mutation.parentIdentifier name:@"" type:CloudTypeDirectory parentIdentifier:nil];
+    FileInfoBlock itemResult = ^(CloudItem * cloudItem, CloudStatus status) {
+        [self mutation:mutation didEndWithItem:cloudItem status:status];
+    };
+    ResultBlock result = ^(CloudStatus status) {
+        [self mutation:mutation didEndWithItem:nil status:status];
+    };
+    switch (mutation.kind) {
+        case CloudMutationKindCreateFolder:
+            [manager createFolder:mutation.name parent:parent result:itemResult];
+            break;
+        case CloudMutationKindUpdate:
+            [manager update:item name:mutation.renames ? mutation.name : nil parentIdentifier:mutation.parentIdentifier result:itemResult];
+            break;
+        case CloudMutationKindCopy:
+            [manager copy:[[CloudItem alloc] initWithIdentifier:mutation.sourceIdentifier name:mutation.name type:mutation.type parentIdentifier:nil] destination:parent result:itemResult];
+            break;
+        case CloudMutationKindDelete:
+            if (item.isDirectory) {
+                [manager deleteFolder:item result:result];
+            } else {
+                [manager deleteFile:item result:result];
+            }
+            break;
+    }
+}
+
+- (void) mutation:(CloudMutation*)mutation didEndWithItem:(CloudItem*)cloudItem status:(CloudStatus)status {
+    BOOL alreadyDeleted = mutation.kind == CloudMutationKindDelete && (status == ResourceNotFound || status == CloudErrorNotFound);
+    if (status == StatusOK || alreadyDeleted) {
+        @synchronized(self) {
+            [self.mutations removeObject:mutation];
+        }
+        if (cloudItem.identifier != nil && [cloudItem.identifier isEqualToString:mutation.itemIdentifier] == NO) {
+            [self replaceIdentifier:mutation.itemIdentifier with:cloudItem.identifier];
+        }
+        [self didChange];
+    } else if (status == CloudAlreadyExists && mutation.kind == CloudMutationKindCreateFolder) {
+        [self adoptExistingFolder:mutation];
+    } else if (isTransientFailure(status) && mutation.attempts + 1 < kMaxAttempts) {
+        @synchronized(self) {
+            mutation.sending = NO;
+            mutation.attempts++;
+        }
+        [self save];
+        [self scheduleRetry:mutation.attempts];
+    } else {
+        [self rejectMutation:mutation status:status];
+    }
+}
+
+/** the folder to create is already there, probably created by a previous launch which was killed before getting the answer */
+- (void) adoptExistingFolder:(CloudMutation*)mutation {
+    CloudItem * parent = [[CloudItem alloc] initWithIdentifier:mutation.parentIdentifier name:@"" type:CloudTypeDirectory parentIdentifier:nil];
+    [self.manager listFolder:parent result:^(NSArray * entries, CloudStatus status) {
+        for (CloudItem * entry in entries) {
+            if (entry.isDirectory && [entry.name isEqualToString:mutation.name]) {
+                [self mutation:mutation didEndWithItem:entry status:StatusOK];
+                return;
+            }
+        }
+        [self mutation:mutation didEndWithItem:nil status:isTransientFailure(status) ? status : CloudAlreadyExists];
+    }];
+}
+
+/** an item got its server identifier, or a new one after a move */
+- (void) replaceIdentifier:(NSString*)oldIdentifier with:(NSString*)newIdentifier {
+    CloudItem * item;
+    @synchronized(self) {
+        for (CloudMutation * mutation in self.mutations) {
+            if ([mutation.itemIdentifier isEqualToString:oldIdentifier]) {
+                mutation.itemIdentifier = newIdentifier;
+            }
+            if ([mutation.sourceIdentifier isEqualToString:oldIdentifier]) {
+                mutation.sourceIdentifier = newIdentifier;
+            }
+            if ([mutation.parentIdentifier isEqualToString:oldIdentifier]) {
+                mutation.parentIdentifier = newIdentifier;
+            }
+        }
+        item = [self.localItems objectForKey:oldIdentifier];
+        [self.localItems removeObjectForKey:oldIdentifier];
+    }
+    if ([CloudMutationJournal isLocalIdentifier:oldIdentifier]) {
+        // the server version has been indexed by CloudManager. Only the entry itself goes, the local content is indexed again when created
+        [self.manager.searchIndex removeItem:[[CloudItem alloc] initWithIdentifier:oldIdentifier name:@"" type:CloudTypeFile parentIdentifier:nil]];
+    }
+    item.identifier = newIdentifier;
+}
+
+/** drop a mutation refused by the server, and the ones depending on the item it should have created */
+- (void) rejectMutation:(CloudMutation*)mutation status:(CloudStatus)status {
+    NSMutableArray * rejected = [[NSMutableArray alloc] initWithObjects:mutation, nil];
+    @synchronized(self) {
+        [self.mutations removeObject:mutation];
+        for (NSUInteger i = 0; i < rejected.count; i++) {
+            CloudMutation * current = rejected[i];
+            if (current.createsItem == NO) {
+                continue;
+            }
+            for (CloudMutation * other in [self.mutations copy]) {
+                if (other.sending == NO && [other refersTo:current.itemIdentifier]) {
+                    [self.mutations removeObject:other];
+                    [rejected addObject:other];
+                }
+            }
+        }
+    }
+    for (CloudMutation * current in rejected) {
+        NSLog (@"CloudMutationJournal: %@ rejected: %@", current, [CloudManager statusString:status]);
+        if (current.createsItem) {
+            [self.manager.searchIndex removeItem:[[CloudItem alloc] initWithIdentifier:current.itemIdentifier name:@"" type:current.type parentIdentifier:nil]];
+        } else if (current.renames && current.previousName != nil) {
+            [self.manager.searchIndex addItems:@[[[CloudItem alloc] initWithIdentifier:current.itemIdentifier name:current.previousName type:current.type parentIdentifier:nil]] parent:nil];
+        }
+    }
+    [self save];
+    MutationFailureBlock failureHandler = self.failureHandler;
+    if (failureHandler != nil) {
+        [self.manager.callbackQueue addOperationWithBlock:^{
+            for (CloudMutation * current in rejected) {
+                failureHandler (current, status);
+            }
+        }];
+    }
+    [self sendNext];
+}
+
+- (void) scheduleRetry:(int)attempts {
+    @synchronized(self) {
+        if (self.retryScheduled) {
+            return;
+        }
+        self.retryScheduled = YES;
+    }
+    NSTimeInterval delay = MIN(pow(2, attempts), kMaxRetryDelay);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        @synchronized(self) {
+            self.retryScheduled = NO;
+        }
+        [self sendNext];
+    });
+}
+
+@end
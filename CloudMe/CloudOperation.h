@@ -0,0 +1,67 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+
+/** A lightweight handle on a pending cloud request, returned by most CloudManager methods.
+ * Cancelling an operation cancels the underlying network connection (freeing its slot for other requests) and
+ * guarantees that the result block will not be called.
+ @code
+ self.thumbnailOperation = [cloudManager getThumbnail:cloudItem result:^(NSData * data, CloudStatus status) {
+     // never called if the operation was cancelled
+ }];
+ ...
+ [self.thumbnailOperation cancel]; // the cell has been reused
+ @endcode
+ */
+@interface CloudOperation : NSObject
+
+/** YES once cancel has been called */
+@property (nonatomic, readonly) BOOL isCancelled;
+
+/** Cancel the operation. It is safe to call this method several times, or after the operation has completed. */
+- (void) cancel;
+
+/** Attach the object actually performing the work (a connection, or another operation when a request is retried).
+ * If the operation has already been cancelled, the object is cancelled immediately.
+ * @note this method is used internally by the SDK, you should not need to call it.
+ */
+- (void) attach:(id _Nullable)cancellable;
+
+/** Set a block called once if the operation is cancelled, immediately if it already is. It releases what the work holds until it completes,
+ * as the completion of a cancelled work is never reported.
+ * @note this method is used internally by the SDK, you should not need to call it.
+ */
+- (void) setCancellationHandler:(void (^ _Nullable)(void))handler;
+
+@end
+
+
+/** A set of operations that can be cancelled at once. A view controller typically owns one group for all the requests
+ * it issued, and cancel them when it disappears.
+ */
+@interface CloudOperationGroup : NSObject
+
+/** Add an operation to the group. Operations are weakly referenced, completed operations are automatically released.
+ * @return the operation passed as parameter, for convenience
+ */
+- (CloudOperation * _Nullable) addOperation:(CloudOperation * _Nullable)operation;
+
+/** Cancel all the operations of the group. The group can still be used afterwards. */
+- (void) cancelAll;
+
+@end
@@ -0,0 +1,106 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudOperation.h"
+
+@interface CloudOperation ()
+@property (nonatomic) id cancellable; // the connection or the retried operation doing the actual work
+@property (nonatomic, copy) void (^cancellationHandler)(void);
+@end
+
+@implementation CloudOperation
+
+- (void) attach:(id)cancellable {
+    BOOL cancelled;
+    @synchronized(self) {
+        cancelled = _isCancelled;
+        if (cancelled == NO) {
+            self.cancellable = cancellable;
+        }
+    }
+    if (cancelled) {
+        [cancellable cancel];
+    }
+}
+
+- (void) setCancellationHandler:(void (^)(void))handler {
+    BOOL cancelled;
+    @synchronized(self) {
+        cancelled = _isCancelled;
+        if (cancelled == NO) {
+            _cancellationHandler = [handler copy];
+        }
+    }
+    if (cancelled && handler != nil) {
+        handler ();
+    }
+}
+
+- (void) cancel {
+    id cancellable;
+    void (^handler)(void);
+    @synchronized(self) {
+        _isCancelled = YES;
+        cancellable = self.cancellable;
+        self.cancellable = nil;
+        handler = _cancellationHandler;
+        _cancellationHandler = nil;
+    }
+    [cancellable cancel];
+    if (handler != nil) {
+        handler ();
+    }
+}
+
+@end
+
+
+@interface CloudOperationGroup ()
+@property (nonatomic) NSHashTable * operations;
+@end
+
+@implementation CloudOperationGroup
+
+- (id) init {
+    self = [super init];
+    if (self != nil) {
+        self.operations = [NSHashTable weakObjectsHashTable];
+    }
+    return self;
+}
+
+- (CloudOperation*) addOperation:(CloudOperation*)operation {
+    if (operation != nil) {
+        @synchronized(self) {
+            [self.operations addObject:operation];
+        }
+    }
+    return operation;
+}
+
+- (void) cancelAll {
+    NSArray * operations;
+    @synchronized(self) {
+        operations = self.operations.allObjects;
+        [self.operations removeAllObjects];
+    }
+    for (CloudOperation * operation in operations) {
+        [operation cancel];
+    }
+}
+
+@end
@@ -0,0 +1,93 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+#import "CloudManager.h"
+
+/** The decision about an upload, taken before any byte is sent */
+typedef NS_ENUM(NSInteger, CloudQuotaAdmission) {
+    /** the upload fits: its size is reserved until it ends */
+    CloudQuotaAdmitted,
+    /** the free space is being fetched: ask again once it is known */
+    CloudQuotaPending,
+    /** the upload does not fit in the free space left by the uploads already admitted */
+    CloudQuotaNoSpaceLeft,
+    /** a file at least as large has already been refused by the server */
+    CloudQuotaFileTooBig
+};
+
+/** a block type called with the decision about an upload */
+typedef __strong void (^QuotaAdmissionBlock) (CloudQuotaAdmission admission);
+
+/** This class keeps track of the free space of the account, so that uploads that cannot fit are refused before being sent rather than
+ * failing at the end of the transfer. The free space is fetched from the server when the session opens and when it gets old, and updated
+ * locally in the meantime: admitted uploads reserve their size, completed uploads consume it, and deleted files give it back.
+ * If the free space cannot be fetched, uploads are admitted and the server decides.
+ * @note all methods are thread safe
+ */
+@interface CloudQuotaTracker : NSObject
+
+- (nonnull id) initWithManager:(CloudManager * _Nonnull)manager;
+
+/** the last free space returned by the server, updated with the local changes since then. -1 when unknown */
+@property (nonatomic, readonly) long long freeSpace;
+
+/** the total size of the uploads admitted and not ended yet */
+@property (nonatomic, readonly) long long reservedSpace;
+
+/** the free space left for new uploads, -1 when unknown */
+@property (nonatomic, readonly) long long availableSpace;
+
+/** the age after which the free space is fetched again. Default value is 5 minutes */
+@property (nonatomic) NSTimeInterval revalidationInterval;
+
+/** YES to keep uploads that do not fit pending until space is freed, NO to fail them with CloudErrorNoSpaceLeft. Default value is NO */
+@property (nonatomic) BOOL deferUploads;
+
+/** called on the manager callback queue when the available space grows, for example to start deferred uploads */
+@property (atomic, copy, nullable) void (^availableSpaceHandler)(void);
+
+/** fetch the free space from the server */
+- (void) revalidate:(ResultBlock _Nullable)result;
+
+/** decide whether an upload can be sent, without waiting: CloudQuotaPending is returned while the free space is fetched.
+ * When admitted, the size is reserved until endUploadOfSize:status: is called.
+ */
+- (CloudQuotaAdmission) admitUploadOfSize:(long long)size;
+
+/** decide whether an upload can be sent, waiting for the free space if it is being fetched. The result is called on the manager callback queue */
+- (void) admitUploadOfSize:(long long)size result:(QuotaAdmissionBlock _Nonnull)result;
+
+/** reserve the size of an upload already being sent, for example a transfer resumed after a relaunch */
+- (void) reserveUploadOfSize:(long long)size;
+
+/** release the reservation of an admitted upload. On success, the size is taken from the free space. A failure because of the quota
+ * triggers a revalidation, a file refused as too big sets the size limit.
+ */
+- (void) endUploadOfSize:(long long)size status:(CloudStatus)status;
+
+/** give back the size of a deleted file. 0 or a negative size means unknown, for example a folder: the free space is fetched again */
+- (void) creditDeletedSize:(long long)size;
+
+/** choose which files of a batch to upload so that they all fit in the available space: the smallest ones first, which uploads as many
+ * files as possible. All are chosen while the free space is unknown.
+ * @param sizes the sizes of the files of the batch.
+ * @return the indexes of the chosen files.
+ */
+- (NSIndexSet * _Nonnull) packUploadsOfSizes:(NSArray<NSNumber*> * _Nonnull)sizes;
+
+@end
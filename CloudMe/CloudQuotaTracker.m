@@ -0,0 +1,207 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudQuotaTracker.h"
+#import "CloudManagerInternal.h"
+
+static const NSTimeInterval kDefaultRevalidationInterval = 5 * 60;
+
+@interface CloudQuotaTracker ()
+@property (nonatomic, weak) CloudManager * manager;
+@property (nonatomic) NSDate * validationDate; // when the free space was last fetched, nil if never
+@property (nonatomic) BOOL validating;
+@property (nonatomic) NSMutableArray * waitingAdmissions; // blocks waiting for the free space to be known
+@property (nonatomic) long long rejectedFileSize; // the smallest file refused as too big, 0 if none
+@end
+
+@implementation CloudQuotaTracker
+
+- (id) initWithManager:(CloudManager*)manager {
+    self = [super init];
+    if (self != nil) {
+        _manager = manager;
+        _freeSpace = -1;
+        _revalidationInterval = kDefaultRevalidationInterval;
+        _waitingAdmissions = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (long long) freeSpace {
+    @synchronized(self) {
+        return _freeSpace;
+    }
+}
+
+- (long long) reservedSpace {
+    @synchronized(self) {
+        return _reservedSpace;
+    }
+}
+
+- (long long) availableSpace {
+    @synchronized(self) {
+        return _freeSpace < 0 ? -1 : MAX(_freeSpace - _reservedSpace, 0);
+    }
+}
+
+- (void) revalidate:(ResultBlock)result {
+    @synchronized(self) {
+        self.validating = YES;
+    }
+    [self.manager getFreeSpace:^(long size, CloudStatus status) {
+        long long previous = self.availableSpace;
+        NSArray * waitingAdmissions;
+        @synchronized(self) {
+            self.validating = NO;
+            // after a failure, uploads are admitted until the next attempt rather than waiting for a value that cannot be fetched
+            self.validationDate = [NSDate date];
+            if (status == StatusOK) {
+                _freeSpace = size;
+            }
+            waitingAdmissions = [self.waitingAdmissions copy];
+            [self.waitingAdmissions removeAllObjects];
+        }
+        for (void (^admission)(void) in waitingAdmissions) {
+            admission ();
+        }
+        [self availableSpaceChangedFrom:previous];
+        if (result != nil) {
+            result (status);
+        }
+    }];
+}
+
+/** fetch the free space again if it is unknown or old. Must be called with self locked */
+- (void) revalidateIfNeeded {
+    if (self.validating || self.manager.isConnected == NO) {
+        return;
+    }
+    if (self.validationDate == nil || -[self.validationDate timeIntervalSinceNow] > self.revalidationInterval) {
+        self.validating = YES;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self revalidate:nil];
+        });
+    }
+}
+
+- (void) availableSpaceChangedFrom:(long long)previous {
+    long long available = self.availableSpace;
+    void (^availableSpaceHandler)(void) = self.availableSpaceHandler;
+    if (availableSpaceHandler != nil && (available < 0 || available > previous)) {
+        [self.manager deliver:availableSpaceHandler operation:nil];
+    }
+}
+
+- (CloudQuotaAdmission) admitUploadOfSize:(long long)size {
+    @synchronized(self) {
+        [self revalidateIfNeeded];
+        if (self.rejectedFileSize > 0 && size >= self.rejectedFileSize) {
+            return CloudQuotaFileTooBig;
+        }
+        if (_freeSpace < 0) {
+            if (self.validating) {
+                return CloudQuotaPending;
+            }
+            // the free space cannot be known: the server decides
+        } else if (size > _freeSpace - _reservedSpace) {
+            return CloudQuotaNoSpaceLeft;
+        }
+        _reservedSpace += size;
+        return CloudQuotaAdmitted;
+    }
+}
+
+- (void) admitUploadOfSize:(long long)size result:(QuotaAdmissionBlock)result {
+    CloudQuotaAdmission admission;
+    @synchronized(self) {
+        admission = [self admitUploadOfSize:size];
+        if (admission == CloudQuotaPending) {
+            [self.waitingAdmissions addObject:^{
+                [self admitUploadOfSize:size result:result];
+            }];
+            return;
+        }
+    }
+    [self.manager deliver:^{ result (admission); } operation:nil];
+}
+
+- (void) reserveUploadOfSize:(long long)size {
+    @synchronized(self) {
+        _reservedSpace += size;
+    }
+}
+
+- (void) endUploadOfSize:(long long)size status:(CloudStatus)status {
+    long long previous = self.availableSpace;
+    @synchronized(self) {
+        _reservedSpace = MAX(_reservedSpace - size, 0);
+        if (status == StatusOK && _freeSpace >= 0) {
+            _freeSpace = MAX(_freeSpace - size, 0);
+        } else if (status == CloudErrorNoSpaceLeft) { // the local value was wrong
+            self.validationDate = nil;
+            [self revalidateIfNeeded];
+        } else if (status == CloudErrorFileTooBig) {
+            self.rejectedFileSize = self.rejectedFileSize > 0 ? MIN(self.rejectedFileSize, size) : size;
+        }
+    }
+    [self availableSpaceChangedFrom:previous];
+}
+
+- (void) creditDeletedSize:(long long)size {
+    long long previous = self.availableSpace;
+    @synchronized(self) {
+        if (size > 0 && _freeSpace >= 0) {
+            _freeSpace += size;
+        } else {
+            self.validationDate = nil;
+            [self revalidateIfNeeded];
+        }
+    }
+    [self availableSpaceChangedFrom:previous];
+}
+
+- (NSIndexSet*) packUploadsOfSizes:(NSArray<NSNumber*>*)sizes {
+    long long available = self.availableSpace;
+    long long rejectedFileSize;
+    @synchronized(self) {
+        rejectedFileSize = self.rejectedFileSize;
+    }
+    NSMutableIndexSet * packed = [[NSMutableIndexSet alloc] init];
+    NSMutableArray * indexes = [[NSMutableArray alloc] initWithCapacity:sizes.count];
+    for (NSUInteger i = 0; i < sizes.count; i++) {
+        [indexes addObject:@(i)];
+    }
+    [indexes sortUsingComparator:^NSComparisonResult(NSNumber * index1, NSNumber * index2) {
+        return [sizes[index1.unsignedIntegerValue] compare:sizes[index2.unsignedIntegerValue]];
+    }];
+    long long total = 0;
+    for (NSNumber * index in indexes) {
+        long long size = [sizes[index.unsignedIntegerValue] longLongValue];
+        if (rejectedFileSize > 0 && size >= rejectedFileSize) {
+            break; // sorted: the following ones are too big as well
+        }
+        if (available >= 0 && total + size > available) {
+            break;
+        }
+        total += size;
+        [packed addIndex:index.unsignedIntegerValue];
+    }
+    return packed;
+}
+
+@end
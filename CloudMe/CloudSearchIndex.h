@@ -0,0 +1,73 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+#import "CloudItem.h"
+#import "CloudManager.h"
+
+/** A local index of the names of the items stored in the cloud, which answers filename searches instantly and offline.
+ * Names are folded (case, diacritics and width insensitive) and split into trigrams; a query is answered by intersecting the lists
+ * of items containing each of its trigrams, so its cost depends on the number of matches rather than on the number of indexed items.
+ * The index is fed by CloudManager with every listing, and kept up to date by the calls that create, rename, move or delete items.
+ * The tree of an account can also be indexed upfront with CloudManager buildSearchIndex:result:.
+ * @note all methods are thread safe
+ */
+@interface CloudSearchIndex : NSObject
+
+/** create an empty index kept in memory only */
+- (nonnull id) init;
+
+/** create an index saved to the given file, which is loaded in the background if it exists. Changes are saved a few seconds after they happen */
+- (nonnull id) initWithURL:(NSURL * _Nonnull)url;
+
+/** the file the index is saved to, or nil */
+@property (nonatomic, readonly, nullable) NSURL * url;
+
+/** the number of indexed items */
+@property (nonatomic, readonly) NSUInteger count;
+
+/** an estimation of the memory used by the index, in bytes */
+@property (nonatomic, readonly) NSUInteger estimatedMemoryUsage;
+
+/** add or update items.
+ * @param parent the folder containing the items, or nil to use their parentIdentifier.
+ */
+- (void) addItems:(NSArray<CloudItem*> * _Nonnull)items parent:(CloudItem * _Nullable)parent;
+
+/** replace the content of a folder by a complete listing: items of the folder that are not in the listing are removed */
+- (void) updateFolder:(CloudItem * _Nullable)folder items:(NSArray<CloudItem*> * _Nonnull)items;
+
+/** remove an item, and everything it contains if it is a folder */
+- (void) removeItem:(CloudItem * _Nonnull)item;
+
+- (void) removeAllItems;
+
+/** find the items whose name contains the query, items whose name starts with it first.
+ * @param filter restricts the result to a type of file. FilterTypeOther matches the files that are neither images, videos nor audio files.
+ * @param folder restricts the result to the items contained, directly or not, in this folder. nil to search everywhere.
+ * @param limit the maximum number of items returned, 0 for no limit.
+ * @return new CloudItem objects, without extra info
+ */
+- (NSArray<CloudItem*> * _Nonnull) search:(NSString * _Nonnull)query filter:(FilterType)filter folder:(CloudItem * _Nullable)folder limit:(NSUInteger)limit;
+
+/** the path of an indexed item, built from the names of its indexed ancestors, e.g. @"/Photos/2016/beach.jpg" */
+- (NSString * _Nullable) pathOfItem:(CloudItem * _Nonnull)item;
+
+/** save the index now, instead of waiting for the automatic save */
+- (BOOL) save;
+
+@end
@@ -0,0 +1,638 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudSearchIndex.h"
+
+static NSString * const kVersionKey = @"version";
+static NSString * const kIdentifiersKey = @"identifiers";
+static NSString * const kNamesKey = @"names";
+static NSString * const kParentsKey = @"parents";
+static NSString * const kTypesKey = @"types";
+static const NSInteger kFormatVersion = 1;
+
+// changes are saved after this delay, so that a burst of listings is saved only once
+static const NSTimeInterval kSaveDelay = 5.0;
+
+// removed items leave a hole in the slots, which are rebuilt when holes are more than half of them
+static const double kCompactionRatio = 0.5;
+static const NSUInteger kMinCompaction = 1024;
+
+// protects the walks up the parent chain against a cycle in corrupted data
+static const NSUInteger kMaxDepth = 256;
+
+/** names are compared case, diacritics and width insensitively: "ETE" finds "été.jpg" */
+static NSString * foldName(NSString * name) {
+    return [name stringByFoldingWithOptions:NSCaseInsensitiveSearch | NSDiacriticInsensitiveSearch | NSWidthInsensitiveSearch locale:nil];
+}
+
+/** the key of the trigram starting at index i */
+static inline uint64_t trigramKey(const unichar * characters, NSUInteger i) {
+    return ((uint64_t)characters[i] << 32) | ((uint64_t)characters[i + 1] << 16) | characters[i + 2];
+}
+
+/** the index of the first value not lower than slot in a sorted list, starting at index from */
+static inline NSUInteger lowerBound(const uint32_t * values, NSUInteger from, NSUInteger count, uint32_t slot) {
+    NSUInteger high = count;
+    while (from < high) {
+        NSUInteger middle = from + (high - from) / 2;
+        if (values[middle] < slot) {
+            from = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return from;
+}
+
+static BOOL typeMatchesFilter(CloudType type, FilterType filter) {
+    switch (filter) {
+        case FilterTypeAll:
+            return YES;
+        case FilterTypeImage:
+            return type == CloudTypeImage;
+        case FilterTypeVideo:
+            return type == CloudTypeVideo;
+        case FilterTypeAudio:
+            return type == CloudTypeAudio;
+        case FilterTypeOther:
+            return type == CloudTypeFile;
+    }
+    return YES;
+}
+
+
+@interface CloudSearchIndex ()
+// items are stored in parallel arrays indexed by slot, rather than as objects, to keep the memory cost per item low.
+// A removed item leaves an NSNull identifier until the next compaction
+@property (nonatomic) NSMutableArray * identifiers;
+@property (nonatomic) NSMutableArray * names;
+@property (nonatomic) NSMutableArray * foldedNames; // the name object itself when folding does not change it
+@property (nonatomic) NSMutableArray * parents; // parent identifier or NSNull
+@property (nonatomic) NSMutableData * types; // one CloudType per slot, as uint8_t
+@property (nonatomic) NSMutableDictionary * slots; // identifier -> slot
+@property (nonatomic) NSMutableDictionary * postings; // trigram key -> NSMutableData of increasing uint32_t slots
+@property (nonatomic) NSMutableSet * parentIdentifiers; // siblings share the same parent identifier string
+@property (nonatomic) NSMutableDictionary * children; // parent identifier -> NSMutableIndexSet of the slots of its items
+@property (nonatomic) NSUInteger removedCount;
+@property (nonatomic) BOOL saveScheduled;
+@property (nonatomic) NSObject * fileLock; // serializes load and saves, so that an older snapshot never overwrites a newer one
+// until the saved index is loaded, the items removed since the launch, which the load must not bring back. nil once loaded
+@property (nonatomic) NSMutableSet * removedIdentifiers;
+@property (nonatomic) NSMutableSet * removedFolders;
+@property (nonatomic) BOOL removedAll;
+@end
+
+@implementation CloudSearchIndex
+
+- (id) init {
+    self = [super init];
+    if (self != nil) {
+        _fileLock = [[NSObject alloc] init];
+        [self reset];
+    }
+    return self;
+}
+
+- (id) initWithURL:(NSURL*)url {
+    self = [self init];
+    if (self != nil) {
+        _url = url;
+        _removedIdentifiers = [[NSMutableSet alloc] init];
+        _removedFolders = [[NSMutableSet alloc] init];
+        // loading a large index takes a noticeable time, it must not delay the launch. Searches meanwhile only see the new listings
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+            [self load];
+            @synchronized(self) {
+                self.removedIdentifiers = nil;
+                self.removedFolders = nil;
+            }
+        });
+    }
+    return self;
+}
+
+/** empty the index. Must be called with self locked */
+- (void) reset {
+    self.identifiers = [[NSMutableArray alloc] init];
+    self.names = [[NSMutableArray alloc] init];
+    self.foldedNames = [[NSMutableArray alloc] init];
+    self.parents = [[NSMutableArray alloc] init];
+    self.types = [[NSMutableData alloc] init];
+    self.slots = [[NSMutableDictionary alloc] init];
+    self.postings = [[NSMutableDictionary alloc] init];
+    self.parentIdentifiers = [[NSMutableSet alloc] init];
+    self.children = [[NSMutableDictionary alloc] init];
+    self.removedCount = 0;
+}
+
+- (NSUInteger) count {
+    @synchronized(self) {
+        return self.slots.count;
+    }
+}
+
+#pragma mark - updates
+
+/** add an item in a new slot. Must be called with self locked */
+- (void) appendIdentifier:(NSString*)identifier name:(NSString*)name type:(CloudType)type parent:(NSString*)parent {
+    uint32_t slot = (uint32_t)self.identifiers.count;
+    NSString * folded = foldName(name);
+    if ([folded isEqualToString:name]) {
+        folded = name;
+    }
+    if (parent != nil) {
+        NSString * shared = [self.parentIdentifiers member:parent];
+        if (shared == nil) {
+            [self.parentIdentifiers addObject:parent];
+        } else {
+            parent = shared;
+        }
+        NSMutableIndexSet * siblings = self.children[parent];
+        if (siblings == nil) {
+            siblings = [[NSMutableIndexSet alloc] init];
+            self.children[parent] = siblings;
+        }
+        [siblings addIndex:slot];
+    }
+    [self.identifiers addObject:identifier];
+    [self.names addObject:name];
+    [self.foldedNames addObject:folded];
+    [self.parents addObject:parent ?: [NSNull null]];
+    uint8_t typeValue = type;
+    [self.types appendBytes:&typeValue length:sizeof(typeValue)];
+    self.slots[identifier] = [NSNumber numberWithUnsignedInt:slot];
+
+    NSUInteger length = folded.length;
+    if (length < 3) {
+        return;
+    }
+    unichar buffer[256];
+    unichar * characters = length <= 256 ? buffer : malloc(length * sizeof(unichar));
+    [folded getCharacters:characters range:NSMakeRange(0, length)];
+    for (NSUInteger i = 0; i + 2 < length; i++) {
+        NSNumber * key = [NSNumber numberWithUnsignedLongLong:trigramKey(characters, i)];
+        NSMutableData * posting = self.postings[key];
+        if (posting == nil) {
+            posting = [[NSMutableData alloc] initWithCapacity:4 * sizeof(uint32_t)];
+            self.postings[key] = posting;
+        }
+        // slots only grow, so the list stays sorted. A trigram repeated in the name is recorded once
+        NSUInteger count = posting.length / sizeof(uint32_t);
+        if (count == 0 || ((const uint32_t*)posting.bytes)[count - 1] != slot) {
+            [posting appendBytes:&slot length:sizeof(slot)];
+        }
+    }
+    if (characters != buffer) {
+        free(characters);
+    }
+}
+
+/** remove the item of a slot. Its trigram lists still reference the slot, searches skip it. Must be called with self locked */
+- (void) removeSlot:(uint32_t)slot {
+    id parent = self.parents[slot];
+    if (parent != [NSNull null]) {
+        NSMutableIndexSet * siblings = self.children[parent];
+        [siblings removeIndex:slot];
+        if (siblings.count == 0) {
+            [self.children removeObjectForKey:parent];
+        }
+    }
+    [self.slots removeObjectForKey:self.identifiers[slot]];
+    self.identifiers[slot] = [NSNull null];
+    self.names[slot] = @"";
+    self.foldedNames[slot] = @"";
+    self.parents[slot] = [NSNull null];
+    self.removedCount++;
+}
+
+/** add or update an item. Must be called with self locked
+ * @param replace NO to keep the indexed version of an item that is already known
+ */
+- (void) setIdentifier:(NSString*)identifier name:(NSString*)name type:(CloudType)type parent:(NSString*)parent replace:(BOOL)replace {
+    if (identifier == nil || name == nil) {
+        return;
+    }
+    if (replace) { // listed again since its removal
+        [self.removedIdentifiers removeObject:identifier];
+        [self.removedFolders removeObject:identifier];
+    }
+    NSNumber * slotNumber = self.slots[identifier];
+    if (slotNumber != nil) {
+        if (replace == NO) {
+            return;
+        }
+        uint32_t slot = slotNumber.unsignedIntValue;
+        id currentParent = self.parents[slot];
+        if (parent == nil && currentParent != [NSNull null]) {
+            parent = currentParent;
+        }
+        if ([self.names[slot] isEqualToString:name] && [currentParent isEqual:parent ?: [NSNull null]]) {
+            ((uint8_t*)self.types.mutableBytes)[slot] = type;
+            return;
+        }
+        [self removeSlot:slot];
+    }
+    [self appendIdentifier:identifier name:name type:type parent:parent];
+}
+
+/** record an item removed from the cloud, so that loading the saved index does not bring it back. Must be called with self locked */
+- (void) recordRemovalOfIdentifier:(NSString*)identifier isDirectory:(BOOL)isDirectory {
+    [self.removedIdentifiers addObject:identifier];
+    if (isDirectory) {
+        [self.removedFolders addObject:identifier];
+    }
+}
+
+/** remove everything contained in the folders. Must be called with self locked */
+- (void) removeDescendantsOfFolders:(NSSet*)folders {
+    const uint8_t * types = self.types.bytes;
+    while (folders.count > 0) {
+        NSMutableSet * subfolders = [[NSMutableSet alloc] init];
+        for (NSString * folder in folders) {
+            [self recordRemovalOfIdentifier:folder isDirectory:YES];
+            // removing a slot updates the list of children, so iterate over a copy
+            NSIndexSet * slots = [self.children[folder] copy];
+            [slots enumerateIndexesUsingBlock:^(NSUInteger slot, BOOL * stop) {
+                if (types[slot] == CloudTypeDirectory) {
+                    [subfolders addObject:self.identifiers[slot]];
+                } else {
+                    [self recordRemovalOfIdentifier:self.identifiers[slot] isDirectory:NO];
+                }
+                [self removeSlot:(uint32_t)slot];
+            }];
+        }
+        folders = subfolders;
+    }
+}
+
+/** rebuild the slots when too many of them are holes. Must be called with self locked */
+- (void) compactIfNeeded {
+    if (self.removedCount < kMinCompaction || self.removedCount < self.identifiers.count * kCompactionRatio) {
+        return;
+    }
+    NSArray * identifiers = self.identifiers;
+    NSArray * names = self.names;
+    NSArray * parents = self.parents;
+    NSData * types = self.types;
+    [self reset];
+    const uint8_t * typeValues = types.bytes;
+    for (NSUInteger slot = 0; slot < identifiers.count; slot++) {
+        if (identifiers[slot] != [NSNull null]) {
+            id parent = parents[slot];
+            [self appendIdentifier:identifiers[slot] name:names[slot] type:typeValues[slot] parent:parent == [NSNull null] ? nil : parent];
+        }
+    }
+}
+
+- (void) addItems:(NSArray*)items parent:(CloudItem*)parent {
+    NSString * parentIdentifier = parent.identifier;
+    @synchronized(self) {
+        for (CloudItem * item in items) {
+            [self setIdentifier:item.identifier name:item.name type:item.type parent:parentIdentifier ?: item.parentIdentifier replace:YES];
+        }
+        [self compactIfNeeded];
+    }
+    [self scheduleSave];
+}
+
+- (void) updateFolder:(CloudItem*)folder items:(NSArray*)items {
+    NSString * folderIdentifier = folder.identifier;
+    if (folderIdentifier == nil) {
+        [self addItems:items parent:nil];
+        return;
+    }
+    NSMutableSet * listed = [[NSMutableSet alloc] initWithCapacity:items.count];
+    for (CloudItem * item in items) {
+        if (item.identifier != nil) {
+            [listed addObject:item.identifier];
+        }
+    }
+    @synchronized(self) {
+        // only the current children of the folder are visited, so a listing costs the same whatever the size of the index
+        NSMutableSet * staleFolders = [[NSMutableSet alloc] init];
+        const uint8_t * types = self.types.bytes;
+        NSIndexSet * slots = [self.children[folderIdentifier] copy];
+        [slots enumerateIndexesUsingBlock:^(NSUInteger slot, BOOL * stop) {
+            id identifier = self.identifiers[slot];
+            if ([listed containsObject:identifier] == NO) {
+                if (types[slot] == CloudTypeDirectory) {
+                    [staleFolders addObject:identifier];
+                } else {
+                    [self recordRemovalOfIdentifier:identifier isDirectory:NO];
+                }
+                [self removeSlot:(uint32_t)slot];
+            }
+        }];
+        [self removeDescendantsOfFolders:staleFolders];
+        for (CloudItem * item in items) {
+            [self setIdentifier:item.identifier name:item.name type:item.type parent:folderIdentifier replace:YES];
+        }
+        [self compactIfNeeded];
+    }
+    [self scheduleSave];
+}
+
+- (void) removeItem:(CloudItem*)item {
+    if (item.identifier == nil) {
+        return;
+    }
+    @synchronized(self) {
+        BOOL isDirectory = item.isDirectory;
+        NSNumber * slotNumber = self.slots[item.identifier];
+        if (slotNumber != nil) {
+            uint32_t slot = slotNumber.unsignedIntValue;
+            isDirectory = isDirectory || ((const uint8_t*)self.types.bytes)[slot] == CloudTypeDirectory;
+            [self removeSlot:slot];
+        }
+        if (isDirectory) {
+            [self removeDescendantsOfFolders:[NSSet setWithObject:item.identifier]];
+        } else {
+            [self recordRemovalOfIdentifier:item.identifier isDirectory:NO];
+        }
+        [self compactIfNeeded];
+    }
+    [self scheduleSave];
+}
+
+- (void) removeAllItems {
+    @synchronized(self) {
+        [self reset];
+        self.removedAll = self.removedIdentifiers != nil;
+    }
+    [self scheduleSave];
+}
+
+#pragma mark - queries
+
+/** the slots of the items whose folded name contains all the trigrams of the query, in increasing order. Must be called with self locked */
+- (NSData*) candidatesForQuery:(NSString*)folded {
+    NSUInteger length = folded.length;
+    unichar * characters = malloc(length * sizeof(unichar));
+    [folded getCharacters:characters range:NSMakeRange(0, length)];
+    NSMutableArray * lists = [[NSMutableArray alloc] initWithCapacity:length - 2];
+    for (NSUInteger i = 0; i + 2 < length; i++) {
+        NSData * posting = self.postings[[NSNumber numberWithUnsignedLongLong:trigramKey(characters, i)]];
+        if (posting == nil) {
+            free(characters);
+            return [NSData data];
+        }
+        [lists addObject:posting];
+    }
+    free(characters);
+
+    // start from the rarest trigram, so that the intersection is never larger than the smallest list
+    [lists sortUsingComparator:^NSComparisonResult(NSData * list1, NSData * list2) {
+        return list1.length < list2.length ? NSOrderedAscending : list1.length > list2.length ? NSOrderedDescending : NSOrderedSame;
+    }];
+    NSMutableData * result = [lists[0] mutableCopy];
+    for (NSUInteger l = 1; l < lists.count && result.length > 0; l++) {
+        NSData * list = lists[l];
+        const uint32_t * others = list.bytes;
+        NSUInteger otherCount = list.length / sizeof(uint32_t);
+        uint32_t * slots = result.mutableBytes;
+        NSUInteger count = result.length / sizeof(uint32_t);
+        NSUInteger kept = 0;
+        NSUInteger position = 0;
+        for (NSUInteger i = 0; i < count; i++) {
+            position = lowerBound(others, position, otherCount, slots[i]);
+            if (position == otherCount) {
+                break;
+            }
+            if (others[position] == slots[i]) {
+                slots[kept++] = slots[i];
+            }
+        }
+        result.length = kept * sizeof(uint32_t);
+    }
+    return result;
+}
+
+/** YES if the folder is one of the indexed ancestors of the slot. Must be called with self locked */
+- (BOOL) slot:(uint32_t)slot isInFolder:(NSString*)folderIdentifier {
+    for (NSUInteger depth = 0; depth < kMaxDepth; depth++) {
+        id parent = self.parents[slot];
+        if (parent == [NSNull null]) {
+            return NO;
+        }
+        if ([parent isEqualToString:folderIdentifier]) {
+            return YES;
+        }
+        NSNumber * parentSlot = self.slots[parent];
+        if (parentSlot == nil) {
+            return NO;
+        }
+        slot = parentSlot.unsignedIntValue;
+    }
+    return NO;
+}
+
+/** Must be called with self locked */
+- (CloudItem*) itemAtSlot:(uint32_t)slot {
+    id parent = self.parents[slot];
+    CloudType type = ((const uint8_t*)self.types.bytes)[slot];
+    return [[CloudItem alloc] initWithIdentifier:self.identifiers[slot] name:self.names[slot] type:type parentIdentifier:parent == [NSNull null] ? nil : parent];
+}
+
+- (NSArray*) search:(NSString*)query filter:(FilterType)filter folder:(CloudItem*)folder limit:(NSUInteger)limit {
+    NSString * folded = foldName([query stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]]);
+    if (folded.length == 0) {
+        return @[];
+    }
+    if (limit == 0) {
+        limit = NSUIntegerMax;
+    }
+    NSMutableArray * prefixMatches = [[NSMutableArray alloc] init];
+    NSMutableArray * otherMatches = [[NSMutableArray alloc] init];
+    @synchronized(self) {
+        // queries shorter than a trigram scan all the names, they stop as soon as enough prefix matches are found
+        NSData * candidates = folded.length >= 3 ? [self candidatesForQuery:folded] : nil;
+        NSUInteger count = candidates != nil ? candidates.length / sizeof(uint32_t) : self.identifiers.count;
+        const uint32_t * candidateSlots = candidates.bytes;
+        const uint8_t * types = self.types.bytes;
+        for (NSUInteger i = 0; i < count && prefixMatches.count < limit; i++) {
+            uint32_t slot = candidates != nil ? candidateSlots[i] : (uint32_t)i;
+            if (self.identifiers[slot] == [NSNull null] || typeMatchesFilter(types[slot], filter) == NO) {
+                continue;
+            }
+            // trigrams may match in a different order, the name itself is the reference
+            NSRange range = [self.foldedNames[slot] rangeOfString:folded options:NSLiteralSearch];
+            if (range.location == NSNotFound) {
+                continue;
+            }
+            if (folder.identifier != nil && [self slot:slot isInFolder:folder.identifier] == NO) {
+                continue;
+            }
+            if (range.location == 0) {
+                [prefixMatches addObject:[self itemAtSlot:slot]];
+            } else if (otherMatches.count < limit) {
+                [otherMatches addObject:[self itemAtSlot:slot]];
+            }
+        }
+    }
+    [prefixMatches addObjectsFromArray:otherMatches];
+    if (prefixMatches.count > limit) {
+        [prefixMatches removeObjectsInRange:NSMakeRange(limit, prefixMatches.count - limit)];
+    }
+    return prefixMatches;
+}
+
+- (NSString*) pathOfItem:(CloudItem*)item {
+    if (item.identifier == nil) {
+        return nil;
+    }
+    @synchronized(self) {
+        NSNumber * slotNumber = self.slots[item.identifier];
+        if (slotNumber == nil) {
+            return nil;
+        }
+        uint32_t slot = slotNumber.unsignedIntValue;
+        NSMutableArray * components = [[NSMutableArray alloc] init];
+        while (components.count < kMaxDepth) {
+            [components insertObject:self.names[slot] atIndex:0];
+            id parent = self.parents[slot];
+            NSNumber * parentSlot = parent == [NSNull null] ? nil : self.slots[parent];
+            if (parentSlot == nil) {
+                break;
+            }
+            slot = parentSlot.unsignedIntValue;
+        }
+        return [@"/" stringByAppendingString:[components componentsJoinedByString:@"/"]];
+    }
+}
+
+- (NSUInteger) estimatedMemoryUsage {
+    // approximate sizes of the Foundation objects, which are not observable
+    const NSUInteger objectOverhead = 16;
+    const NSUInteger dictionaryEntry = 3 * sizeof(id) + objectOverhead; // key, value, hash slot and the NSNumber key
+    @synchronized(self) {
+        NSUInteger count = self.identifiers.count;
+        NSUInteger size = self.types.length + count * (4 * sizeof(id) + dictionaryEntry);
+        for (NSUInteger slot = 0; slot < count; slot++) {
+            NSString * identifier = self.identifiers[slot];
+            if ((id)identifier == [NSNull null]) {
+                continue;
+            }
+            NSString * name = self.names[slot];
+            NSString * folded = self.foldedNames[slot];
+            size += 2 * objectOverhead + [identifier lengthOfBytesUsingEncoding:NSUTF8StringEncoding] + [name lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+            if (folded != name) {
+                size += objectOverhead + [folded lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+            }
+        }
+        for (NSString * parent in self.parentIdentifiers) {
+            size += objectOverhead + sizeof(id) + [parent lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+        }
+        for (NSData * posting in self.postings.objectEnumerator) {
+            size += dictionaryEntry + objectOverhead + posting.length;
+        }
+        return size;
+    }
+}
+
+#pragma mark - persistence
+
+/** merge the saved items with the ones indexed since the launch, which are more recent. Items removed since the launch, and the content
+ * of removed folders, are not merged */
+- (void) load {
+    @synchronized(self.fileLock) {
+        NSData * data = [NSData dataWithContentsOfURL:self.url options:NSDataReadingMappedIfSafe error:nil];
+        if (data == nil) {
+            return;
+        }
+        NSDictionary * dictionary = [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:nil error:nil];
+        if ([dictionary isKindOfClass:[NSDictionary class]] == NO || [dictionary[kVersionKey] integerValue] != kFormatVersion) {
+            return;
+        }
+        NSArray * identifiers = dictionary[kIdentifiersKey];
+        NSArray * names = dictionary[kNamesKey];
+        NSArray * parents = dictionary[kParentsKey];
+        NSData * types = dictionary[kTypesKey];
+        NSUInteger count = identifiers.count;
+        if (names.count != count || parents.count != count || types.length != count) {
+            NSLog (@"CloudSearchIndex: ignoring inconsistent index %@", self.url.path);
+            return;
+        }
+        const uint8_t * typeValues = types.bytes;
+        @synchronized(self) {
+            if (self.removedAll) {
+                return;
+            }
+            for (NSUInteger i = 0; i < count; i++) {
+                if ([self.removedIdentifiers containsObject:identifiers[i]]) {
+                    continue;
+                }
+                NSString * parent = parents[i];
+                [self setIdentifier:identifiers[i] name:names[i] type:typeValues[i] parent:parent.length > 0 ? parent : nil replace:NO];
+            }
+            // saved items may be listed before their folder: the content of removed folders is removed once all are merged
+            [self removeDescendantsOfFolders:[self.removedFolders copy]];
+            [self compactIfNeeded];
+        }
+    }
+}
+
+- (BOOL) save {
+    if (self.url == nil) {
+        return NO;
+    }
+    @synchronized(self.fileLock) {
+        NSMutableArray * identifiers;
+        NSMutableArray * names;
+        NSMutableArray * parents;
+        NSMutableData * types;
+        @synchronized(self) {
+            self.saveScheduled = NO;
+            NSUInteger count = self.slots.count;
+            identifiers = [[NSMutableArray alloc] initWithCapacity:count];
+            names = [[NSMutableArray alloc] initWithCapacity:count];
+            parents = [[NSMutableArray alloc] initWithCapacity:count];
+            types = [[NSMutableData alloc] initWithCapacity:count];
+            const uint8_t * typeValues = self.types.bytes;
+            for (NSUInteger slot = 0; slot < self.identifiers.count; slot++) {
+                if (self.identifiers[slot] == [NSNull null]) {
+                    continue;
+                }
+                id parent = self.parents[slot];
+                [identifiers addObject:self.identifiers[slot]];
+                [names addObject:self.names[slot]];
+                [parents addObject:parent == [NSNull null] ? @"" : parent];
+                [types appendBytes:&typeValues[slot] length:1];
+            }
+        }
+        NSDictionary * dictionary = @{ kVersionKey : @(kFormatVersion), kIdentifiersKey : identifiers, kNamesKey : names, kParentsKey : parents, kTypesKey : types };
+        NSData * data = [NSPropertyListSerialization dataWithPropertyList:dictionary format:NSPropertyListBinaryFormat_v1_0 options:0 error:nil];
+        [[NSFileManager defaultManager] createDirectoryAtURL:[self.url URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+        return [data writeToURL:self.url options:NSDataWritingAtomic error:nil];
+    }
+}
+
+- (void) scheduleSave {
+    if (self.url == nil) {
+        return;
+    }
+    @synchronized(self) {
+        if (self.saveScheduled) {
+            return;
+        }
+        self.saveScheduled = YES;
+    }
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kSaveDelay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        [self save];
+    });
+}
+
+@end
@@ -192,6 +192,9 @@ typedef enum {
     /** not enough space available with th ecurrent account to upload the file */
     CloudErrorNoSpaceLeft,
     
+    /** The operation was cancelled before completion */
+    CloudErrorCancelled,
+    
     
 } CloudStatus;
 
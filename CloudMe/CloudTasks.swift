@@ -0,0 +1,262 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+import Foundation
+
+/** A unit of work run by a CloudTaskGroup. The task starts a cloud request, calls done exactly once when the request is over,
+ and returns the operation used to cancel the request (or nil if there is nothing to cancel) */
+typealias CloudTask = (done : () -> Void) -> CloudOperation?
+
+/**
+ Runs cloud requests with a limited number of requests in flight and notifies when all of them are done.
+ Cancelling the group cancels the requests in flight (their result closures are not called) and drops the pending ones.
+
+ ```Swift
+ let group = CloudTaskGroup (maxConcurrentTasks: 4)
+ for item in items {
+     group.addTask { done in
+         return manager.getThumbnail (item) { data, status in
+             // use data
+             done ()
+         }
+     }
+ }
+ group.notify { print ("all thumbnails fetched") }
+ ```
+ @warning a group must be used from the CloudManager callback queue (the main queue by default)
+ */
+class CloudTaskGroup {
+
+    /** the maximum number of tasks running at the same time */
+    let maxConcurrentTasks : Int
+
+    /** true once cancel has been called */
+    private(set) var isCancelled = false
+
+    private var pendingTasks = [CloudTask]()
+    private var runningTasks = 0
+    private let operations = CloudOperationGroup ()
+    private var completions = [() -> Void]()
+    private var isStarting = false // guards against tasks calling done synchronously, which would recurse once per task
+
+    init (maxConcurrentTasks : Int = 4) {
+        self.maxConcurrentTasks = max (1, maxConcurrentTasks)
+    }
+
+    /** add a task to the group. It is started as soon as there is a free slot */
+    func addTask (task : CloudTask) {
+        if isCancelled {
+            return
+        }
+        pendingTasks.append (task)
+        startPendingTasks ()
+    }
+
+    /** call completion once all the tasks added so far are done (immediately if there is none), or when the group is cancelled */
+    func notify (completion : () -> Void) {
+        completions.append (completion)
+        checkCompletion ()
+    }
+
+    /** cancel the tasks in flight and drop the pending ones */
+    func cancel () {
+        isCancelled = true
+        pendingTasks.removeAll ()
+        runningTasks = 0
+        operations.cancelAll ()
+        checkCompletion ()
+    }
+
+    private func startPendingTasks () {
+        if isStarting {
+            return // the loop below picks up the slot freed by a task done synchronously
+        }
+        isStarting = true
+        defer { isStarting = false }
+        while runningTasks < maxConcurrentTasks && pendingTasks.count > 0 && isCancelled == false {
+            let task = pendingTasks.removeFirst ()
+            runningTasks += 1
+            var finished = false
+            let operation = task () {
+                if finished || self.isCancelled {
+                    return
+                }
+                finished = true
+                self.runningTasks -= 1
+                self.startPendingTasks ()
+                self.checkCompletion ()
+            }
+            operations.addOperation (operation)
+        }
+    }
+
+    private func checkCompletion () {
+        if runningTasks == 0 && pendingTasks.count == 0 && completions.count > 0 {
+            let completions = self.completions
+            self.completions.removeAll ()
+            for completion in completions {
+                completion ()
+            }
+        }
+    }
+}
+
+/**
+ Lists a folder page by page, using the limit and offset parameters of listFolder.
+
+ ```Swift
+ let pager = CloudListingPager (manager: manager, folder: folder, pageSize: 200)
+ pager.forEachPage ({ items in
+     entries += items
+     return true // continue with next page
+ }) { status in
+     print ("listing done: \(CloudManager.statusString (status))")
+ }
+ ```
+ */
+class CloudListingPager {
+
+    let manager : CloudManager
+    let folder : CloudItem
+    let pageSize : Int
+
+    /** the number of items already listed */
+    private(set) var offset = 0
+
+    /** true once the last page has been listed */
+    private(set) var isFinished = false
+
+    private var operation : CloudOperation?
+
+    init (manager : CloudManager, folder : CloudItem, pageSize : Int = 100) {
+        self.manager = manager
+        self.folder = folder
+        self.pageSize = max (1, pageSize)
+    }
+
+    /** fetch the next page. An empty array is passed once the whole folder has been listed */
+    func next (result : ([CloudItem], CloudStatus) -> Void) {
+        if isFinished {
+            result ([], StatusOK)
+            return
+        }
+        operation = manager.listFolder (folder, restrictedMode: false, showThumbnails: true, filter: .All, flat: false, tree: false, limit: Int32 (pageSize), offset: Int32 (offset)) { entries, status in
+            self.operation = nil
+            let items = (entries as? [CloudItem]) ?? []
+            if status == StatusOK {
+                self.offset += items.count
+                self.isFinished = items.count < self.pageSize
+            }
+            result (items, status)
+        }
+    }
+
+    /** list the remaining pages, calling body with each of them until it returns false or the whole folder has been listed */
+    func forEachPage (body : ([CloudItem]) -> Bool, completion : (CloudStatus) -> Void) {
+        next () { items, status in
+            if status != StatusOK {
+                completion (status)
+            } else if items.count == 0 || body (items) == false || self.isFinished {
+                completion (StatusOK)
+            } else {
+                self.forEachPage (body, completion: completion)
+            }
+        }
+    }
+
+    /** restart the listing from the first page */
+    func reset () {
+        cancel ()
+        offset = 0
+        isFinished = false
+    }
+
+    /** cancel the page request in flight, if any. Its result closure will not be called */
+    func cancel () {
+        operation?.cancel ()
+        operation = nil
+    }
+}
+
+/** Bulk operations, running the underlying requests in a CloudTaskGroup. The returned group can be used to be notified when
+ all requests are done, or to cancel them. */
+extension CloudManager {
+
+    /** fetch the thumbnails of several files, result is called for each file as soon as its thumbnail is available */
+    func getThumbnails (items : [CloudItem], maxConcurrentTasks : Int = 4, result : (CloudItem, NSData?, CloudStatus) -> Void) -> CloudTaskGroup {
+        return runTasks (items, maxConcurrentTasks: maxConcurrentTasks) { item, done in
+            return self.getThumbnail (item) { data, status in
+                result (item, data, status)
+                done ()
+            }
+        }
+    }
+
+    /** fetch the content of several files, result is called for each file as soon as its content is available */
+    func getFileContents (items : [CloudItem], maxConcurrentTasks : Int = 2, result : (CloudItem, NSData?, CloudStatus) -> Void) -> CloudTaskGroup {
+        return runTasks (items, maxConcurrentTasks: maxConcurrentTasks) { item, done in
+            return self.getFileContent (item) { data, status in
+                result (item, data, status)
+                done ()
+            }
+        }
+    }
+
+    /** fetch the extra information (size, creation date, urls) of several files */
+    func fileInfos (items : [CloudItem], maxConcurrentTasks : Int = 4, result : (CloudItem, CloudStatus) -> Void) -> CloudTaskGroup {
+        return runTasks (items, maxConcurrentTasks: maxConcurrentTasks) { item, done in
+            return self.fileInfo (item) { _, status in
+                result (item, status)
+                done ()
+            }
+        }
+    }
+
+    /** delete several files and folders */
+    func deleteItems (items : [CloudItem], maxConcurrentTasks : Int = 4, result : (CloudItem, CloudStatus) -> Void) -> CloudTaskGroup {
+        return runTasks (items, maxConcurrentTasks: maxConcurrentTasks) { item, done in
+            let completion : ResultBlock = { status in
+                result (item, status)
+                done ()
+            }
+            return item.isDirectory ? self.deleteFolder (item, result: completion) : self.deleteFile (item, result: completion)
+        }
+    }
+
+    /** upload several files in the same folder, result is called with the new file item for each upload */
+    func uploadFiles (files : [(filename : String, data : NSData)], folderID : String, maxConcurrentTasks : Int = 2, result : (String, CloudItem?, CloudStatus) -> Void) -> CloudTaskGroup {
+        let group = CloudTaskGroup (maxConcurrentTasks: maxConcurrentTasks)
+        for file in files {
+            group.addTask { done in
+                return self.uploadData (file.data, filename: file.filename, folderID: folderID, progress: nil) { item, status in
+                    result (file.filename, item, status)
+                    done ()
+                }
+            }
+        }
+        return group
+    }
+
+    private func runTasks (items : [CloudItem], maxConcurrentTasks : Int, task : (CloudItem, () -> Void) -> CloudOperation?) -> CloudTaskGroup {
+        let group = CloudTaskGroup (maxConcurrentTasks: maxConcurrentTasks)
+        for item in items {
+            group.addTask { done in
+                return task (item, done)
+            }
+        }
+        return group
+    }
+}
@@ -0,0 +1,179 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+#import "CloudItem.h"
+#import "CloudStatus.h"
+
+@class CloudManager;
+
+/** The kind of a transfer */
+typedef NS_ENUM(NSInteger, CloudTransferKind) {
+    CloudTransferKindUpload,
+    CloudTransferKindDownload
+};
+
+/** The life cycle of a transfer: pending (waiting for a session or for the system to start it), running, then completed or failed */
+typedef NS_ENUM(NSInteger, CloudTransferState) {
+    CloudTransferStatePending,
+    CloudTransferStateRunning,
+    CloudTransferStateCompleted,
+    CloudTransferStateFailed
+};
+
+/** A file upload or download managed by a CloudTransferManager. Transfers are persisted, so that they survive the application being
+ * suspended or killed.
+ */
+@interface CloudTransfer : NSObject
+
+/** a unique identifier, stable across application launches */
+@property (nonatomic, readonly, nonnull) NSString * identifier;
+
+@property (nonatomic, readonly) CloudTransferKind kind;
+
+@property (nonatomic, readonly) CloudTransferState state;
+
+/** the name of the file in the cloud */
+@property (nonatomic, readonly, nonnull) NSString * filename;
+
+/** for an upload, the identifier of the destination folder. For a download, the identifier of the downloaded file */
+@property (nonatomic, readonly, nonnull) NSString * cloudIdentifier;
+
+/** for an upload, the local file being uploaded (nil when uploading data). For a download, the local file where the content is written on completion */
+@property (nonatomic, readonly, nullable) NSURL * fileURL;
+
+/** for an upload, the size of the content, known once it is spooled */
+@property (nonatomic, readonly) long long size;
+
+/** the progress of the transfer, between 0 and 1 */
+@property (nonatomic, readonly) float progress;
+
+/** once the transfer is over, StatusOK or the error code */
+@property (nonatomic, readonly) CloudStatus status;
+
+/** for a completed upload, the new cloud file */
+@property (nonatomic, readonly, nullable) CloudItem * cloudItem;
+
+@end
+
+
+/** a block type called with a batch of transfers that have just completed or failed */
+typedef __strong void (^TransfersBlock) (NSArray<CloudTransfer*> * _Nonnull transfers);
+
+/** a block type called when the progress of a transfer changes */
+typedef __strong void (^TransferProgressBlock) (CloudTransfer * _Nonnull transfer);
+
+/** a block type called when a transfer has completed or failed */
+typedef __strong void (^TransferResultBlock) (CloudTransfer * _Nonnull transfer);
+
+/** a block type reading a part of a content to upload.
+ * @param buffer where to copy the bytes.
+ * @param offset the position of the first byte to read in the content.
+ * @param length the number of bytes to read.
+ * @return the number of bytes read, 0 if the content cannot be read.
+ */
+typedef __strong NSUInteger (^ContentReaderBlock) (uint8_t * _Nonnull buffer, long long offset, NSUInteger length);
+
+/** This class performs uploads and downloads with a background NSURLSession, so that they go on while the application is suspended,
+ * and are picked up again when the application is relaunched by the system.
+ * Uploads are spooled to a file containing the full request body, so that neither the original data nor the request body need to stay in memory.
+ * Pending transfers are kept in a persistent queue; they are started as soon as the cloud session is open, the system then schedules them when
+ * the network is available. Uploads are admitted by the quota tracker of the manager before being started, so that an upload that cannot fit
+ * fails without being sent.
+ * Completions are batched: the completion block is called once for all the transfers that ended in a short time frame, or once for all
+ * the transfers that ended while the application was in background.
+ * @note most applications should use the transfer manager owned by CloudManager rather than creating their own.
+ */
+@interface CloudTransferManager : NSObject
+
+/** create a transfer manager using a background session with the given identifier. Transfers started by a previous instance with the same
+ * identifier, possibly in a previous application launch, are reattached.
+ */
+- (nonnull id) initWithManager:(CloudManager * _Nonnull)manager identifier:(NSString * _Nonnull)identifier;
+
+/** create a transfer manager with a custom session configuration, typically a default configuration and a custom protocol class to
+ * simulate a server, or to simulate the application being killed by creating a new manager with the same identifier.
+ * @param identifier the name of the persistent queue. For background configurations, it must be the configuration identifier.
+ */
+- (nonnull id) initWithManager:(CloudManager * _Nonnull)manager identifier:(NSString * _Nonnull)identifier configuration:(NSURLSessionConfiguration * _Nonnull)configuration;
+
+/** the identifier of the background session and of the persistent queue */
+@property (nonatomic, readonly, nonnull) NSString * identifier;
+
+/** called on the manager callback queue with the transfers that completed or failed since the previous call.
+ * Transfers ending while no block is set are kept, and reported as soon as a block is set.
+ */
+@property (nonatomic, copy, nullable) TransfersBlock completionHandler;
+
+/** called on the manager callback queue when the progress of a running transfer changes */
+@property (atomic, copy, nullable) TransferProgressBlock progressHandler;
+
+/** the transfers that are not over yet */
+@property (nonatomic, readonly, nonnull) NSArray<CloudTransfer*> * transfers;
+
+/** Queue the upload of a local file. The file must not be modified or deleted until the upload is over.
+ * Uploads whose content cannot be read or spooled fail with CloudErrorBadParameter, whichever method queued them.
+ * @param fileURL the local file to upload.
+ * @param filename the name of the file in the cloud.
+ * @param folderID the identifier of the cloud folder the file is uploaded in.
+ */
+- (CloudTransfer * _Nonnull) uploadFile:(NSURL * _Nonnull)fileURL filename:(NSString * _Nonnull)filename folderID:(NSString * _Nonnull)folderID;
+
+/** Queue the upload of a batch of local files, named after their last path component. The files that fit in the available space are chosen
+ * so that as many of them as possible are uploaded (see CloudQuotaTracker); the others fail with CloudErrorNoSpaceLeft, or stay pending
+ * until space is freed if the quota tracker defers uploads.
+ * @return the transfers, in the order of the files.
+ */
+- (NSArray<CloudTransfer*> * _Nonnull) uploadFiles:(NSArray<NSURL*> * _Nonnull)fileURLs folderID:(NSString * _Nonnull)folderID;
+
+/** Queue the upload of some data. The data is kept until it is written to the transfer spool by chunks on the transfer queue, the caller is not blocked */
+- (CloudTransfer * _Nonnull) uploadData:(NSData * _Nonnull)data filename:(NSString * _Nonnull)filename folderID:(NSString * _Nonnull)folderID;
+
+/** Queue the upload of a content read by chunks, for example a photo library asset, so that it is never fully loaded in memory.
+ * The content is spooled before returning: this method should be called from a background queue for large contents.
+ * @param size the size of the content.
+ * @param chunkSize the maximum length read at once, which is the memory used by the spooling.
+ * @param reader called with successive chunks of the content. It is released once the content is spooled.
+ * @param result called on the manager callback queue when the transfer ends during this launch of the application, in addition to the completion handler.
+ */
+- (CloudTransfer * _Nonnull) uploadContentOfSize:(long long)size chunkSize:(NSUInteger)chunkSize filename:(NSString * _Nonnull)filename folderID:(NSString * _Nonnull)folderID
+                                          reader:(ContentReaderBlock _Nonnull)reader result:(TransferResultBlock _Nullable)result;
+
+/** Queue the download of a cloud file.
+ * @param cloudFile a file, with its download URL (see fileInfo).
+ * @param fileURL the local file where the content is written once downloaded. Any existing file is replaced.
+ * @return the transfer, or nil if the file has no download URL.
+ */
+- (CloudTransfer * _Nullable) downloadFile:(CloudItem * _Nonnull)cloudFile toURL:(NSURL * _Nonnull)fileURL;
+
+/** Cancel a transfer. It is reported as failed with CloudErrorCancelled in the next batch of completions */
+- (void) cancelTransfer:(CloudTransfer * _Nonnull)transfer;
+
+/** Start the pending transfers. This is done automatically when the cloud session is opened */
+- (void) resume;
+
+/** Stop the manager as if the application was killed: the tasks of its session are cancelled and their events ignored, and the queue
+ * is left on disk as it is, for the next manager created with the same identifier. The manager cannot be used afterwards.
+ */
+- (void) invalidate;
+
+/** Forward the application delegate call of the same name.
+ * @return YES if the identifier is the one of this manager, in which case the completion handler is called once all events are processed.
+ */
+- (BOOL) handleEventsForBackgroundURLSession:(NSString * _Nonnull)identifier completionHandler:(void (^ _Nonnull)(void))completionHandler;
+
+@end
@@ -0,0 +1,721 @@
+/*
+ Copyright (C) 2016 Orange
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "CloudTransferManager.h"
+#import "CloudManagerInternal.h"
+#import "CloudConnection.h"
+#import "CloudSearchIndex.h"
+#import "CloudQuotaTracker.h"
+
+static NSString * const kTransfersFile = @"transfers.plist";
+
+// size of the chunks used to copy a file into an upload body, so that large files are never fully loaded in memory
+static const NSUInteger kSpoolChunkSize = 256 * 1024;
+
+// transfers ending within this delay are reported together
+static const NSTimeInterval kBatchDelay = 0.5;
+
+// a transfer failing because of the network is started again, at most this number of times, after a delay doubling with each attempt
+static const int kMaxAttempts = 5;
+static const NSTimeInterval kRetryDelay = 2.0;
+static const NSTimeInterval kMaxRetryDelay = 300.0;
+
+// after a relaunch, the session reports the tasks that completed while the application was not running shortly after being created.
+// A transfer started by a previous launch whose task is neither running nor reported after this delay is started again
+static const NSTimeInterval kLostTaskDelay = 5.0;
+
+static const NSInteger kMaxConnectionsPerHost = 4;
+
+
+@interface CloudTransfer ()
+@property (nonatomic, readwrite) NSString * identifier;
+@property (nonatomic, readwrite) CloudTransferKind kind;
+@property (nonatomic, readwrite) CloudTransferState state;
+@property (nonatomic, readwrite) NSString * filename;
+@property (nonatomic, readwrite) NSString * cloudIdentifier;
+@property (nonatomic, readwrite) NSURL * fileURL;
+@property (nonatomic, readwrite) long long size;
+@property (nonatomic, readwrite) float progress;
+@property (nonatomic, readwrite) CloudStatus status;
+@property (nonatomic, readwrite) CloudItem * cloudItem;
+@property (nonatomic) NSURL * bodyURL; // the spooled request body of an upload
+@property (nonatomic) NSString * remoteURL; // the download URL of a download
+@property (nonatomic) int attempts;
+@property (nonatomic) NSURLSessionTask * task;
+@property (nonatomic, copy) TransferResultBlock resultHandler; // not persisted: only called during the launch that queued the transfer
+@property (nonatomic) BOOL reserved; // not persisted: YES while the size of the upload is reserved in the quota tracker
+@property (nonatomic) NSDate * retryDate; // not persisted: a transfer failing because of the network is not started again before
+@end
+
+@implementation CloudTransfer
+
+/** paths are stored relative to the home directory, as the application container moves between launches */
+static NSString * storedPath (NSURL * url) {
+    return [url.path stringByAbbreviatingWithTildeInPath];
+}
+
+static NSURL * urlFromStoredPath (NSString * path) {
+    return path == nil ? nil : [NSURL fileURLWithPath:[path stringByExpandingTildeInPath]];
+}
+
+- (id) initWithDictionary:(NSDictionary*)dictionary {
+    self = [super init];
+    if (self != nil) {
+        self.identifier = dictionary[@"identifier"];
+        self.kind = [dictionary[@"kind"] integerValue];
+        self.state = [dictionary[@"state"] integerValue];
+        self.status = [dictionary[@"status"] intValue];
+        self.filename = dictionary[@"filename"];
+        self.cloudIdentifier = dictionary[@"cloudIdentifier"];
+        self.fileURL = urlFromStoredPath (dictionary[@"file"]);
+        self.bodyURL = urlFromStoredPath (dictionary[@"body"]);
+        self.remoteURL = dictionary[@"remoteURL"];
+        self.attempts = [dictionary[@"attempts"] intValue];
+        self.size = [dictionary[@"size"] longLongValue];
+        if (dictionary[@"itemId"] != nil) {
+            self.cloudItem = [[CloudItem alloc] init];
+            self.cloudItem.identifier = dictionary[@"itemId"];
+            self.cloudItem.name = dictionary[@"itemName"];
+            self.cloudItem.type = CloudTypeFile;
+        }
+    }
+    return self;
+}
+
+- (NSDictionary*) dictionary {
+    NSMutableDictionary * dictionary = [@{
+                                          @"identifier" : self.identifier,
+                                          @"kind" : @(self.kind),
+                                          @"state" : @(self.state),
+                                          @"status" : @(self.status),
+                                          @"filename" : self.filename,
+                                          @"cloudIdentifier" : self.cloudIdentifier,
+                                          @"attempts" : @(self.attempts),
+                                          @"size" : @(self.size),
+                                          } mutableCopy];
+    if (self.fileURL != nil) {
+        dictionary[@"file"] = storedPath (self.fileURL);
+    }
+    if (self.bodyURL != nil) {
+        dictionary[@"body"] = storedPath (self.bodyURL);
+    }
+    if (self.remoteURL != nil) {
+        dictionary[@"remoteURL"] = self.remoteURL;
+    }
+    if (self.cloudItem.identifier != nil) {
+        dictionary[@"itemId"] = self.cloudItem.identifier;
+        dictionary[@"itemName"] = self.cloudItem.name ?: self.filename;
+    }
+    return dictionary;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<CloudTransfer %@ %@ %@ state:%d status:%@>", self.identifier, self.kind == CloudTransferKindUpload ? @"upload" : @"download",
+            self.filename, (int)self.state, [CloudManager statusString:self.status]];
+}
+
+@end
+
+
+@interface CloudTransferManager () <NSURLSessionDataDelegate, NSURLSessionDownloadDelegate>
+@property (nonatomic, weak) CloudManager * manager;
+@property (nonatomic) NSURLSession * session;
+@property (nonatomic) NSOperationQueue * queue; // serial queue on which session events are processed and transfers are changed
+@property (nonatomic) NSURL * directory; // where the queue and the upload bodies are stored
+@property (nonatomic) NSMutableArray * allTransfers; // the persisted queue, including the ended transfers not reported yet
+@property (nonatomic) NSMutableDictionary * responses; // task identifier -> response body
+@property (nonatomic) BOOL reattached; // YES once the tasks of a previous launch have been looked up
+@property (nonatomic) BOOL batchScheduled;
+@property (nonatomic) BOOL invalidated; // the session events are ignored and the queue is no longer saved
+@property (nonatomic) BOOL reopeningSession; // a new session has been requested after a transfer found the session expired
+@property (nonatomic, copy) void (^backgroundEventsHandler)(void);
+@end
+
+@implementation CloudTransferManager
+
+@synthesize completionHandler = _completionHandler;
+
+- (id) initWithManager:(CloudManager*)manager identifier:(NSString*)identifier {
+    NSURLSessionConfiguration * configuration = [NSURLSessionConfiguration backgroundSessionConfigurationWithIdentifier:identifier];
+    configuration.sessionSendsLaunchEvents = YES;
+    configuration.discretionary = NO; // start as soon as the network is available, rather than waiting for Wi-Fi and power
+    return [self initWithManager:manager identifier:identifier configuration:configuration];
+}
+
+- (id) initWithManager:(CloudManager*)manager identifier:(NSString*)identifier configuration:(NSURLSessionConfiguration*)configuration {
+    self = [super init];
+    if (self != nil) {
+        _identifier = identifier;
+        self.manager = manager;
+        self.responses = [[NSMutableDictionary alloc] init];
+        self.queue = [[NSOperationQueue alloc] init];
+        self.queue.maxConcurrentOperationCount = 1;
+        self.queue.name = @"CloudTransferManager";
+
+        NSFileManager * fileManager = [NSFileManager defaultManager];
+        NSURL * support = [[fileManager URLsForDirectory:NSApplicationSupportDirectory inDomains:NSUserDomainMask] firstObject];
+        self.directory = [[support URLByAppendingPathComponent:@"CloudTransfers"] URLByAppendingPathComponent:identifier];
+        [fileManager createDirectoryAtURL:self.directory withIntermediateDirectories:YES attributes:nil error:nil];
+        [self.directory setResourceValue:@YES forKey:NSURLIsExcludedFromBackupKey error:nil];
+        self.allTransfers = [self loadTransfers];
+
+        configuration.HTTPMaximumConnectionsPerHost = kMaxConnectionsPerHost;
+        // the session retains its delegate: the transfer manager lives as long as the application
+        self.session = [NSURLSession sessionWithConfiguration:configuration delegate:self delegateQueue:self.queue];
+        [self reattach];
+    }
+    return self;
+}
+
+#pragma mark - persistent queue
+
+- (NSMutableArray*) loadTransfers {
+    NSMutableArray * transfers = [[NSMutableArray alloc] init];
+    NSArray * array = [NSArray arrayWithContentsOfURL:[self.directory URLByAppendingPathComponent:kTransfersFile]];
+    for (NSDictionary * dictionary in array) {
+        CloudTransfer * transfer = [[CloudTransfer alloc] initWithDictionary:dictionary];
+        if (transfer.identifier != nil && transfer.filename != nil && transfer.cloudIdentifier != nil) {
+            [transfers addObject:transfer];
+        }
+    }
+    return transfers;
+}
+
+- (void) save {
+    if (self.invalidated) {
+        return; // the queue on disk belongs to the next manager with the same identifier
+    }
+    NSMutableArray * array = [[NSMutableArray alloc] init];
+    @synchronized(self) {
+        for (CloudTransfer * transfer in self.allTransfers) {
+            [array addObject:[transfer dictionary]];
+        }
+    }
+    [array writeToURL:[self.directory URLByAppendingPathComponent:kTransfersFile] atomically:YES];
+}
+
+- (NSArray<CloudTransfer*>*) transfers {
+    @synchronized(self) {
+        return [self.allTransfers filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"state < %d", (int)CloudTransferStateCompleted]];
+    }
+}
+
+- (CloudTransfer*) transferForTask:(NSURLSessionTask*)task {
+    @synchronized(self) {
+        for (CloudTransfer * transfer in self.allTransfers) {
+            if ([transfer.identifier isEqualToString:task.taskDescription]) {
+                return transfer;
+            }
+        }
+    }
+    return nil;
+}
+
+/** look up the tasks the system went on with while the application was not running */
+- (void) reattach {
+    [self.session getTasksWithCompletionHandler:^(NSArray * dataTasks, NSArray * uploadTasks, NSArray * downloadTasks) {
+        [self.queue addOperationWithBlock:^{
+            NSMutableDictionary * tasks = [[NSMutableDictionary alloc] init];
+            for (NSURLSessionTask * task in [uploadTasks arrayByAddingObjectsFromArray:downloadTasks]) {
+                if (task.taskDescription != nil) {
+                    tasks[task.taskDescription] = task;
+                }
+            }
+            for (CloudTransfer * transfer in self.transfers) {
+                NSURLSessionTask * task = tasks[transfer.identifier];
+                [tasks removeObjectForKey:transfer.identifier];
+                if (task != nil) {
+                    transfer.task = task;
+                    transfer.state = CloudTransferStateRunning;
+                    if (transfer.kind == CloudTransferKindUpload && transfer.reserved == NO) { // admitted in a previous launch
+                        [self.manager.quotaTracker reserveUploadOfSize:transfer.size];
+                        transfer.reserved = YES;
+                    }
+                }
+                // a transfer running in a previous launch without a task now either completed while the application was not running,
+                // or was lost. It is only started again once the session had the time to report the completion
+            }
+            for (NSURLSessionTask * task in tasks.allValues) { // tasks whose transfer has been lost
+                [task cancel];
+            }
+            self.reattached = YES;
+            [self save];
+            if (self.manager.isConnected) {
+                [self startPendingTransfers];
+            }
+            [self scheduleBatch]; // report the transfers that ended in a previous launch
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kLostTaskDelay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+                [self.queue addOperationWithBlock:^{
+                    [self restartLostTransfers];
+                }];
+            });
+        }];
+    }];
+}
+
+/** start again the transfers of a previous launch whose task did not survive. Must be called on the transfer queue */
+- (void) restartLostTransfers {
+    if (self.reattached == NO || self.invalidated) {
+        return;
+    }
+    BOOL lost = NO;
+    for (CloudTransfer * transfer in self.transfers) {
+        if (transfer.state == CloudTransferStateRunning && transfer.task == nil) {
+            NSLog (@"transfer %@ lost, starting it again", transfer.filename);
+            transfer.state = CloudTransferStatePending;
+            lost = YES;
+        }
+    }
+    if (lost && self.manager.isConnected) {
+        [self startPendingTransfers];
+    }
+}
+
+- (void) invalidate {
+    [self.queue addOperationWithBlock:^{
+        self.invalidated = YES;
+        for (CloudTransfer * transfer in self.transfers) {
+            if (transfer.reserved) {
+                transfer.reserved = NO;
+                [self.manager.quotaTracker endUploadOfSize:transfer.size status:CloudErrorCancelled];
+            }
+        }
+    }];
+    [self.session invalidateAndCancel];
+}
+
+#pragma mark - queueing transfers
+
+- (CloudTransfer*) transferWithKind:(CloudTransferKind)kind filename:(NSString*)filename cloudIdentifier:(NSString*)cloudIdentifier {
+    CloudTransfer * transfer = [[CloudTransfer alloc] init];
+    transfer.identifier = [[NSUUID UUID] UUIDString];
+    transfer.kind = kind;
+    transfer.state = CloudTransferStatePending;
+    transfer.filename = filename;
+    transfer.cloudIdentifier = cloudIdentifier;
+    if (kind == CloudTransferKindUpload) {
+        transfer.bodyURL = [self.directory URLByAppendingPathComponent:[transfer.identifier stringByAppendingPathExtension:@"body"]];
+    }
+    return transfer;
+}
+
+/** write the whole multipart request body to the spool file, reading the content by chunks into a single buffer */
+- (BOOL) spoolTransfer:(CloudTransfer*)transfer size:(long long)size chunkSize:(NSUInteger)chunkSize reader:(ContentReaderBlock)reader {
+    NSFileManager * fileManager = [NSFileManager defaultManager];
+    [fileManager createFileAtPath:transfer.bodyURL.path contents:nil attributes:nil];
+    NSFileHandle * output = [NSFileHandle fileHandleForWritingToURL:transfer.bodyURL error:nil];
+    if (output == nil) {
+        return NO;
+    }
+    [output writeData:[self.manager multipartHeaderWithFilename:transfer.filename size:size folder:transfer.cloudIdentifier]];
+    NSMutableData * buffer = [[NSMutableData alloc] initWithLength:MAX(chunkSize, 1)];
+    long long offset = 0;
+    while (offset < size) {
+        @autoreleasepool {
+            NSUInteger length = reader (buffer.mutableBytes, offset, (NSUInteger)MIN((long long)buffer.length, size - offset));
+            if (length == 0) { // the content is shorter than announced, or cannot be read
+                [output closeFile];
+                [fileManager removeItemAtURL:transfer.bodyURL error:nil];
+                return NO;
+            }
+            [output writeData:[NSData dataWithBytesNoCopy:buffer.mutableBytes length:length freeWhenDone:NO]];
+            offset += length;
+        }
+    }
+    [output writeData:[self.manager multipartFooter]];
+    [output closeFile];
+    transfer.size = size;
+    return YES;
+}
+
+/** queue a spooled transfer, or report it as failed if the spooling failed. Must be called on the transfer queue */
+- (void) enqueueTransfer:(CloudTransfer*)transfer spooled:(BOOL)spooled failure:(CloudStatus)failure {
+    if (spooled) {
+        [self enqueueTransfer:transfer];
+    } else {
+        @synchronized(self) {
+            [self.allTransfers addObject:transfer];
+        }
+        [self endTransfer:transfer status:failure];
+    }
+}
+
+- (void) enqueueTransfer:(CloudTransfer*)transfer {
+    @synchronized(self) {
+        [self.allTransfers addObject:transfer];
+    }
+    [self save];
+    if (self.manager.isConnected) {
+        [self startPendingTransfers];
+    }
+}
+
+- (CloudTransfer*) uploadFile:(NSURL*)fileURL filename:(NSString*)filename folderID:(NSString*)folderID {
+    CloudTransfer * transfer = [self transferWithKind:CloudTransferKindUpload filename:filename cloudIdentifier:folderID];
+    transfer.fileURL = fileURL;
+    [self.queue addOperationWithBlock:^{
+        long long size = [[[NSFileManager defaultManager] attributesOfItemAtPath:fileURL.path error:nil] fileSize];
+        NSFileHandle * input = [NSFileHandle fileHandleForReadingFromURL:fileURL error:nil];
+        BOOL spooled = input != nil && [self spoolTransfer:transfer size:size chunkSize:kSpoolChunkSize reader:^NSUInteger(uint8_t * buffer, long long offset, NSUInteger length) {
+            NSData * chunk = [input readDataOfLength:length];
+            memcpy(buffer, chunk.bytes, chunk.length);
+            return chunk.length;
+        }];
+        [input closeFile];
+        [self enqueueTransfer:transfer spooled:spooled failure:CloudErrorBadParameter];
+    }];
+    return transfer;
+}
+
+- (NSArray<CloudTransfer*>*) uploadFiles:(NSArray<NSURL*>*)fileURLs folderID:(NSString*)folderID {
+    NSMutableArray * sizes = [[NSMutableArray alloc] initWithCapacity:fileURLs.count];
+    for (NSURL * fileURL in fileURLs) {
+        [sizes addObject:@([[[NSFileManager defaultManager] attributesOfItemAtPath:fileURL.path error:nil] fileSize])];
+    }
+    CloudQuotaTracker * quotaTracker = self.manager.quotaTracker;
+    NSIndexSet * packed = [quotaTracker packUploadsOfSizes:sizes];
+    // the chosen files are queued first and smallest first, so that the admission of each upload follows the packing
+    NSMutableArray * order = [[NSMutableArray alloc] initWithCapacity:fileURLs.count];
+    [packed enumerateIndexesUsingBlock:^(NSUInteger index, BOOL * stop) {
+        [order addObject:@(index)];
+    }];
+    [order sortUsingComparator:^NSComparisonResult(NSNumber * index1, NSNumber * index2) {
+        return [sizes[index1.unsignedIntegerValue] compare:sizes[index2.unsignedIntegerValue]];
+    }];
+    for (NSUInteger index = 0; index < fileURLs.count; index++) {
+        if ([packed containsIndex:index] == NO) {
+            [order addObject:@(index)];
+        }
+    }
+    NSMutableArray * transfers = [[NSMutableArray alloc] initWithCapacity:fileURLs.count];
+    for (NSUInteger index = 0; index < fileURLs.count; index++) {
+        [transfers addObject:[NSNull null]];
+    }
+    for (NSNumber * number in order) {
+        NSUInteger index = number.unsignedIntegerValue;
+        NSURL * fileURL = fileURLs[index];
+        if ([packed containsIndex:index] || quotaTracker.deferUploads) {
+            transfers[index] = [self uploadFile:fileURL filename:fileURL.lastPathComponent folderID:folderID];
+        } else {
+            CloudTransfer * transfer = [self transferWithKind:CloudTransferKindUpload filename:fileURL.lastPathComponent cloudIdentifier:folderID];
+            transfer.fileURL = fileURL;
+            transfer.size = [sizes[index] longLongValue];
+            [self.queue addOperationWithBlock:^{
+                [self enqueueTransfer:transfer spooled:NO failure:CloudErrorNoSpaceLeft];
+            }];
+            transfers[index] = transfer;
+        }
+    }
+    return transfers;
+}
+
+- (CloudTransfer*) uploadData:(NSData*)data filename:(NSString*)filename folderID:(NSString*)folderID {
+    CloudTransfer * transfer = [self transferWithKind:CloudTransferKindUpload filename:filename cloudIdentifier:folderID];
+    data = [data copy]; // a mutable data could change before it is spooled
+    [self.queue addOperationWithBlock:^{
+        BOOL spooled = [self spoolTransfer:transfer size:data.length chunkSize:kSpoolChunkSize reader:^NSUInteger(uint8_t * buffer, long long offset, NSUInteger length) {
+            [data getBytes:buffer range:NSMakeRange((NSUInteger)offset, length)];
+            return length;
+        }];
+        [self enqueueTransfer:transfer spooled:spooled failure:CloudErrorBadParameter];
+    }];
+    return transfer;
+}
+
+- (CloudTransfer*) uploadContentOfSize:(long long)size chunkSize:(NSUInteger)chunkSize filename:(NSString*)filename folderID:(NSString*)folderID
+                                reader:(ContentReaderBlock)reader result:(TransferResultBlock)result {
+    CloudTransfer * transfer = [self transferWithKind:CloudTransferKindUpload filename:filename cloudIdentifier:folderID];
+    transfer.resultHandler = result;
+    BOOL spooled = [self spoolTransfer:transfer size:size chunkSize:chunkSize reader:reader];
+    [self.queue addOperationWithBlock:^{
+        [self enqueueTransfer:transfer spooled:spooled failure:CloudErrorBadParameter];
+    }];
+    return transfer;
+}
+
+- (CloudTransfer*) downloadFile:(CloudItem*)cloudFile toURL:(NSURL*)fileURL {
+    if (cloudFile.downloadURL == nil || cloudFile.identifier == nil) {
+        return nil;
+    }
+    CloudTransfer * transfer = [self transferWithKind:CloudTransferKindDownload filename:cloudFile.name ?: @"" cloudIdentifier:cloudFile.identifier];
+    transfer.fileURL = fileURL;
+    transfer.remoteURL = cloudFile.downloadURL;
+    [self.queue addOperationWithBlock:^{
+        [self enqueueTransfer:transfer];
+    }];
+    return transfer;
+}
+
+- (void) cancelTransfer:(CloudTransfer*)transfer {
+    [self.queue addOperationWithBlock:^{
+        if (transfer.state < CloudTransferStateCompleted) {
+            [transfer.task cancel];
+            [self endTransfer:transfer status:CloudErrorCancelled];
+        }
+    }];
+}
+
+- (void) resume {
+    [self.queue addOperationWithBlock:^{
+        [self startPendingTransfers];
+    }];
+}
+
+/** create the tasks of the pending transfers. The system then runs them when the network is available */
+- (void) startPendingTransfers {
+    if (self.reattached == NO || self.invalidated) {
+        return; // done once the previous tasks are known, to avoid starting twice the same transfer
+    }
+    for (CloudTransfer * transfer in self.transfers) {
+        if (transfer.state != CloudTransferStatePending || [transfer.retryDate timeIntervalSinceNow] > 0) {
+            continue;
+        }
+        NSURLSessionTask * task;
+        if (transfer.kind == CloudTransferKindUpload && [[NSFileManager defaultManager] fileExistsAtPath:transfer.bodyURL.path] == NO) {
+            [self endTransfer:transfer status:CloudErrorBadParameter]; // the spool has been purged
+            continue;
+        }
+        if (transfer.kind == CloudTransferKindUpload && transfer.reserved == NO) {
+            CloudQuotaTracker * quotaTracker = self.manager.quotaTracker;
+            CloudQuotaAdmission admission = [quotaTracker admitUploadOfSize:transfer.size];
+            if (admission == CloudQuotaPending || (admission == CloudQuotaNoSpaceLeft && quotaTracker.deferUploads)) {
+                continue; // started again when the free space is known, or when it grows
+            } else if (admission != CloudQuotaAdmitted) {
+                [self endTransfer:transfer status:admission == CloudQuotaNoSpaceLeft ? CloudErrorNoSpaceLeft : CloudErrorFileTooBig];
+                continue;
+            }
+            transfer.reserved = YES;
+        }
+        if (transfer.kind == CloudTransferKindUpload) {
+            task = [self.session uploadTaskWithRequest:[self.manager uploadRequest] fromFile:transfer.bodyURL];
+        } else {
+            task = [self.session downloadTaskWithRequest:[self.manager requestWithMethod:@"GET" endpoint:transfer.remoteURL]];
+        }
+        task.taskDescription = transfer.identifier;
+        transfer.task = task;
+        transfer.retryDate = nil;
+        transfer.state = CloudTransferStateRunning;
+        transfer.attempts++;
+        [task resume];
+    }
+    [self save];
+}
+
+- (void) endTransfer:(CloudTransfer*)transfer status:(CloudStatus)status {
+    transfer.task = nil;
+    if (transfer.reserved) {
+        transfer.reserved = NO;
+        [self.manager.quotaTracker endUploadOfSize:transfer.size status:status];
+    }
+    transfer.status = status;
+    transfer.state = status == StatusOK ? CloudTransferStateCompleted : CloudTransferStateFailed;
+    if (status == StatusOK) {
+        transfer.progress = 1;
+    }
+    if (transfer.bodyURL != nil) {
+        [[NSFileManager defaultManager] removeItemAtURL:transfer.bodyURL error:nil];
+        transfer.bodyURL = nil;
+    }
+    [self save];
+    TransferResultBlock resultHandler = transfer.resultHandler;
+    if (resultHandler != nil) {
+        transfer.resultHandler = nil;
+        [self.manager deliver:^{ resultHandler (transfer); } operation:nil];
+    }
+    [self scheduleBatch];
+}
+
+#pragma mark - batched notifications
+
+- (void) setCompletionHandler:(TransfersBlock)completionHandler {
+    @synchronized(self) {
+        _completionHandler = [completionHandler copy];
+    }
+    [self.queue addOperationWithBlock:^{
+        [self scheduleBatch];
+    }];
+}
+
+- (TransfersBlock) completionHandler {
+    @synchronized(self) {
+        return _completionHandler;
+    }
+}
+
+- (void) scheduleBatch {
+    if (self.batchScheduled == NO) {
+        self.batchScheduled = YES;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kBatchDelay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            [self.queue addOperationWithBlock:^{
+                [self reportEndedTransfers];
+            }];
+        });
+    }
+}
+
+- (void) reportEndedTransfers {
+    self.batchScheduled = NO;
+    TransfersBlock completionHandler = self.completionHandler;
+    if (completionHandler == nil) {
+        return; // kept until someone is interested
+    }
+    NSArray * ended;
+    @synchronized(self) {
+        ended = [self.allTransfers filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"state >= %d", (int)CloudTransferStateCompleted]];
+        [self.allTransfers removeObjectsInArray:ended];
+    }
+    if (ended.count > 0) {
+        [self save];
+        [self.manager deliver:^{ completionHandler (ended); } operation:nil];
+    }
+}
+
+- (BOOL) handleEventsForBackgroundURLSession:(NSString*)identifier completionHandler:(void (^)(void))completionHandler {
+    if ([identifier isEqualToString:self.identifier] == NO) {
+        return NO;
+    }
+    self.backgroundEventsHandler = completionHandler;
+    return YES;
+}
+
+- (void) URLSessionDidFinishEventsForBackgroundURLSession:(NSURLSession *)session {
+    [self restartLostTransfers]; // every completion has been reported, the transfers still without a task are lost
+    [self reportEndedTransfers];
+    void (^backgroundEventsHandler)(void) = self.backgroundEventsHandler;
+    self.backgroundEventsHandler = nil;
+    if (backgroundEventsHandler != nil) {
+        // once the completions are delivered, the system can take a new snapshot of the UI and suspend the application
+        [self.manager deliver:backgroundEventsHandler operation:nil];
+    }
+}
+
+#pragma mark - session delegate
+
+- (void) reportProgress:(CloudTransfer*)transfer sent:(int64_t)sent expected:(int64_t)expected {
+    if (transfer == nil || expected <= 0) {
+        return;
+    }
+    transfer.progress = (float)sent / expected;
+    TransferProgressBlock progressHandler = self.progressHandler;
+    if (progressHandler != nil) {
+        [self.manager deliver:^{ progressHandler (transfer); } operation:nil];
+    }
+}
+
+- (void) URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didSendBodyData:(int64_t)bytesSent totalBytesSent:(int64_t)totalBytesSent totalBytesExpectedToSend:(int64_t)totalBytesExpectedToSend {
+    [self reportProgress:[self transferForTask:task] sent:totalBytesSent expected:totalBytesExpectedToSend];
+}
+
+- (void) URLSession:(NSURLSession *)session downloadTask:(NSURLSessionDownloadTask *)downloadTask didWriteData:(int64_t)bytesWritten totalBytesWritten:(int64_t)totalBytesWritten totalBytesExpectedToWrite:(int64_t)totalBytesExpectedToWrite {
+    [self reportProgress:[self transferForTask:downloadTask] sent:totalBytesWritten expected:totalBytesExpectedToWrite];
+}
+
+- (void) URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
+    NSMutableData * response = self.responses[@(dataTask.taskIdentifier)];
+    if (response == nil) {
+        response = [[NSMutableData alloc] init];
+        self.responses[@(dataTask.taskIdentifier)] = response;
+    }
+    [response appendData:data];
+}
+
+- (void) URLSession:(NSURLSession *)session downloadTask:(NSURLSessionDownloadTask *)downloadTask didFinishDownloadingToURL:(NSURL *)location {
+    // the downloaded file is deleted when this method returns, it must be moved now
+    CloudTransfer * transfer = [self transferForTask:downloadTask];
+    NSHTTPURLResponse * response = (NSHTTPURLResponse*)downloadTask.response;
+    if (transfer == nil || self.invalidated) {
+        return;
+    }
+    if (response.statusCode >= 300) {
+        self.responses[@(downloadTask.taskIdentifier)] = [NSMutableData dataWithContentsOfURL:location]; // the error description
+        return;
+    }
+    NSFileManager * fileManager = [NSFileManager defaultManager];
+    [fileManager createDirectoryAtURL:[transfer.fileURL URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+    [fileManager removeItemAtURL:transfer.fileURL error:nil];
+    if ([fileManager moveItemAtURL:location toURL:transfer.fileURL error:nil] == NO) {
+        self.responses[@(downloadTask.taskIdentifier)] = [NSNull null]; // reported as a failure on completion
+    }
+}
+
+- (void) URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error {
+    id data = self.responses[@(task.taskIdentifier)];
+    [self.responses removeObjectForKey:@(task.taskIdentifier)];
+    // matched by task description rather than by task: after a relaunch, the completion of a task of the previous launch can come
+    // before the task is reattached, or instead of it when the task completed while the application was not running
+    CloudTransfer * transfer = [self transferForTask:task];
+    if (transfer == nil || self.invalidated || transfer.state >= CloudTransferStateCompleted || (transfer.task != nil && transfer.task != task)) {
+        return; // cancelled, or restarted in the meantime
+    }
+    transfer.task = nil;
+    NSHTTPURLResponse * response = (NSHTTPURLResponse*)task.response;
+    if (error != nil) {
+        if (transfer.attempts < kMaxAttempts) {
+            NSTimeInterval delay = MIN(kRetryDelay * pow(2, MAX(transfer.attempts - 1, 0)), kMaxRetryDelay);
+            NSLog (@"transfer %@ failed (%@), retrying in %.0f s", transfer.filename, error.localizedDescription, delay);
+            transfer.state = CloudTransferStatePending;
+            transfer.retryDate = [NSDate dateWithTimeIntervalSinceNow:delay];
+            [self save];
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+                [self.queue addOperationWithBlock:^{
+                    if (self.manager.isConnected) {
+                        [self startPendingTransfers];
+                    }
+                }];
+            });
+        } else {
+            [self endTransfer:transfer status:CloudErrorNetworkError];
+        }
+    } else if (response.statusCode >= 300) {
+        CloudStatus status = [CloudUtil statusFromConnection:response data:[data isKindOfClass:[NSData class]] ? data : nil];
+        if (status == CloudErrorSessionExpired || status == ExpiredCredentials) {
+            NSLog (@"transfer %@: session expired, waiting for a new session", transfer.filename);
+            transfer.state = CloudTransferStatePending; // started again by resume, once the session is reopened
+            transfer.attempts = 0;
+            if (transfer.reserved) { // admitted again when started, the free space may have changed meanwhile
+                transfer.reserved = NO;
+                [self.manager.quotaTracker endUploadOfSize:transfer.size status:CloudErrorCancelled];
+            }
+            [self save];
+            if (self.reopeningSession == NO) { // the transfers expiring together wait for the same new session
+                self.reopeningSession = YES;
+                [self.manager reopenSession:^(CloudStatus status) {
+                    [self.queue addOperationWithBlock:^{
+                        self.reopeningSession = NO;
+                    }];
+                }];
+            }
+        } else {
+            [self endTransfer:transfer status:status];
+        }
+    } else if (transfer.kind == CloudTransferKindDownload) {
+        [self endTransfer:transfer status:data == [NSNull null] ? CloudErrorUnknown : StatusOK];
+    } else {
+        NSObject * jsonObject = data == nil ? nil : [NSJSONSerialization JSONObjectWithData:data options:0 error:nil];
+        if ([jsonObject isKindOfClass:[NSDictionary class]] == NO) {
+            [self endTransfer:transfer status:CloudErrorResponseMalformed];
+        } else {
+            NSDictionary * dictionary = (NSDictionary*)jsonObject;
+            CloudItem * file = [[CloudItem alloc] initWithIdentifier:dictionary[@"fileId"] name:dictionary[@"fileName"] type:CloudTypeFile parentIdentifier:transfer.cloudIdentifier];
+            [self.manager.searchIndex addItems:@[file] parent:nil];
+            transfer.cloudItem = file;
+            [self endTransfer:transfer status:StatusOK];
+        }
+    }
+}
+
+@end
@@ -27,4 +27,14 @@
 /** the cloud item to display */
 @property (nonatomic) CloudItem * cloudItem;
 
+/** if set, the requests issued by the cell are added to this group, so that the owning controller can cancel them all at once */
+@property (nonatomic) CloudOperationGroup * operations;
+
+/** YES to only show the cached info of the next item assigned, without requesting what is missing until loadDetails is called.
+ * Typically set while scrolling on a slow link, so that rows passing by do not fill the link with requests */
+@property (nonatomic) BOOL deferDetails;
+
+/** request the file info and thumbnail deferred when the item was assigned, if any */
+- (void) loadDetails;
+
 @end
@@ -24,6 +24,8 @@
 @property (nonatomic) UILabel * date;
 @property (nonatomic) UIImageView * thumbnail;
 @property (nonatomic) UIImageView * indicator;
+@property (nonatomic) CloudOperation * operation; // the pending file info or thumbnail request, cancelled when the cell is reused
+@property (nonatomic) BOOL detailsDeferred; // the requests for the current item wait for loadDetails
 @end
 
 @implementation FileListViewCell
@@ -69,32 +71,38 @@
     return self;
 }
 
+- (UIImage*) defaultIconFor:(CloudItem*)cloudItem {
+    if (cloudItem.type == CloudTypeDirectory) {
+        return [UIImage imageNamed:@"LS_Folder"];
+    } else if (cloudItem.type == CloudTypeImage) {
+        return [UIImage imageNamed:@"FileImage"];
+    } else if (cloudItem.type == CloudTypeVideo) {
+        return [UIImage imageNamed:@"FileVideo"];
+    } else {
+        return [UIImage imageNamed:@"FileDocument"];
+    }
+}
+
 - (void) setIconFor:(CloudItem*)cloudItem withData:(NSData*)data {
     UIImage * image = nil;
     if (data != nil) {
         image = [UIImage imageWithData:data];
     }
     if (image == nil) { // if no data or data is corruped, used a default image
-        if (cloudItem.type == CloudTypeDirectory) {
-            image = [UIImage imageNamed:@"LS_Folder"];
-        } else if (cloudItem.type == CloudTypeImage) {
-            image = [UIImage imageNamed:@"FileImage"];
-        } else if (cloudItem.type == CloudTypeVideo) {
-            image = [UIImage imageNamed:@"FileVideo"];
-        } else {
-            image = [UIImage imageNamed:@"FileDocument"];
-        }
-
+        image = [self defaultIconFor:cloudItem];
     }
-    cloudItem.thumbnail = image;
+    [self.cloudManager setThumbnail:image forItem:cloudItem];
     if (_cloudItem== cloudItem) { // bu sure that cell has not been reused
         self.thumbnail.image = image;
     }
 }
 
 - (void) getThumbnail:(CloudItem*)cloudFile {
-    if (cloudFile.thumbnail == nil) {
-        [self.cloudManager getThumbnail:cloudFile result:^(NSData * data, CloudStatus status) {
+    UIImage * thumbnail = [self.cloudManager thumbnailForItem:cloudFile];
+    if (thumbnail == nil && self.detailsDeferred) {
+        self.thumbnail.image = [self defaultIconFor:cloudFile];
+    } else if (thumbnail == nil) {
+        self.operation = [self.cloudManager getThumbnail:cloudFile result:^(NSData * data, CloudStatus status) {
             if (status == StatusOK) {
                 [self setIconFor:cloudFile withData:data];
             } else {
@@ -102,8 +110,9 @@
                 [self setIconFor:cloudFile withData:nil];
             }
         }];
+        [self.operations addOperation:self.operation];
     } else {
-        self.thumbnail.image = cloudFile.thumbnail;
+        self.thumbnail.image = thumbnail;
     }
 }
 
@@ -133,21 +142,42 @@
 }
 
 - (void) setCloudItem:(CloudItem *)cloudItem {
+    // the cell is being reused: the pending request for the previous item is no longer needed
+    [self.operation cancel];
+    self.operation = nil;
     _cloudItem = cloudItem;
     self.indicator.hidden = YES;
     self.date.hidden = YES;
     self.size.hidden = YES;
     self.thumbnail.image = nil;
-    if (cloudItem.extraInfoAvailable == NO) {
-        [self.cloudManager fileInfo:cloudItem result:^(CloudItem * cloudFile, CloudStatus status ) {
+    self.detailsDeferred = self.deferDetails;
+    [self showDetails];
+}
+
+/** show the info and thumbnail of the item, requesting the missing ones unless the requests are deferred */
+- (void) showDetails {
+    CloudItem * cloudItem = _cloudItem;
+    if (cloudItem.extraInfoAvailable) {
+        [self updateCellInfo:cloudItem];
+    } else if (self.detailsDeferred) {
+        self.name.text = cloudItem.name;
+        self.thumbnail.image = [self defaultIconFor:cloudItem];
+    } else {
+        self.operation = [self.cloudManager fileInfo:cloudItem result:^(CloudItem * cloudFile, CloudStatus status ) {
             if (status == StatusOK) {
                 [self updateCellInfo:cloudFile];
             } else {
                 [self setIconFor:cloudItem withData:nil];
             }
         }];
-    } else {
-        [self updateCellInfo:cloudItem];
+        [self.operations addOperation:self.operation];
+    }
+}
+
+- (void) loadDetails {
+    if (self.detailsDeferred) {
+        self.detailsDeferred = NO;
+        [self showDetails];
     }
 }
 
@@ -29,4 +29,7 @@
 /** refresh folder content */
 - (void) loadContent;
 
+/** remove an entry from the displayed list, e.g. an item deleted through the mutation journal by another controller */
+- (void) removeEntry:(CloudItem*)item;
+
 @end
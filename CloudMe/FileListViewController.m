@@ -20,6 +20,10 @@
 #import "FileListViewCell.h"
 #import "BrowseController.h"
 #import "ImageViewController.h"
+#import "MediaViewController.h"
+#import "CloudSearchIndex.h"
+#import "CloudListingDiff.h"
+#import "CloudBackupEngine.h"
 
 @interface ProgressView : UIView
 @property (nonatomic) double progress;
@@ -78,7 +82,7 @@
 }
 
 @end
-@interface FileListViewController () <UITableViewDataSource, UIAlertViewDelegate, UITableViewDelegate, UIImagePickerControllerDelegate, UINavigationControllerDelegate>
+@interface FileListViewController () <UITableViewDataSource, UIAlertViewDelegate, UITableViewDelegate, UIImagePickerControllerDelegate, UINavigationControllerDelegate, UISearchBarDelegate>
 
 @property (nonatomic) CloudManager * cloudManager; // the cloud session to use
 @property (nonatomic) CloudItem * cloudItem;
@@ -87,12 +91,16 @@
 @property (nonatomic) ProgressView * uploadProgressView;
 
 @property (nonatomic) NSArray * entries;
+@property (nonatomic) UISearchBar * searchBar;
+@property (nonatomic) NSArray * searchResults; // items of the folder tree matching the search bar text, nil when the folder content is displayed
 //@property (nonatomic) UIRefreshControl * refreshControl;
 @property (nonatomic) UIActivityIndicatorView * indicator;
 @property (nonatomic) UIAlertView * createDirAlert;
 @property (nonatomic) UIAlertView * deleteDirAlert;
 @property (nonatomic) UIAlertView * logoutAlert;
 @property (nonatomic) BOOL canReloadContent;
+@property (nonatomic) CloudOperationGroup * operations; // pending read requests, cancelled when the controller is popped
+@property (nonatomic) CloudBackupEngine * backupEngine;
 @end
 
 
@@ -103,6 +111,7 @@
     if (self != nil) {
         self.cloudItem = cloudItem;
         self.cloudManager = manager;
+        self.operations = [[CloudOperationGroup alloc] init];
         if (cloudItem.identifier) {
             self.title = [self title:cloudItem.identifier];
         }
@@ -174,6 +183,13 @@
     self.tableView.rowHeight = 66;
     self.tableView.scrollsToTop = YES;
 
+    // the search covers the whole tree below this folder, as far as it is known by the search index
+    self.searchBar = [[UISearchBar alloc] initWithFrame:CGRectMake(0, 0, self.view.bounds.size.width, 44)];
+    self.searchBar.placeholder = @"Search";
+    self.searchBar.autocapitalizationType = UITextAutocapitalizationTypeNone;
+    self.searchBar.delegate = self;
+    self.tableView.tableHeaderView = self.searchBar;
+
     self.indicator = [[UIActivityIndicatorView alloc] initWithFrame:self.view.bounds];
     self.indicator.backgroundColor = [UIColor colorWithWhite:0 alpha:0.5];
     [self.view addSubview:self.indicator];
@@ -188,8 +204,48 @@
 - (void) viewWillAppear:(BOOL)animated {
     [super viewWillAppear:animated];
     if (self.entries == nil) {
+        // the last listing still in memory is shown at once, and updated when the new one arrives
+        NSArray * cachedListing = [self.cloudManager cachedListingOfFolder:self.cloudItem];
+        if (cachedListing != nil) {
+            [self showEntries:[self.cloudManager.mutationJournal applyToListing:cachedListing folder:self.cloudItem]];
+        }
         [self loadContent];
     }
+    // the visible controller follows the uploads, which go on even if the application is suspended
+    __weak FileListViewController * weakSelf = self;
+    self.cloudManager.transferManager.progressHandler = ^(CloudTransfer * transfer) {
+        if (transfer.kind == CloudTransferKindUpload && [transfer.cloudIdentifier isEqualToString:weakSelf.cloudItem.identifier]) {
+            [weakSelf showProgressIndicator];
+            weakSelf.uploadProgressView.progress = transfer.progress;
+        }
+    };
+    self.cloudManager.transferManager.completionHandler = ^(NSArray * transfers) {
+        [weakSelf transfersDidEnd:transfers];
+    };
+    // a change refused by the server: the real content is listed again, which also brings back the name of an item whose rename was refused
+    self.cloudManager.mutationJournal.failureHandler = ^(CloudMutation * mutation, CloudStatus status) {
+        NSLog (@"***** Change of %@ refused: %@", mutation.name, [CloudManager statusString:status]);
+        [weakSelf loadContent];
+    };
+}
+
+- (void) didReceiveMemoryWarning {
+    [super didReceiveMemoryWarning];
+    // a folder deep in the navigation stack is listed again when shown
+    if (self.isViewLoaded && self.view.window == nil) {
+        [self.operations cancelAll];
+        self.entries = nil;
+        self.searchResults = nil;
+        self.searchBar.text = nil;
+        [self.tableView reloadData];
+    }
+}
+
+- (void) viewWillDisappear:(BOOL)animated {
+    [super viewWillDisappear:animated];
+    if (self.isMovingFromParentViewController) { // listing and thumbnails are useless once the user went back
+        [self.operations cancelAll];
+    }
 }
 
 - (void)scrollViewDidScroll:(UIScrollView *)scrollView {
@@ -202,18 +258,52 @@
 
 - (void)scrollViewDidEndDragging:(UIScrollView *)scrollView willDecelerate:(BOOL)decelerate {
     self.canReloadContent = YES;
+    if (decelerate == NO) {
+        [self loadVisibleCellDetails];
+    }
 }
 
+- (void)scrollViewDidEndDecelerating:(UIScrollView *)scrollView {
+    [self loadVisibleCellDetails];
+}
+
+/** on a slow link the cells shown while scrolling defer their requests: only the ones still visible once the scrolling stops send them */
+- (void) loadVisibleCellDetails {
+    for (UITableViewCell * cell in self.tableView.visibleCells) {
+        if ([cell isKindOfClass:[FileListViewCell class]]) {
+            [(FileListViewCell*)cell loadDetails];
+        }
+    }
+}
+
+
+/** display a new content of the folder, updating only the rows that changed. The cells of unchanged items keep their extra info and thumbnail */
+- (void) showEntries:(NSArray*)items {
+    CloudListingDiff * diff = [CloudListingDiff diffFrom:self.entries to:items];
+    BOOL firstListing = self.entries == nil;
+    self.entries = diff.items;
+    if (firstListing) {
+        [self.tableView reloadData];
+    } else if (self.searchResults == nil) {
+        [diff applyToTableView:self.tableView section:0];
+    }
+}
 
 - (void) loadContent {
+    CloudMutationJournal * journal = self.cloudManager.mutationJournal;
+    if ([CloudMutationJournal isLocalIdentifier:self.cloudItem.identifier]) { // not created on the server yet
+        [self.refreshControl endRefreshing];
+        [self showEntries:[journal applyToListing:@[] folder:self.cloudItem]];
+        return;
+    }
     [self.indicator startAnimating];
-    [self.cloudManager listFolder:self.cloudItem restrictedMode:FALSE showThumbnails:TRUE filter:FilterTypeAll flat:FALSE tree:FALSE limit:0 offset:0 result:^(NSArray * array, CloudStatus status) {
+    [self.operations addOperation:[self.cloudManager listFolder:self.cloudItem restrictedMode:FALSE showThumbnails:TRUE filter:FilterTypeAll flat:FALSE tree:FALSE limit:0 offset:0 result:^(NSArray * array, CloudStatus status) {
         if (status == StatusOK) {
             if (self.refreshControl.isRefreshing) {
                 [self.refreshControl endRefreshing];
             }
-            self.entries = array;
-            [self.tableView reloadData];
+            // the changes not acknowledged by the server yet are shown as done
+            [self showEntries:[journal applyToListing:array folder:self.cloudItem]];
             [self.indicator stopAnimating];
         } else {
             if (self.refreshControl.isRefreshing) {
@@ -223,13 +313,43 @@
             [self.tableView reloadData];
             [self.indicator stopAnimating];
         }
-    }];
+    }]];
+}
+
+#pragma mark - UISearchBarDelegate methods
+
+static const NSUInteger kMaxSearchResults = 200;
+
+/** the items listed by the table */
+- (NSArray*) displayedEntries {
+    return self.searchResults ?: self.entries;
+}
+
+- (void)searchBar:(UISearchBar *)searchBar textDidChange:(NSString *)searchText {
+    // the index answers in a few milliseconds, it is queried on each keystroke
+    if (searchText.length == 0) {
+        self.searchResults = nil;
+    } else {
+        self.searchResults = [self.cloudManager.searchIndex search:searchText filter:FilterTypeAll folder:self.cloudItem limit:kMaxSearchResults] ?: @[];
+    }
+    searchBar.showsCancelButton = self.searchResults != nil;
+    [self.tableView reloadData];
+}
+
+- (void)searchBarSearchButtonClicked:(UISearchBar *)searchBar {
+    [searchBar resignFirstResponder];
+}
+
+- (void)searchBarCancelButtonClicked:(UISearchBar *)searchBar {
+    searchBar.text = nil;
+    [searchBar resignFirstResponder];
+    [self searchBar:searchBar textDidChange:@""];
 }
 
 #pragma mark - UITableViewDelegate & UITableViewDataSource methods
 
 - (NSInteger)tableView:(UITableView *)tableView numberOfRowsInSection:(NSInteger)section {
-    return [self.entries count];
+    return [[self displayedEntries] count];
 }
 
 - (UITableViewCell *)tableView:(UITableView *)tableView cellForRowAtIndexPath:(NSIndexPath *)indexPath {
@@ -241,20 +361,42 @@
 		cell = [[FileListViewCell alloc] initWithStyle:UITableViewCellStyleDefault reuseIdentifier:kCellID];
 	}
     cell.cloudManager = self.cloudManager;
-    cell.cloudItem = (CloudItem*) self.entries[indexPath.row];
+    cell.operations = self.operations;
+    cell.deferDetails = (tableView.dragging || tableView.decelerating) && self.cloudManager.bandwidthEstimator.isSlow;
+    cell.cloudItem = (CloudItem*) [self displayedEntries][indexPath.row];
     return cell;
 }
 
 - (void)tableView:(UITableView *)tableView didSelectRowAtIndexPath:(NSIndexPath *)indexPath {
-    CloudItem * item = (CloudItem*) self.entries[indexPath.row];
+    CloudItem * item = (CloudItem*) [self displayedEntries][indexPath.row];
     if (item.isDirectory) {
         [self.navigationController pushViewController:[[FileListViewController alloc] initWithManager:self.cloudManager item:item] animated:YES];
         [tableView deselectRowAtIndexPath:indexPath animated:YES];
+    } else if (item.type == CloudTypeVideo || item.type == CloudTypeAudio) { // played while downloaded
+        [self.navigationController pushViewController:[[MediaViewController alloc] initWithManager:self.cloudManager item:item] animated:YES];
     } else {
         [self.navigationController pushViewController:[[ImageViewController alloc] initWithManager:self.cloudManager item:item] animated:YES];
     }
 }
 
+- (BOOL)tableView:(UITableView *)tableView canEditRowAtIndexPath:(NSIndexPath *)indexPath {
+    return self.searchResults == nil;
+}
+
+- (void)tableView:(UITableView *)tableView commitEditingStyle:(UITableViewCellEditingStyle)editingStyle forRowAtIndexPath:(NSIndexPath *)indexPath {
+    if (editingStyle == UITableViewCellEditingStyleDelete) {
+        CloudItem * item = (CloudItem*) self.entries[indexPath.row];
+        [self.cloudManager.mutationJournal deleteItem:item];
+        [self removeEntry:item];
+    }
+}
+
+- (void) removeEntry:(CloudItem*)item {
+    NSMutableArray * items = [self.entries mutableCopy];
+    [items removeObject:item];
+    [self showEntries:items];
+}
+
 -(void) tableView:(UITableView *)tableView willDisplayCell:(UITableViewCell *)cell forRowAtIndexPath:(NSIndexPath *)indexPath {
 }
 
@@ -264,34 +406,21 @@
     if (alertView == self.createDirAlert) {
         if (buttonIndex == 1) {
             NSString * name = [alertView textFieldAtIndex:0].text;
-            [self.cloudManager createFolder:name parent:self.cloudItem result:^(CloudItem * item, CloudStatus status) {
-                if (status == StatusOK) {
-                    self.entries = nil;
-                    [self loadContent];
-                } else {
-                    NSLog (@"***** Cannot create directory %@", name);
-                }
-            }];
+            CloudItem * folder = [self.cloudManager.mutationJournal createFolder:name parent:self.cloudItem];
+            [self showEntries:[(self.entries ?: @[]) arrayByAddingObject:folder]];
         }
     } else if (alertView == self.deleteDirAlert) {
         if (buttonIndex == 1) {
-            [self.cloudManager deleteFolder:self.cloudItem result:^(CloudStatus status){
-                if (status == StatusOK) {
-                    NSArray * viewControllers = self.navigationController.viewControllers;
-                    NSInteger index = [viewControllers indexOfObject:self];
-                    if (index != NSNotFound && index > 0) {
-                        UIViewController * previousController = viewControllers[index-1];
-                        if ([previousController isKindOfClass:[FileListViewController class]]) {
-                            [(FileListViewController*)previousController loadContent];
-                        } else {
-                            [self loadContent];
-                        }
-                    }
-                    [self.navigationController popViewControllerAnimated:YES];
-                } else {
-                    NSLog (@"***** Cannot delete directory %@", self.title);
+            [self.cloudManager.mutationJournal deleteItem:self.cloudItem];
+            NSArray * viewControllers = self.navigationController.viewControllers;
+            NSInteger index = [viewControllers indexOfObject:self];
+            if (index != NSNotFound && index > 0) {
+                UIViewController * previousController = viewControllers[index-1];
+                if ([previousController isKindOfClass:[FileListViewController class]]) {
+                    [(FileListViewController*)previousController removeEntry:self.cloudItem];
                 }
-            }];
+            }
+            [self.navigationController popViewControllerAnimated:YES];
         }
     } else if (alertView == self.logoutAlert) {
         if (buttonIndex == 1) {
@@ -354,6 +483,8 @@
         [self logout];
     } else if (buttonIndex == 1) { // info
         [self showInfo];
+    } else if (buttonIndex == 2) { // backup
+        [self backupPhotos];
     } else { // cancel : do nothing
         
     }
@@ -377,10 +508,24 @@
                                                              delegate:self
                                                     cancelButtonTitle:@"Cancel"
                                                destructiveButtonTitle:@"Logout"
-                                                    otherButtonTitles:@"Info", nil];
+                                                    otherButtonTitles:@"Info", self.backupEngine.isRunning ? @"Stop backup" : @"Back up photos", nil];
     [actionSheet showInView:[self.view window]];
 }
 
+/** upload the photos of the camera roll that are not in this folder yet, or stop the backup in progress */
+- (void) backupPhotos {
+    if (self.backupEngine.isRunning) {
+        [self.backupEngine stop];
+        return;
+    }
+    self.backupEngine = [[CloudBackupEngine alloc] initWithManager:self.cloudManager folder:self.cloudItem.identifier];
+    __weak FileListViewController * weakSelf = self;
+    [self.backupEngine start:^(CloudStatus status) {
+        NSString * message = [NSString stringWithFormat:@"%@\n%@", [CloudManager statusString:status], weakSelf.backupEngine.stats];
+        [weakSelf showAlertWithTitle:@"Backup" message:message];
+    }];
+}
+
 
 - (void) showProgressIndicator {
     if (self.uploadProgressView == nil) {
@@ -390,6 +535,31 @@
         self.uploadProgressView.hidden = NO;
     }
 }
+- (void) transfersDidEnd:(NSArray*)transfers {
+    NSMutableArray * uploaded = [[NSMutableArray alloc] init];
+    for (CloudTransfer * transfer in transfers) {
+        if (transfer.kind != CloudTransferKindUpload || [transfer.cloudIdentifier isEqualToString:self.cloudItem.identifier] == NO) {
+            continue;
+        }
+        self.uploadProgressView.hidden = YES;
+        if (transfer.status == StatusOK) {
+            // a file replaced by the upload is already listed
+            if (transfer.cloudItem != nil && [[self.entries valueForKey:@"identifier"] containsObject:transfer.cloudItem.identifier] == NO) {
+                [uploaded addObject:transfer.cloudItem];
+            }
+        } else if (transfer.status != CloudErrorCancelled) {
+            NSString * message = [NSString stringWithFormat:@"Problem uploading image: %@", [CloudManager statusString:transfer.status]];
+            UIAlertView * alert = [[UIAlertView alloc] initWithTitle:@"Uploading failed" message:message delegate:self cancelButtonTitle:@"OK" otherButtonTitles:nil];
+            [alert show];
+            
+            NSLog (@"Probleme uploading image: %@", [CloudManager statusString:transfer.status]);
+        }
+    }
+    if (uploaded.count > 0) { // the new files are shown without listing the folder again
+        [self showEntries:[(self.entries ?: @[]) arrayByAddingObjectsFromArray:uploaded]];
+    }
+}
+
 - (void)imagePickerController:(UIImagePickerController *)picker didFinishPickingMediaWithInfo:(NSDictionary *)info {
     
     NSURL * assetUrl = info[UIImagePickerControllerReferenceURL];
@@ -397,28 +567,18 @@
     [assetslibrary assetForURL:assetUrl
                    resultBlock:^(ALAsset * asset) {
                        ALAssetRepresentation * defaultRepresentation = [asset defaultRepresentation];
-                       Byte * buffer = (Byte*) malloc ((int)defaultRepresentation.size);
-                       NSUInteger buffered = [defaultRepresentation getBytes:buffer fromOffset:0.0 length:(int)defaultRepresentation.size error:nil];
-                       NSData * data = [NSData dataWithBytesNoCopy:buffer length:buffered freeWhenDone:YES];
-                       NSString * filename = defaultRepresentation.filename;
+                       NSString * folderID = self.cloudItem.identifier;
+                       NSUInteger chunkSize = self.cloudManager.bandwidthEstimator.recommendedChunkSize;
                        [self showProgressIndicator];
-                       
-                       [self.cloudManager uploadData:data filename:filename folderID:self.cloudItem.identifier progress:^(float progress) {
-                           self.uploadProgressView.progress = progress;
-                       } result:^(CloudItem * item, CloudStatus status) {
-                           if (status == StatusOK) {
-                               self.entries = nil;
-                               self.uploadProgressView.hidden = YES;
-                               [self loadContent];
-                           } else {
-                               self.uploadProgressView.hidden = YES;
-                               NSString * message = [NSString stringWithFormat:@"Problem uploading image: %@", [CloudManager statusString:status]];
-                               UIAlertView * alert = [[UIAlertView alloc] initWithTitle:@"Uploading failed" message:message delegate:self cancelButtonTitle:@"OK" otherButtonTitles:nil];
-                               [alert show];
-                               
-                               NSLog (@"Probleme uploading image: %@", [CloudManager statusString:status]);
-                           }
-                       }];
+                       self.uploadProgressView.progress = 0;
+                       // a video can be larger than the available memory: it is read by chunks into the upload spool file, away from the main thread
+                       dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                           __unused ALAssetsLibrary * library = assetslibrary; // the representation is valid as long as its library
+                           [self.cloudManager.transferManager uploadContentOfSize:defaultRepresentation.size chunkSize:chunkSize filename:defaultRepresentation.filename folderID:folderID
+                                                                           reader:^NSUInteger(uint8_t * buffer, long long offset, NSUInteger length) {
+                                                                               return [defaultRepresentation getBytes:buffer fromOffset:offset length:length error:nil];
+                                                                           } result:nil];
+                       });
                    }
      
                   failureBlock:^(NSError* error) {
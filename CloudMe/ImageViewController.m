@@ -19,14 +19,20 @@
 #import "CloudManager.h"
 #import "FileListViewController.h"
 
-@interface ImageViewController ()
+@interface ImageViewController () <CloudMemoryConsumer>
 @property (nonatomic) UIImageView * imageView;
 @property (nonatomic) UIActivityIndicatorView * indicator;
 @property (nonatomic) CloudManager * cloudManager;
 @property (nonatomic) CloudItem * cloudItem;
 @property (nonatomic) UIAlertView * deleteFileAlert;
+@property (nonatomic) CloudOperation * contentOperation;
+@property (nonatomic) unsigned long long imageCost; // the size of the decoded image, accounted as a bitmap in the memory governor
+@property (nonatomic) BOOL imageReleased; // the image was dropped while the controller was hidden, it is loaded again when shown
 @end
 
+// the time the user is expected to wait for the image, used to choose between the preview and the full content
+static const NSTimeInterval kMaxDisplayDelay = 2.0;
+
 @implementation ImageViewController
 
 - (id) initWithManager:(CloudManager*)cloudManager item:(CloudItem*)cloudItem {
@@ -37,10 +43,16 @@
         self.cloudItem = cloudItem;
         self.view.hidden = NO;
         self.title = cloudItem.name;
+        [cloudManager.memoryGovernor registerConsumer:self category:CloudMemoryCategoryBitmaps];
     }
     return self;
 }
 
+- (void) dealloc {
+    [_cloudManager.memoryGovernor unregisterConsumer:self];
+    [_cloudManager.memoryGovernor addUsage:-(long long)_imageCost category:CloudMemoryCategoryBitmaps];
+}
+
 - (void)viewDidLoad {
     [super viewDidLoad];
     self.navigationController.toolbarHidden = NO;
@@ -65,36 +77,111 @@
 
     self.view.backgroundColor = [UIColor whiteColor];
     
-    [self.cloudManager getFileContent:self.cloudItem result:^(NSData * data, CloudStatus status) {
+    [self loadBestContent];
+}
+
+- (void) viewWillAppear:(BOOL)animated {
+    [super viewWillAppear:animated];
+    if (self.imageReleased) {
+        self.imageReleased = NO;
+        [self.indicator startAnimating];
+        [self loadBestContent];
+    }
+}
+
+- (void) loadBestContent {
+    // on a slow network, the thumbnail is displayed while the lighter preview is downloaded instead of the full content
+    CloudContentQuality quality = [self.cloudManager.bandwidthEstimator qualityForFileSize:self.cloudItem.size maxDelay:kMaxDisplayDelay];
+    if (quality != CloudContentQualityFull) {
+        [self showImage:[self.cloudManager thumbnailForItem:self.cloudItem]];
+    }
+    [self loadContent:quality == CloudContentQualityFull ? CloudContentQualityFull : CloudContentQualityPreview];
+}
+
+/** display an image, accounting its decoded size in the memory governor */
+- (void) showImage:(UIImage*)image {
+    self.imageView.image = image;
+    unsigned long long cost = image == nil ? 0 : CGImageGetBytesPerRow(image.CGImage) * CGImageGetHeight(image.CGImage);
+    [self.cloudManager.memoryGovernor addUsage:(long long)cost - (long long)self.imageCost category:CloudMemoryCategoryBitmaps];
+    self.imageCost = cost;
+}
+
+/** the image redrawn at the resolution of the screen, or the image itself if it is not larger */
+- (UIImage*) screenSizedImage:(UIImage*)image {
+    CGFloat screenScale = [UIScreen mainScreen].scale;
+    CGSize bounds = self.view.bounds.size;
+    CGFloat ratio = MIN(bounds.width * screenScale / (image.size.width * image.scale), bounds.height * screenScale / (image.size.height * image.scale));
+    if (ratio >= 1) {
+        return image;
+    }
+    CGSize size = CGSizeMake(floor(image.size.width * image.scale * ratio / screenScale), floor(image.size.height * image.scale * ratio / screenScale));
+    UIGraphicsBeginImageContextWithOptions(size, YES, screenScale);
+    [image drawInRect:CGRectMake(0, 0, size.width, size.height)];
+    UIImage * screenSizedImage = UIGraphicsGetImageFromCurrentImageContext();
+    UIGraphicsEndImageContext();
+    return screenSizedImage;
+}
+
+/** a full resolution photo can weigh tens of megabytes once decoded: a visible image is reduced to the screen resolution, a hidden one is dropped */
+- (void) releaseImageMemory {
+    if (self.isViewLoaded == NO || self.imageView.image == nil) {
+        return;
+    }
+    if (self.view.window == nil) {
+        [self.contentOperation cancel];
+        [self showImage:nil];
+        self.imageReleased = YES;
+    } else {
+        [self showImage:[self screenSizedImage:self.imageView.image]];
+    }
+}
+
+- (void) evictMemory:(unsigned long long)bytes {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [self releaseImageMemory];
+    });
+}
+
+- (void) loadContent:(CloudContentQuality)quality {
+    DataBlock result = ^(NSData * data, CloudStatus status) {
         if (status == StatusOK) {
             [self.indicator stopAnimating];
-            self.imageView.image = [UIImage imageWithData:data];
+            [self showImage:[UIImage imageWithData:data]];
+        } else if (quality == CloudContentQualityPreview) { // the preview could not be generated
+            [self loadContent:CloudContentQualityFull];
         } else {
             [self.indicator stopAnimating];
             NSLog (@"Error during file content retrieval: %@", [CloudManager statusString:status]);
         }
-    }];
+    };
+    if (quality == CloudContentQualityPreview && self.cloudItem.previewURL != nil) {
+        self.contentOperation = [self.cloudManager getPreview:self.cloudItem result:result];
+    } else {
+        self.contentOperation = [self.cloudManager getFileContent:self.cloudItem result:result];
+    }
+}
 
+- (void) viewWillDisappear:(BOOL)animated {
+    [super viewWillDisappear:animated];
+    if (self.isMovingFromParentViewController) { // user backed out before the end of the download
+        [self.contentOperation cancel];
+    }
 }
 
 -(void)alertView:(UIAlertView *)alertView clickedButtonAtIndex:(NSInteger)buttonIndex{
     if (alertView == self.deleteFileAlert) {
         if (buttonIndex == 1) {
-            [self.cloudManager deleteFile:self.cloudItem result:^(CloudStatus status){
-                if (status == StatusOK) {
-                    NSArray * viewControllers = self.navigationController.viewControllers;
-                    NSInteger index = [viewControllers indexOfObject:self];
-                    if (index != NSNotFound && index > 0) {
-                        UIViewController * previousController = viewControllers[index-1];
-                        if ([previousController isKindOfClass:[FileListViewController class]]) {
-                        [(FileListViewController*)previousController loadContent];
-                        }
-                    }
-                    [self.navigationController popViewControllerAnimated:YES];
-                } else {
-                    NSLog (@"***** Cannot delete file %@", self.title);
+            // the journal sends the deletion in the background, and the list is listed again if the server refuses it
+            [self.cloudManager.mutationJournal deleteItem:self.cloudItem];
+            NSArray * viewControllers = self.navigationController.viewControllers;
+            NSInteger index = [viewControllers indexOfObject:self];
+            if (index != NSNotFound && index > 0) {
+                UIViewController * previousController = viewControllers[index-1];
+                if ([previousController isKindOfClass:[FileListViewController class]]) {
+                    [(FileListViewController*)previousController removeEntry:self.cloudItem];
                 }
-            }];
+            }
+            [self.navigationController popViewControllerAnimated:YES];
         }
     }
 }
@@ -106,7 +193,7 @@
 
 - (void)didReceiveMemoryWarning {
     [super didReceiveMemoryWarning];
-    // Dispose of any resources that can be recreated.
+    [self releaseImageMemory];
 }
 //- (void) setImageData:(NSData*)data {
 //    self.imageView.image = [UIImage imageWithData:data];
@@ -0,0 +1,29 @@
+/*
+ Copyright (C) 2015 Orange
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#import <UIKit/UIKit.h>
+#import "CloudManager.h"
+
+/** This class plays an audio or video file of the cloud while it is downloaded */
+
+@interface MediaViewController : UIViewController
+
+/** Initialize the controller with the current cloud session and the cloud item to play.
+ * @warning the cloud item must be of type Video or Audio
+ */
+- (id) initWithManager:(CloudManager*)cloudManager item:(CloudItem*)cloudItem;
+
+@end
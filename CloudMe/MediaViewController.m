@@ -0,0 +1,64 @@
+/*
+ Copyright (C) 2015 Orange
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#import "MediaViewController.h"
+#import "CloudMediaLoader.h"
+#import <AVKit/AVKit.h>
+
+@interface MediaViewController ()
+@property (nonatomic) CloudManager * cloudManager;
+@property (nonatomic) CloudItem * cloudItem;
+@property (nonatomic) CloudMediaLoader * loader; // kept alive while the asset is played
+@property (nonatomic) AVPlayerViewController * playerController;
+@end
+
+@implementation MediaViewController
+
+- (id) initWithManager:(CloudManager*)cloudManager item:(CloudItem*)cloudItem {
+    self = [super initWithNibName:nil bundle:nil];
+    if (self) {
+        self.cloudManager = cloudManager;
+        self.cloudItem = cloudItem;
+        self.title = cloudItem.name;
+    }
+    return self;
+}
+
+- (void)viewDidLoad {
+    [super viewDidLoad];
+    self.view.backgroundColor = [UIColor blackColor];
+
+    self.loader = [[CloudMediaLoader alloc] initWithManager:self.cloudManager item:self.cloudItem];
+    self.playerController = [[AVPlayerViewController alloc] init];
+    self.playerController.player = [AVPlayer playerWithPlayerItem:[AVPlayerItem playerItemWithAsset:self.loader.asset]];
+    [self addChildViewController:self.playerController];
+    self.playerController.view.frame = self.view.bounds;
+    self.playerController.view.autoresizingMask = UIViewAutoresizingFlexibleWidth | UIViewAutoresizingFlexibleHeight;
+    [self.view addSubview:self.playerController.view];
+    [self.playerController didMoveToParentViewController:self];
+    [self.playerController.player play];
+}
+
+- (void) viewWillDisappear:(BOOL)animated {
+    [super viewWillDisappear:animated];
+    if (self.isMovingFromParentViewController) {
+        [self.playerController.player pause];
+        [self.loader invalidate];
+    }
+}
+
+@end
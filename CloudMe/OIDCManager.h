@@ -18,6 +18,8 @@
 #import <UIKit/UIKit.h>
 #import "CloudStatus.h"
 
+@class CloudConnectionPool;
+
 ///** List of error codes that are used when an error occured during the authentication phase.
 // */
 //typedef enum {
@@ -86,6 +88,15 @@ typedef void (^AuthenticationCheck)(NSString * authorizationCode);
  */
 - (id) initWithAppKey:(NSString*)appKey appSecret:(NSString*) appSecret redirectURI:(NSString*)redirectURI;
 
+/** create a connection manager for one of several accounts. The refresh token is stored under keys specific to the account,
+ * so that managers of different accounts never use each other's token.
+ * @param account a name identifying the account in the application, nil for the keys of a single account application
+ */
+- (id) initWithAppKey:(NSString*)appKey appSecret:(NSString*) appSecret redirectURI:(NSString*)redirectURI account:(NSString*)account;
+
+/** the pool in which the token requests are sent. Default value is the default pool */
+@property (nonatomic) CloudConnectionPool * connectionPool;
+
 /** Start the whole authentication process. This method should be called only when an error occured but can be fixed before restarting the process.
  * It is mostly a convenience method to avoid poping and pushing back this controller.
  */
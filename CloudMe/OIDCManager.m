@@ -54,6 +54,10 @@ static NSString * kAuthenticationRevoked = @"authenticationRevokedKey";
 /** the refresh token retrieved during the first login/passwd authentication */
 @property (nonatomic) NSString * refreshToken;
 
+// the user defaults keys of the refresh token and of the revocation flag, specific to the account
+@property (nonatomic) NSString * refreshTokenKey;
+@property (nonatomic) NSString * authenticationRevokedKey;
+
 // the web view used for the registration process
 @property (nonatomic) UIWebView * webView;
 
@@ -74,6 +78,10 @@ static NSString * kAuthenticationRevoked = @"authenticationRevokedKey";
 //}
 
 - (id)initWithAppKey:(NSString *)appKey appSecret:(NSString *)appSecret redirectURI:(NSString *)redirectURI {
+    return [self initWithAppKey:appKey appSecret:appSecret redirectURI:redirectURI account:nil];
+}
+
+- (id)initWithAppKey:(NSString *)appKey appSecret:(NSString *)appSecret redirectURI:(NSString *)redirectURI account:(NSString *)account {
     self = [super initWithNibName:nil bundle:nil];
     if (self) {
         // Custom initialization
@@ -87,9 +95,12 @@ static NSString * kAuthenticationRevoked = @"authenticationRevokedKey";
         self.response_type = @"code";
         self.state = @"state";
 
+        // without account, the keys are the ones of the previous versions, so that a single account application keeps its token
+        self.refreshTokenKey = account == nil ? kRefreshToken : [NSString stringWithFormat:@"%@.%@", kRefreshToken, account];
+        self.authenticationRevokedKey = account == nil ? kAuthenticationRevoked : [NSString stringWithFormat:@"%@.%@", kAuthenticationRevoked, account];
         NSUserDefaults * defaults= [NSUserDefaults standardUserDefaults];
-        _authenticationRevoked = [defaults boolForKey:kAuthenticationRevoked];
-        _refreshToken = [defaults valueForKey:kRefreshToken];
+        _authenticationRevoked = [defaults boolForKey:self.authenticationRevokedKey];
+        _refreshToken = [defaults valueForKey:self.refreshTokenKey];
         self.connectingExternally = NO;
     }
     return self;
@@ -240,14 +251,14 @@ NSString* encodeToPercentEscapeString(NSString *string) {
 - (void) setRefreshToken:(NSString *)refreshToken {
     _refreshToken = refreshToken;
     NSUserDefaults * defaults= [NSUserDefaults standardUserDefaults];
-    [defaults setObject:self.refreshToken forKey:kRefreshToken];
+    [defaults setObject:self.refreshToken forKey:self.refreshTokenKey];
     [defaults synchronize];
 }
 
 - (void) setAuthenticationRevoked:(BOOL)authenticationRevoked {
     _authenticationRevoked = authenticationRevoked;
     NSUserDefaults * defaults= [NSUserDefaults standardUserDefaults];
-    [defaults setBool:self.authenticationRevoked forKey:kAuthenticationRevoked];
+    [defaults setBool:self.authenticationRevoked forKey:self.authenticationRevokedKey];
     [defaults synchronize];
 }
 
@@ -307,7 +318,8 @@ typedef enum {
     NSURLRequest * request = [self createGetTokenRequestWidthType:grantType code:code];
     
     // make the request asynchronously
-    [CloudConnection sendAsynchronousRequest:request queue:[NSOperationQueue mainQueue] message:TRACE_BANDWIDTH_USAGE ? @"Get Token" : nil completionHandler:^(NSURLResponse *response, NSData *data, NSError *connectionError) {
+    [CloudConnection sendAsynchronousRequest:request pool:self.connectionPool queue:[NSOperationQueue mainQueue] message:TRACE_BANDWIDTH_USAGE ? @"Get Token" : nil
+                             progressHandler:nil completionHandler:^(NSURLResponse *response, NSData *data, NSError *connectionError) {
         [[NSOperationQueue mainQueue] addOperationWithBlock:^{
             if (connectionError == nil) {
                 // no error, so the token should be there,
@@ -19,5 +19,10 @@
 //
 
 #import "CloudManager.h"
+#import "CloudSearchIndex.h"
+#import "CloudBackupEngine.h"
+#import "CloudMediaLoader.h"
+#import "CloudQuotaTracker.h"
+#import "CloudConnection.h"
 #import "FileListViewController.h"
 #import "ImageViewController.h"
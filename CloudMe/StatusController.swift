@@ -50,6 +50,17 @@ class StatusController : UIViewController {
         ("rename directory", renameDirectory),
         ("list folder" , listFolder),
         ("copy file", copyFile),
+        ("download thumbnails in parallel", getThumbnailsInParallel),
+        ("list folder by pages", listFolderByPages),
+        ("search index benchmark", searchIndexBenchmark),
+        ("search index removal during load", searchIndexRemovalDuringLoad),
+        ("camera roll backup", cameraRollBackup),
+        ("stream media by ranges", streamMediaRanges),
+        ("memory governor eviction order", memoryGovernorEviction),
+        ("quota admission and packing", quotaAdmission),
+        ("compressed listing", compressedListing),
+        ("parallel accounts", parallelAccounts),
+        ("interrupted upload", interruptedUpload),
         ("rename file", renameFile),
         ("get file information" , getFileInfo),
         ("download file" , downloadFile),
@@ -62,7 +73,7 @@ class StatusController : UIViewController {
     private let label = UILabel ()
 
     private var testItems = [TestItem]()
-    private var currentItem = 0
+    private var testGroup : CloudTaskGroup?
     
     private let scrollview = UIScrollView ()
     
@@ -146,33 +157,38 @@ class StatusController : UIViewController {
         scrollview.scrollRectToVisible(item.frame, animated: true)
     }
     
-    func performNextTest () {
-        currentItem += 1
-        if currentItem < testItems.count {
-            let item = testItems[currentItem]
-            ensureItemIsDisplayed(item)
-            item.state = .InProgress
-            let startingDate = NSDate ()
-            if let selector = item.closure {
-                selector (context: testContext) { state in
-                    NSOperationQueue.mainQueue().addOperationWithBlock() {
-                        item.state = state
-                        if item.duration == 0 {
-                            let duration = NSDate().timeIntervalSinceDate(startingDate)
-                            stats.addStat(duration, forTest: item.name)
-                            item.duration = duration
-                        }
+    func performTest (item : TestItem, done : () -> Void) {
+        ensureItemIsDisplayed(item)
+        item.state = .InProgress
+        let startingDate = NSDate ()
+        if let selector = item.closure {
+            selector (context: testContext) { state in
+                NSOperationQueue.mainQueue().addOperationWithBlock() {
+                    item.state = state
+                    if item.duration == 0 {
+                        let duration = NSDate().timeIntervalSinceDate(startingDate)
+                        stats.addStat(duration, forTest: item.name)
+                        item.duration = duration
                     }
-                    self.performNextTest()
+                    done ()
                 }
             }
+        } else {
+            done ()
         }
     }
     
     func performTests () {
-        currentItem = -1
-        performNextTest ()
-        
+        // tests depend on each other, run them one at a time
+        testGroup?.cancel ()
+        let group = CloudTaskGroup (maxConcurrentTasks: 1)
+        for item in testItems {
+            group.addTask { done in
+                self.performTest (item, done: done)
+                return nil
+            }
+        }
+        testGroup = group
     }
     
     func clearStats () {
@@ -251,6 +251,515 @@ func deleteFolder (context : TestContext, result : (TestState)->Void) {
     }
 }
 
+func getThumbnailsInParallel (context : TestContext, result : (TestState)->Void) {
+    if let folder = context.testFolder {
+        context.manager.listFolder(folder, restrictedMode: false, showThumbnails: true, filter: .All, flat: false, tree: false, limit: 0, offset: 0) { items, status in
+            let files = ((items as? [CloudItem]) ?? []).filter { $0.isDirectory == false }
+            if status != StatusOK || files.count == 0 {
+                result (.Failed)
+                return
+            }
+            var succeeded = 0
+            let group = context.manager.getThumbnails(files, maxConcurrentTasks: 4) { item, data, status in
+                if status == StatusOK {
+                    succeeded += 1
+                }
+            }
+            group.notify {
+                result (succeeded == files.count ? .Succeeded : (succeeded > 0 ? .Partial : .Failed))
+            }
+        }
+    } else {
+        result (.Failed)
+    }
+}
+
+func listFolderByPages (context : TestContext, result : (TestState)->Void) {
+    if let folder = context.testFolder {
+        let pager = CloudListingPager (manager: context.manager, folder: folder, pageSize: 1)
+        var count = 0
+        pager.forEachPage ({ items in
+            count += items.count
+            return true
+        }) { status in
+            result (status == StatusOK && count > 0 ? .Succeeded : .Failed)
+        }
+    } else {
+        result (.Failed)
+    }
+}
+
+/** index 100k synthetic names in a separate index, and check that substring queries answer in a few milliseconds */
+func searchIndexBenchmark (context : TestContext, result : (TestState)->Void) {
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0)) {
+        let index = CloudSearchIndex ()
+        let words = ["holiday", "beach", "Été", "family", "report", "invoice", "birthday", "concert", "résumé", "budget"]
+        let types = [CloudTypeImage, CloudTypeVideo, CloudTypeAudio, CloudTypeFile]
+        var items = [CloudItem] ()
+        for i in 0..<100000 {
+            let name = "\(words[i % words.count]) \(words[(i / words.count) % words.count]) \(i).jpg"
+            items.append (CloudItem (identifier: "id\(i)", name: name, type: types[i % types.count], parentIdentifier: "folder\(i / 100)"))
+        }
+        var start = CFAbsoluteTimeGetCurrent()
+        index.addItems(items, parent: nil)
+        let indexingTime = CFAbsoluteTimeGetCurrent() - start
+        items.removeAll()
+
+        var found = 0
+        start = CFAbsoluteTimeGetCurrent()
+        let queries = ["beach", "ete", "RESUME", "day con", "invoice 4242", "123", "zz"]
+        for query in queries {
+            found += index.search(query, filter: .All, folder: nil, limit: 100).count
+            found += index.search(query, filter: .Image, folder: nil, limit: 100).count
+        }
+        let queryTime = (CFAbsoluteTimeGetCurrent() - start) * 1000 / Double (2 * queries.count)
+        let bytesPerItem = Double (index.estimatedMemoryUsage) / Double (index.count)
+        stats.addStat(queryTime, forTest: "search query (ms)")
+        print ("searchIndexBenchmark: \(index.count) items indexed in \(indexingTime) s, \(queryTime) ms per query, \(Int (bytesPerItem)) bytes per item")
+        dispatch_async(dispatch_get_main_queue()) {
+            result (found > 0 && queryTime < 10 ? .Succeeded : (found > 0 ? .Partial : .Failed))
+        }
+    }
+}
+
+/** remove a file and a folder from an index while its saved version is loading: neither they nor the content of the folder come back */
+func searchIndexRemovalDuringLoad (context : TestContext, result : (TestState)->Void) {
+    let url = NSURL (fileURLWithPath: NSTemporaryDirectory()).URLByAppendingPathComponent("CloudSearchIndexTombstones.plist")
+    let _ = try? NSFileManager.defaultManager().removeItemAtURL(url)
+    let folder = CloudItem (identifier: "tombstoneFolder", name: "tombstone folder", type: CloudTypeDirectory, parentIdentifier: "tombstoneRoot")
+    let removed = CloudItem (identifier: "tombstoneRemoved", name: "tombstone removed.jpg", type: CloudTypeImage, parentIdentifier: "tombstoneRoot")
+    // the child comes first, as saved items may precede their folder
+    let saved = CloudSearchIndex (URL: url)
+    saved.addItems([CloudItem (identifier: "tombstoneChild", name: "tombstone child.jpg", type: CloudTypeImage, parentIdentifier: folder.identifier),
+        folder, removed, CloudItem (identifier: "tombstoneKept", name: "tombstone kept.jpg", type: CloudTypeImage, parentIdentifier: "tombstoneRoot")], parent: nil)
+    if saved.save() == false {
+        result (.Failed)
+        return
+    }
+    let index = CloudSearchIndex (URL: url)
+    index.removeItem(folder)
+    index.removeItem(removed)
+    waitUntil ({ index.count > 0 }, timeout: 5) { loaded in
+        let names = index.search("tombstone", filter: .All, folder: nil, limit: 0).map { $0.name ?? "" }
+        let _ = try? NSFileManager.defaultManager().removeItemAtURL(url)
+        result (loaded && index.count == 1 && names == ["tombstone kept.jpg"] ? .Succeeded : .Failed)
+    }
+}
+
+/** back up up to 1,000 assets of the camera roll into the test folder, with a separate index so that every run uploads them */
+func cameraRollBackup (context : TestContext, result : (TestState)->Void) {
+    if let folder = context.testFolder {
+        let indexURL = NSURL (fileURLWithPath: NSTemporaryDirectory()).URLByAppendingPathComponent("CloudBackupTest.plist")
+        let engine = CloudBackupEngine (manager: context.manager, folder: folder.identifier, indexURL: indexURL)
+        engine.resetIndex()
+        engine.maxAssets = 1000
+        engine.start { status in
+            if let backupStats = engine.stats {
+                stats.addStat(backupStats.throughput / 1024, forTest: "backup throughput (kB/s)")
+                stats.addStat(Double (backupStats.peakMemory) / 1048576, forTest: "backup peak memory (MB)")
+                print ("cameraRollBackup: \(backupStats)")
+            }
+            result (status == StatusOK ? .Succeeded : (engine.stats?.uploadedCount > 0 ? .Partial : .Failed))
+        }
+    } else {
+        result (.Failed)
+    }
+}
+
+/** the answer of a stub host: an HTTP response, or a failure of the request when error is set */
+struct StubResponse {
+    let statusCode : Int
+    let headers : [String : String]
+    let body : NSData
+    let error : NSError?
+
+    init (statusCode : Int = 200, headers : [String : String] = [:], body : NSData = NSData (), error : NSError? = nil) {
+        self.statusCode = statusCode
+        self.headers = headers
+        self.body = body
+        self.error = error
+    }
+}
+
+/** serves the hosts registered with stubHost, so that scenarios run without a server. The handler of a host is called on the loading thread
+ * for each request, and answers it once, possibly later */
+class StubProtocol : NSURLProtocol {
+    typealias Handler = (NSURLRequest, (StubResponse)->Void) -> Void
+    static var handlers = [String : Handler] () // by host, guarded by lock
+    static var registered = false
+    static let lock = NSLock ()
+
+    /** answer the requests to a host with the handler, or stop answering them when it is nil */
+    class func stubHost (host : String, handler : Handler?) {
+        lock.lock()
+        handlers[host] = handler
+        if !registered {
+            registered = true
+            NSURLProtocol.registerClass(StubProtocol.self)
+        }
+        lock.unlock()
+    }
+
+    class func handlerForRequest (request : NSURLRequest) -> Handler? {
+        lock.lock()
+        defer { lock.unlock() }
+        return request.URL?.host.flatMap { handlers[$0] }
+    }
+
+    override class func canInitWithRequest (request: NSURLRequest) -> Bool {
+        return handlerForRequest(request) != nil
+    }
+
+    override class func canonicalRequestForRequest (request: NSURLRequest) -> NSURLRequest {
+        return request
+    }
+
+    override func startLoading () {
+        guard let handler = StubProtocol.handlerForRequest(request) else {
+            client?.URLProtocol(self, didFailWithError: NSError (domain: NSURLErrorDomain, code: NSURLErrorCannotConnectToHost, userInfo: nil))
+            return
+        }
+        handler (request) { answer in
+            if let error = answer.error {
+                self.client?.URLProtocol(self, didFailWithError: error)
+                return
+            }
+            let response = NSHTTPURLResponse (URL: self.request.URL!, statusCode: answer.statusCode, HTTPVersion: "HTTP/1.1", headerFields: answer.headers)!
+            self.client?.URLProtocol(self, didReceiveResponse: response, cacheStoragePolicy: .NotAllowed)
+            // by chunks, as received from the network
+            var offset = 0
+            while offset < answer.body.length {
+                let length = min (16 * 1024, answer.body.length - offset)
+                self.client?.URLProtocol(self, didLoadData: answer.body.subdataWithRange(NSMakeRange(offset, length)))
+                offset += length
+            }
+            self.client?.URLProtocolDidFinishLoading(self)
+        }
+    }
+
+    override func stopLoading () {
+    }
+}
+
+/** play a content from a local stub serving ranges: a seek is served without downloading what precedes it, and a range already read is served from the cache */
+func streamMediaRanges (context : TestContext, result : (TestState)->Void) {
+    let bytes = (0..<2_500_000).map { UInt8 (truncatingBitPattern: $0 &* 31) }
+    let content = NSData (bytes: bytes, length: bytes.count)
+    var ranges = [NSRange] () // the ranges served so far, guarded by lock
+    let lock = NSLock ()
+    // honour the Range header as the content server does
+    StubProtocol.stubHost("range.stub") { request, respond in
+        var start = 0
+        var end = content.length - 1
+        var statusCode = 200
+        var headers = ["Content-Type" : "application/octet-stream"]
+        if let range = request.valueForHTTPHeaderField("Range") where range.hasPrefix("bytes=") {
+            let bounds = range.substringFromIndex(range.startIndex.advancedBy(6)).componentsSeparatedByString("-")
+            start = Int (bounds[0]) ?? 0
+            if let last = Int (bounds[1]) {
+                end = min (last, end)
+            }
+            statusCode = 206
+            headers["Content-Range"] = "bytes \(start)-\(end)/\(content.length)"
+        }
+        let range = NSMakeRange(start, end - start + 1)
+        lock.lock()
+        ranges.append (range)
+        lock.unlock()
+        respond (StubResponse (statusCode: statusCode, headers: headers, body: content.subdataWithRange(range)))
+    }
+    let cacheURL = NSURL (fileURLWithPath: NSTemporaryDirectory()).URLByAppendingPathComponent("CloudMediaTest.mp4")
+    let loader = CloudMediaLoader (manager: context.manager, URL: "http://range.stub/media.mp4", filename: "media.mp4", cacheURL: cacheURL)
+    loader.cache.removeAllData()
+    let seek = NSMakeRange(2_000_000, 300_000)
+    let requestsOverlappingSeek = { () -> Int in
+        lock.lock()
+        defer { lock.unlock() }
+        return ranges.filter { NSIntersectionRange($0, seek).length > 0 }.count
+    }
+    let start = CFAbsoluteTimeGetCurrent()
+    loader.readDataAtOffset(1000, length: 5000) { data, offset, totalLength, status in
+        stats.addStat((CFAbsoluteTimeGetCurrent() - start) * 1000, forTest: "media first bytes (ms)")
+        let firstRead = status == StatusOK && totalLength == Int64 (content.length) && data == content.subdataWithRange(NSMakeRange(1000, 5000))
+        loader.readDataAtOffset(Int64 (seek.location), length: seek.length) { data, offset, totalLength, status in
+            let seekRequests = requestsOverlappingSeek ()
+            loader.readDataAtOffset(Int64 (seek.location), length: seek.length) { cachedData, _, _, cachedStatus in
+                let succeeded = firstRead && status == StatusOK && data == content.subdataWithRange(seek) && cachedStatus == StatusOK && cachedData == data
+                    && requestsOverlappingSeek () == seekRequests
+                print ("streamMediaRanges: \(loader.requestCount) range requests, \(requestsOverlappingSeek ()) for the seek")
+                loader.invalidate()
+                StubProtocol.stubHost("range.stub", handler: nil)
+                result (succeeded ? .Succeeded : .Failed)
+            }
+        }
+    }
+}
+
+/** fill caches of each category past the limits of a private governor: bitmaps are evicted first, then thumbnails, and listings last.
+ * Then a response buffer larger than the limits is in flight: the caches, within the limits, are kept */
+func memoryGovernorEviction (context : TestContext, result : (TestState)->Void) {
+    let governor = CloudMemoryGovernor ()
+    governor.softLimit = 4 * 1024 * 1024
+    governor.hardLimit = 8 * 1024 * 1024
+    let bitmaps = CloudMemoryCache (category: .Bitmaps, governor: governor)
+    let thumbnails = CloudMemoryCache (category: .Thumbnails, governor: governor)
+    let listings = CloudMemoryCache (category: .Listings, governor: governor)
+    for i in 0..<32 {
+        listings.setObject(NSNull (), forKey: "listing\(i)", cost: 64 * 1024)
+        thumbnails.setObject(NSNull (), forKey: "thumbnail\(i)", cost: 64 * 1024)
+    }
+    // 4 MB of listings and thumbnails: the bitmaps push the usage over the hard limit, which trims synchronously
+    for i in 0..<32 {
+        bitmaps.setObject(NSNull (), forKey: "bitmap\(i)", cost: 256 * 1024)
+    }
+    let usage = [CloudMemoryCategory.Bitmaps, .Thumbnails, .Listings].map { governor.usageForCategory($0) }
+    print ("memoryGovernorEviction: \(governor)")
+    let withinLimits = governor.totalUsage <= governor.hardLimit
+    let inOrder = listings.objectForKey("listing0") != nil && usage[2] == 32 * 64 * 1024 && usage[0] < 32 * 256 * 1024
+    let wait = { (then : ()->Void) in
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, Int64 (200 * NSEC_PER_MSEC)), dispatch_get_main_queue(), then)
+    }
+    wait { // the background trims scheduled by the bitmaps are over
+        let cached = governor.totalUsage
+        let buffer : Int64 = 16 * 1024 * 1024
+        governor.addUsage(buffer, category: .Buffers)
+        wait {
+            let kept = governor.totalUsage == cached + UInt64 (buffer)
+            print ("memoryGovernorEviction: with a buffer in flight \(governor)")
+            governor.addUsage(-buffer, category: .Buffers)
+            result (withinLimits && inOrder && kept ? .Succeeded : .Failed)
+        }
+    }
+}
+
+/** fetch the free space, then check that a batch is packed smallest first within it, and that an admitted upload reserves its size until it ends */
+func quotaAdmission (context : TestContext, result : (TestState)->Void) {
+    let tracker = context.manager.quotaTracker
+    tracker.revalidate() { status in
+        let available = tracker.availableSpace
+        guard status == StatusOK && available >= 0 else {
+            result (.Failed)
+            return
+        }
+        let sizes : [NSNumber] = [NSNumber (longLong: available / 2), NSNumber (longLong: available), NSNumber (longLong: available / 4), NSNumber (longLong: available / 4)]
+        let packed = tracker.packUploadsOfSizes(sizes)
+        let tooLarge = tracker.admitUploadOfSize(available + 1)
+        let admitted = tracker.admitUploadOfSize(available / 2)
+        let reserved = tracker.reservedSpace
+        tracker.endUploadOfSize(available / 2, status: CloudErrorCancelled)
+        print ("quotaAdmission: \(available) bytes available, packed \(packed)")
+        let succeeded = packed.count == 3 && !packed.containsIndex(1) && tooLarge == .NoSpaceLeft && admitted == .Admitted
+            && reserved >= available / 2 && tracker.availableSpace == available
+        result (succeeded ? .Succeeded : .Failed)
+    }
+}
+
+/** a representative folder listing, as the API server returns it */
+let stubListing : NSData = {
+    let prefix = "https://cloudapi.orange.com/cloud/v1/files"
+    var files = [[String : AnyObject]] ()
+    for i in 0..<2000 {
+        let id = "Lw\(String (i * 7919, radix: 36))MTQ2MzA0NTIwMDAwMA"
+        files.append (["id" : id, "name" : "IMG_\(1000 + i).JPG", "size" : 1_500_000 + i * 37, "creationDate" : "2016-05-\(10 + i % 18)T10:12:\(10 + i % 50)Z",
+            "downloadUrl" : "\(prefix)/\(id)/content", "thumbUrl" : "\(prefix)/\(id)/thumbnail", "previewUrl" : "\(prefix)/\(id)/preview"])
+    }
+    return try! NSJSONSerialization.dataWithJSONObject(["id" : "Lw", "name" : "/", "files" : files], options: [])
+}()
+
+/** fetch a listing from a local stub gzip encoded, then plain: the decoded bodies are the same, and the bytes on the wire and coding times are recorded */
+func compressedListing (context : TestContext, result : (TestState)->Void) {
+    let encodedListing = CloudCompression.gzipData(stubListing)!
+    // gzip encoded when the request accepts it, as the API server does
+    StubProtocol.stubHost("gzip.stub") { request, respond in
+        let encoded = request.valueForHTTPHeaderField("Accept-Encoding")?.containsString("gzip") ?? false
+        let body = encoded ? encodedListing : stubListing
+        var headers = ["Content-Type" : "application/json", "Content-Length" : "\(body.length)"]
+        if encoded {
+            headers["Content-Encoding"] = "gzip"
+        }
+        respond (StubResponse (headers: headers, body: body))
+    }
+    let traffic = CloudConnection.trafficStats()
+    let fetch = { (acceptEncoding : String, done : (NSData?, Int64, NSTimeInterval)->Void) in
+        let request = NSMutableURLRequest (URL: NSURL (string: "http://gzip.stub/listing")!)
+        request.setValue(acceptEncoding, forHTTPHeaderField: "Accept-Encoding")
+        let wireBytes = traffic.receivedWireBytes
+        let codingTime = traffic.codingTime
+        CloudConnection.sendAsynchronousRequest(request, queue: NSOperationQueue.mainQueue(), message: nil) { response, data, error in
+            done (error == nil ? data : nil, traffic.receivedWireBytes - wireBytes, traffic.codingTime - codingTime)
+        }
+    }
+    fetch ("gzip, deflate") { encodedData, encodedWireBytes, decodingTime in
+        fetch ("identity") { plainData, plainWireBytes, _ in
+            StubProtocol.stubHost("gzip.stub", handler: nil)
+            let start = CFAbsoluteTimeGetCurrent()
+            let encoded = CloudCompression.gzipData(stubListing)
+            stats.addStat((CFAbsoluteTimeGetCurrent() - start) * 1000, forTest: "listing gzip encoding (ms)")
+            stats.addStat(decodingTime * 1000, forTest: "listing gzip decoding (ms)")
+            stats.addStat(Double (encodedWireBytes) / 1024, forTest: "listing gzip on the wire (kB)")
+            stats.addStat(Double (plainWireBytes) / 1024, forTest: "listing plain on the wire (kB)")
+            print ("compressedListing: \(plainWireBytes) bytes plain, \(encodedWireBytes) bytes gzip, decoded in \(Int (decodingTime * 1000)) ms")
+            let succeeded = encoded != nil && encodedData != nil && encodedData == stubListing && plainData == stubListing
+                && encodedWireBytes < plainWireBytes / 4
+            result (succeeded ? .Succeeded : .Failed)
+        }
+    }
+}
+
+/** remove what a manager of the account may have stored: its tokens in the user defaults, and the files named after the account */
+func removeAccountState (account : String) {
+    let defaults = NSUserDefaults.standardUserDefaults()
+    defaults.removeObjectForKey("refreshTokenKey.\(account)")
+    defaults.removeObjectForKey("authenticationRevokedKey.\(account)")
+    defaults.synchronize()
+    let suffix = account.stringByAddingPercentEncodingWithAllowedCharacters(NSCharacterSet.alphanumericCharacterSet())!
+    let fileManager = NSFileManager.defaultManager()
+    let caches = fileManager.URLsForDirectory(.CachesDirectory, inDomains: .UserDomainMask).first!
+    let support = fileManager.URLsForDirectory(.ApplicationSupportDirectory, inDomains: .UserDomainMask).first!
+    let transfers = "\(NSBundle.mainBundle().bundleIdentifier ?? "").CloudTransfers-\(suffix)"
+    let urls = [caches.URLByAppendingPathComponent("CloudContent-\(suffix)"), caches.URLByAppendingPathComponent("CloudSearchIndex-\(suffix).plist"),
+                caches.URLByAppendingPathComponent("CloudMedia-\(suffix)"), support.URLByAppendingPathComponent("CloudMutations-\(suffix).plist"),
+                support.URLByAppendingPathComponent("CloudBackup-\(suffix)"), support.URLByAppendingPathComponent("CloudTransfers").URLByAppendingPathComponent(transfers)]
+    for url in urls {
+        _ = try? fileManager.removeItemAtURL(url)
+    }
+}
+
+/** two managers of different accounts fetch from a local stub at the same time: each one keeps its own concurrency limit and counters,
+ * the account limited to one request at a time does not delay the other one, and their persisted state has different names */
+func parallelAccounts (context : TestContext, result : (TestState)->Void) {
+    let body = NSData (bytes: [UInt8] (count: 64 * 1024, repeatedValue: 42), length: 64 * 1024)
+    var running = [String : Int] () // guarded by lock
+    var maxRunning = [String : Int] ()
+    let lock = NSLock ()
+    // answer after a short delay, recording how many requests of each account (the first path component) are in flight at once
+    StubProtocol.stubHost("accounts.stub") { request, respond in
+        let account = request.URL?.pathComponents?[1] ?? ""
+        lock.lock()
+        running[account] = (running[account] ?? 0) + 1
+        maxRunning[account] = max (maxRunning[account] ?? 0, running[account]!)
+        lock.unlock()
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, Int64 (50 * NSEC_PER_MSEC)), dispatch_get_global_queue(QOS_CLASS_UTILITY, 0)) {
+            lock.lock()
+            running[account] = (running[account] ?? 1) - 1
+            lock.unlock()
+            respond (StubResponse (headers: ["Content-Type" : "application/octet-stream"], body: body))
+        }
+    }
+    let alice = CloudManager (appKey: "key", appSecret: "secret", redirectURI: "test://callback", account: "alice")
+    let bob = CloudManager (appKey: "key", appSecret: "secret", redirectURI: "test://callback", account: "bob@example.com")
+    alice.bandwidthEstimator.maxConcurrency = 1
+    bob.bandwidthEstimator.minConcurrency = 4
+    let defaultBytes = CloudConnection.trafficStats().receivedBytes
+    let requestCount = 8
+    var remaining = 2 * requestCount
+    var durations = [String : CFAbsoluteTime] ()
+    let start = CFAbsoluteTimeGetCurrent()
+    for (name, manager) in [("alice", alice), ("bob", bob)] {
+        for i in 0..<requestCount {
+            let request = NSMutableURLRequest (URL: NSURL (string: "http://accounts.stub/\(name)/\(i)")!)
+            CloudConnection.sendAsynchronousRequest(request, pool: manager.connectionPool, queue: NSOperationQueue.mainQueue(), message: nil, progressHandler: nil) { response, data, error in
+                durations[name] = CFAbsoluteTimeGetCurrent() - start
+                remaining -= 1
+                guard remaining == 0 else {
+                    return
+                }
+                StubProtocol.stubHost("accounts.stub", handler: nil)
+                lock.lock()
+                let inFlight = maxRunning
+                lock.unlock()
+                stats.addStat(durations["alice"]! * 1000, forTest: "account limited to 1 request (ms)")
+                stats.addStat(durations["bob"]! * 1000, forTest: "account limited to 4 requests (ms)")
+                print ("parallelAccounts: in flight at once \(inFlight), alice \(alice.trafficStats), bob \(bob.trafficStats)")
+                let bytes = Int64 (requestCount * body.length)
+                let isolated = inFlight["alice"] == 1 && inFlight["bob"] > 1 && durations["bob"] < durations["alice"]
+                    && alice.trafficStats.receivedBytes == bytes && bob.trafficStats.receivedBytes == bytes
+                    && CloudConnection.trafficStats().receivedBytes == defaultBytes
+                    && alice.searchIndex?.url != bob.searchIndex?.url
+                removeAccountState ("alice")
+                removeAccountState ("bob@example.com")
+                result (isolated ? .Succeeded : .Failed)
+            }
+        }
+    }
+}
+
+/** check the condition on the main queue until it holds or the timeout expires, then call done with its last value */
+func waitUntil (condition : ()->Bool, timeout : NSTimeInterval, done : (Bool)->Void) {
+    if condition () || timeout <= 0 {
+        done (condition ())
+        return
+    }
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, Int64 (100 * NSEC_PER_MSEC)), dispatch_get_main_queue()) {
+        waitUntil (condition, timeout: timeout - 0.1, done: done)
+    }
+}
+
+/** upload through a local stub whose first attempt fails, then kill the transfer manager while the second attempt is in flight: the retry waits
+ * for its delay, and the manager created next with the same identifier starts the lost upload again, which completes exactly once */
+func interruptedUpload (context : TestContext, result : (TestState)->Void) {
+    let identifier = "test.interruptedUpload"
+    let support = NSFileManager.defaultManager().URLsForDirectory(.ApplicationSupportDirectory, inDomains: .UserDomainMask).first!
+    let directory = support.URLByAppendingPathComponent("CloudTransfers").URLByAppendingPathComponent(identifier)
+    _ = try? NSFileManager.defaultManager().removeItemAtURL(directory)
+    var attempts = [CFAbsoluteTime] () // guarded by lock
+    let lock = NSLock ()
+    let attemptCount = { () -> Int in
+        lock.lock()
+        defer { lock.unlock() }
+        return attempts.count
+    }
+    StubProtocol.stubHost("cloudapi.orange.com") { request, respond in
+        lock.lock()
+        attempts.append (CFAbsoluteTimeGetCurrent())
+        let attempt = attempts.count
+        lock.unlock()
+        if attempt == 1 {
+            respond (StubResponse (error: NSError (domain: NSURLErrorDomain, code: NSURLErrorNetworkConnectionLost, userInfo: nil)))
+        } else if attempt > 2 { // the second attempt is never answered: the application is killed meanwhile
+            let body = try! NSJSONSerialization.dataWithJSONObject(["fileId" : "interrupted\(attempt)", "fileName" : "interrupted.txt"], options: [])
+            respond (StubResponse (headers: ["Content-Type" : "application/json"], body: body))
+        }
+    }
+    let configuration = NSURLSessionConfiguration.defaultSessionConfiguration()
+    configuration.protocolClasses = [StubProtocol.self]
+    var firstCompletions = [CloudTransfer] ()
+    var completions = [CloudTransfer] ()
+    // the upload must be admitted at once, rather than waiting for the free space
+    context.manager.quotaTracker.revalidate() { _ in
+        let first = CloudTransferManager (manager: context.manager, identifier: identifier, configuration: configuration)
+        first.completionHandler = { transfers in firstCompletions += transfers }
+        let transfer = first.uploadData("interrupted".dataUsingEncoding(NSUTF8StringEncoding)!, filename: "interrupted.txt", folderID: "Lw")
+        first.resume()
+        waitUntil ({ attemptCount () >= 2 }, timeout: 10) { retried in
+            first.invalidate()
+            let second = CloudTransferManager (manager: context.manager, identifier: identifier, configuration: configuration)
+            second.completionHandler = { transfers in completions += transfers }
+            waitUntil ({ completions.count > 0 }, timeout: 20) { _ in
+                // a duplicate would come within the same delays
+                dispatch_after(dispatch_time(DISPATCH_TIME_NOW, Int64 (2 * NSEC_PER_SEC)), dispatch_get_main_queue()) {
+                    StubProtocol.stubHost("cloudapi.orange.com", handler: nil)
+                    lock.lock()
+                    let times = attempts
+                    lock.unlock()
+                    let retryDelay = times.count > 1 ? times[1] - times[0] : 0
+                    stats.addStat(retryDelay * 1000, forTest: "transfer retry delay (ms)")
+                    print ("interruptedUpload: \(times.count) attempts, retried after \(Int (retryDelay * 1000)) ms, completions \(completions)")
+                    let succeeded = retried && times.count == 3 && retryDelay >= 1.5 && firstCompletions.isEmpty && second.transfers.isEmpty
+                        && completions.count == 1 && completions[0].identifier == transfer.identifier && completions[0].status == StatusOK
+                        && completions[0].cloudItem?.identifier == "interrupted3"
+                    if let item = completions.first?.cloudItem {
+                        context.manager.searchIndex?.removeItem(item)
+                    }
+                    second.invalidate()
+                    _ = try? NSFileManager.defaultManager().removeItemAtURL(directory)
+                    result (succeeded ? .Succeeded : .Failed)
+                }
+            }
+        }
+    }
+}
+
 func blindTest (context : TestContext, result : (TestState)->Void) {
     print ("blindTest")
     result (.Failed)